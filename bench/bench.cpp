@@ -0,0 +1,1116 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define LODEPNG_NO_COMPILE_CPP
+#include "../crunch/third_party/lodepng.h"
+#include "../crunch/atlas.hpp"
+#include "../crunch/atlas_reader.hpp"
+#include "../crunch/binary.hpp"
+#include "../crunch/bitmap.hpp"
+#include "../crunch/buffer.hpp"
+#include "../crunch/mapped.hpp"
+#include "../crunch/options.hpp"
+#include "../crunch/packer.hpp"
+#include "../crunch/parallel.hpp"
+#include "../crunch/pipeline.hpp"
+#include "../crunch/qoi.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Deterministic generator, so every run and every commit measures the same data
+struct Random
+{
+    uint64_t state;
+
+    uint32_t Next()
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<uint32_t>(state >> 33);
+    }
+
+    int Range(int low, int high)
+    {
+        return low + static_cast<int>(Next() % static_cast<uint32_t>(high - low + 1));
+    }
+};
+
+// Soft shaded blob on a transparent background, roughly what a sprite looks like
+static vector<uint8_t> MakeSprite(Random &random, int width, int height)
+{
+    vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    uint8_t r = random.Next(), g = random.Next(), b = random.Next();
+    float cx = width / 2.0f, cy = height / 2.0f;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            float dx = (x - cx) / cx, dy = (y - cy) / cy, d = dx * dx + dy * dy;
+            uint8_t *p = pixels.data() + (static_cast<size_t>(y) * width + x) * 4;
+            if (d >= 1.0f)
+                continue;
+            float shade = 1.0f - d * 0.5f;
+            p[0] = static_cast<uint8_t>(r * shade) ^ (random.Next() & 3);
+            p[1] = static_cast<uint8_t>(g * shade);
+            p[2] = static_cast<uint8_t>(b * shade);
+            p[3] = d > 0.9f ? 128 : 255;
+        }
+    return pixels;
+}
+
+// One measurement, all of them are written to the --json file so runs of different commits can be compared
+struct Result
+{
+    string benchmark;
+    string set;
+    string phase;
+    double ms;
+    vector<pair<string, double>> values;
+};
+
+static vector<Result> results;
+
+static void Record(const string &benchmark, const string &set, const string &phase, double seconds,
+                   vector<pair<string, double>> values = {})
+{
+    results.push_back({benchmark, set, phase, seconds * 1000.0, move(values)});
+}
+
+static void SaveResults(const string &file)
+{
+    FILE *stream = fopen(file.data(), "w");
+    if (!stream)
+    {
+        cerr << "failed to save results: " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stream, "{\n\t\"threads\": %d,\n\t\"results\": [", WorkerCount());
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        auto &result = results[i];
+        fprintf(stream, "%s\n\t\t{\"benchmark\": \"%s\", \"set\": \"%s\", \"phase\": \"%s\", \"ms\": %.3f", i > 0 ? "," : "",
+                result.benchmark.data(), result.set.data(), result.phase.data(), result.ms);
+        for (auto &[key, value] : result.values)
+            fprintf(stream, ", \"%s\": %.10g", key.data(), value);
+        fprintf(stream, "}");
+    }
+    fprintf(stream, "\n\t]\n}\n");
+    fclose(stream);
+}
+
+static double Time(const function<void()> &body)
+{
+    auto start = chrono::steady_clock::now();
+    body();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static uintmax_t DirectorySize(const fs::path &root)
+{
+    uintmax_t size = 0;
+    for (auto &entry : fs::recursive_directory_iterator(root))
+        if (entry.is_regular_file())
+            size += entry.file_size();
+    return size;
+}
+
+// Writes the same sprite set as png and qoi and runs decode -> pack -> compose -> encode for both
+static void BenchCodecs(const fs::path &root, int count)
+{
+    Random random{42};
+    fs::create_directories(root / "png");
+    fs::create_directories(root / "qoi");
+    for (int i = 0; i < count; ++i)
+    {
+        int w = random.Range(8, 96), h = random.Range(8, 96);
+        auto pixels = MakeSprite(random, w, h);
+        string name = "sprite" + to_string(i);
+        lodepng_encode32_file((root / "png" / (name + ".png")).string().data(), pixels.data(), w, h);
+        QoiEncodeFile((root / "qoi" / (name + ".qoi")).string(), pixels.data(), w, h);
+    }
+
+    printf("%-6s %12s %12s %12s %12s %12s\n", "format", "input bytes", "decode ms", "pack ms", "encode ms", "output bytes");
+    for (const string format : {"png", "qoi"})
+    {
+        vector<Bitmap *> bitmaps;
+        double decode = Time([&]()
+                             {
+            for (auto &entry : fs::directory_iterator(root / format))
+            {
+                string error;
+                auto bitmap = Bitmap::Decode(entry.path().string(), entry.path().stem().string(), false, true, error);
+                if (!bitmap)
+                {
+                    cerr << error << endl;
+                    exit(EXIT_FAILURE);
+                }
+                bitmaps.push_back(bitmap);
+            } });
+
+        vector<Packer *> packers;
+        double pack = Time([&]()
+                           {
+            while (!bitmaps.empty())
+            {
+                auto packer = new Packer(4096, 4096, 1, 0, 1);
+                packer->Pack(bitmaps, false, false, MaxRectsBinPack::RectBestShortSideFit);
+                packers.push_back(packer);
+            } });
+
+        fs::path output = root / ("atlas." + format);
+        double encode = Time([&]()
+                             {
+            if (format == "png")
+                packers[0]->SavePng(output.string(), PixelFormat::RGBA8, Dither::None);
+            else
+                packers[0]->SaveQoi(output.string()); });
+
+        printf("%-6s %12ju %12.2f %12.2f %12.2f %12ju\n", format.data(), DirectorySize(root / format), decode * 1000.0, pack * 1000.0,
+               encode * 1000.0, static_cast<uintmax_t>(fs::file_size(output)));
+        Record("codecs", format, "decode", decode, {{"bytes", static_cast<double>(DirectorySize(root / format))}});
+        Record("codecs", format, "pack", pack);
+        Record("codecs", format, "encode", encode, {{"bytes", static_cast<double>(fs::file_size(output))}});
+
+        for (auto packer : packers)
+        {
+            for (auto bitmap : packer->bitmaps)
+                delete bitmap;
+            delete packer;
+        }
+    }
+}
+
+// Looks up every image of a large binary atlas by name: mapped v1 hash index vs. loading into a map
+static void BenchLookup(const fs::path &root, int count)
+{
+    Random random{7};
+    vector<AtlasTexture> textures(count / 1000 + 1);
+    vector<string> names;
+    for (int i = 0; i < count; ++i)
+    {
+        auto &texture = textures[i / 1000];
+        texture.name = "atlas" + to_string(i / 1000);
+        names.push_back("characters/enemy" + to_string(random.Next() % 1000) + "/frame" + to_string(i));
+        texture.images.push_back({names.back(), random.Range(0, 4000), random.Range(0, 4000), random.Range(1, 64), random.Range(1, 64), 0, 0, 64, 64, false, {}});
+    }
+
+    fs::create_directories(root);
+    string file = (root / "atlas.bin").string();
+    SaveAtlasBin(file, textures, true, false, false);
+
+    // Visit the names in a shuffled order so the lookups don't walk memory linearly
+    for (size_t i = names.size() - 1; i > 0; --i)
+        swap(names[i], names[random.Next() % (i + 1)]);
+
+    long long checksum = 0;
+    crunch::AtlasReader reader;
+    unique_ptr<MappedFile> mapped;
+    double open = Time([&]()
+                       {
+        mapped = make_unique<MappedFile>(file);
+        reader.Open(mapped->data, mapped->size); });
+    double lookup = Time([&]()
+                         {
+        for (auto &name : names)
+            checksum += reader.Find(name)->x; });
+
+    unordered_map<string, AtlasImage> map;
+    double load = Time([&]()
+                       {
+        vector<AtlasTexture> loaded;
+        LoadAtlasBin(file, loaded);
+        for (auto &texture : loaded)
+            for (auto &image : texture.images)
+                map.emplace(image.name, image); });
+    double mapLookup = Time([&]()
+                            {
+        for (auto &name : names)
+            checksum -= map.find(name)->second.x; });
+
+    printf("%-14s %10s %14s %14s\n", "lookup", "images", "open ms", "ns per lookup");
+    printf("%-14s %10d %14.3f %14.1f\n", "v1 mmap", count, open * 1000.0, lookup * 1e9 / count);
+    printf("%-14s %10d %14.3f %14.1f\n", "unordered_map", count, load * 1000.0, mapLookup * 1e9 / count);
+    Record("lookup", "v1 mmap", "open", open);
+    Record("lookup", "v1 mmap", "lookup", lookup, {{"images", count}});
+    Record("lookup", "unordered_map", "open", load);
+    Record("lookup", "unordered_map", "lookup", mapLookup, {{"images", count}});
+    if (checksum != 0)
+        printf("lookup mismatch\n");
+}
+
+// Writes xml, json and bin metadata for many sprites, compared with streaming every field to an ofstream
+static void BenchMetadata(const fs::path &root, int count)
+{
+    Random random{11};
+    vector<Packer *> packers;
+    for (int i = 0; i < count; ++i)
+    {
+        if (i % 1000 == 0)
+            packers.push_back(new Packer(4096, 4096, 1, 0, 1));
+        auto bitmap = new Bitmap(1, 1);
+        bitmap->name = "characters/enemy" + to_string(random.Next() % 1000) + "/frame" + to_string(i);
+        bitmap->width = random.Range(1, 256);
+        bitmap->height = random.Range(1, 256);
+        bitmap->frameX = -random.Range(0, 8);
+        bitmap->frameY = -random.Range(0, 8);
+        bitmap->frameW = bitmap->width + 16;
+        bitmap->frameH = bitmap->height + 16;
+        packers.back()->bitmaps.push_back(bitmap);
+        packers.back()->points.push_back({random.Range(0, 4000), random.Range(0, 4000), -1, (random.Next() & 1) != 0});
+    }
+    fs::create_directories(root);
+
+    double stream = Time([&]()
+                         {
+        ofstream xml((root / "stream.xml").string());
+        for (int t = 0; t < packers.size(); ++t)
+        {
+            auto packer = packers[t];
+            xml << "\t<tex n=\"atlas" << t << "\">" << endl;
+            for (int i = 0; i < packer->bitmaps.size(); ++i)
+            {
+                auto bitmap = packer->bitmaps[i];
+                xml << "\t\t<img n=\"" << bitmap->name << "\" ";
+                xml << "x=\"" << packer->points[i].x << "\" ";
+                xml << "y=\"" << packer->points[i].y << "\" ";
+                xml << "w=\"" << bitmap->width << "\" ";
+                xml << "h=\"" << bitmap->height << "\" ";
+                xml << "fx=\"" << bitmap->frameX << "\" ";
+                xml << "fy=\"" << bitmap->frameY << "\" ";
+                xml << "fw=\"" << bitmap->frameW << "\" ";
+                xml << "fh=\"" << bitmap->frameH << "\" ";
+                xml << "r=\"" << (packer->points[i].rot ? 1 : 0) << "\" ";
+                xml << "/>" << endl;
+            }
+            xml << "\t</tex>" << endl;
+        } });
+
+    auto saveAll = [&](const string &file, void (Packer::*save)(const string &, Buffer &, bool, bool, bool))
+    {
+        vector<Buffer> textures(packers.size());
+        ParallelFor(static_cast<int>(packers.size()), [&](int t)
+                    { (packers[t]->*save)("atlas" + to_string(t), textures[t], true, true, false); });
+        Buffer output;
+        for (auto &texture : textures)
+            output.Append(texture);
+        output.Save((root / file).string());
+    };
+    double xml = Time([&]()
+                      { saveAll("buffered.xml", &Packer::SaveXml); });
+    double json = Time([&]()
+                       { saveAll("buffered.json", &Packer::SaveJson); });
+    double bin = Time([&]()
+                      { saveAll("buffered.bin", &Packer::SaveBin); });
+
+    printf("%-16s %10s %12s %12s\n", "metadata", "images", "ms", "bytes");
+    printf("%-16s %10d %12.2f %12ju\n", "ofstream xml", count, stream * 1000.0, static_cast<uintmax_t>(fs::file_size(root / "stream.xml")));
+    printf("%-16s %10d %12.2f %12ju\n", "buffered xml", count, xml * 1000.0, static_cast<uintmax_t>(fs::file_size(root / "buffered.xml")));
+    printf("%-16s %10d %12.2f %12ju\n", "buffered json", count, json * 1000.0, static_cast<uintmax_t>(fs::file_size(root / "buffered.json")));
+    printf("%-16s %10d %12.2f %12ju\n", "buffered bin", count, bin * 1000.0, static_cast<uintmax_t>(fs::file_size(root / "buffered.bin")));
+    Record("metadata", "ofstream", "xml", stream, {{"images", count}});
+    Record("metadata", "buffered", "xml", xml, {{"images", count}});
+    Record("metadata", "buffered", "json", json, {{"images", count}});
+    Record("metadata", "buffered", "bin", bin, {{"images", count}});
+
+    for (auto packer : packers)
+    {
+        for (auto bitmap : packer->bitmaps)
+            delete bitmap;
+        delete packer;
+    }
+}
+
+// A generated sprite set, the sprites are kept as .png bytes so decoding is measured without the disk
+struct SpriteSet
+{
+    string name;
+    vector<vector<uint8_t>> pngs;
+};
+
+static void AddSprite(SpriteSet &set, const vector<uint8_t> &pixels, int width, int height)
+{
+    unsigned char *png;
+    size_t size;
+    lodepng_encode32(&png, &size, pixels.data(), width, height);
+    set.pngs.emplace_back(png, png + size);
+    free(png);
+}
+
+// Sprite with a transparent margin of up to a quarter of its size on every side, so trimming has work to do
+static vector<uint8_t> MakePaddedSprite(Random &random, int width, int height)
+{
+    int left = random.Range(0, width / 4), right = random.Range(0, width / 4);
+    int top = random.Range(0, height / 4), bottom = random.Range(0, height / 4);
+    int innerWidth = max(1, width - left - right), innerHeight = max(1, height - top - bottom);
+    auto inner = MakeSprite(random, innerWidth, innerHeight);
+    vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    for (int y = 0; y < innerHeight; ++y)
+        memcpy(pixels.data() + (static_cast<size_t>(y + top) * width + left) * 4, inner.data() + static_cast<size_t>(y) * innerWidth * 4,
+               static_cast<size_t>(innerWidth) * 4);
+    return pixels;
+}
+
+// Opaque noisy gradient, compresses about as badly as painted backgrounds do
+static vector<uint8_t> MakeBackground(Random &random, int width, int height)
+{
+    vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    uint8_t r = random.Next(), g = random.Next(), b = random.Next();
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            uint8_t *p = pixels.data() + (static_cast<size_t>(y) * width + x) * 4;
+            p[0] = static_cast<uint8_t>(r + x * 255 / width) ^ (random.Next() & 7);
+            p[1] = static_cast<uint8_t>(g + y * 255 / height) ^ (random.Next() & 7);
+            p[2] = static_cast<uint8_t>(b + (x + y) * 127 / (width + height));
+            p[3] = 255;
+        }
+    return pixels;
+}
+
+static vector<SpriteSet> MakeSpriteSets()
+{
+    vector<SpriteSet> sets(4);
+    Random random{1234};
+
+    sets[0].name = "tiny";
+    for (int i = 0; i < 3000; ++i)
+    {
+        int w = random.Range(4, 16), h = random.Range(4, 16);
+        AddSprite(sets[0], MakePaddedSprite(random, w, h), w, h);
+    }
+
+    sets[1].name = "mixed";
+    for (int i = 0; i < 1000; ++i)
+    {
+        // Mostly small sprites with a few big ones, like characters next to their effects
+        int limit = random.Range(0, 9) == 0 ? 256 : 64;
+        int w = random.Range(8, limit), h = random.Range(8, limit);
+        AddSprite(sets[1], MakePaddedSprite(random, w, h), w, h);
+    }
+
+    sets[2].name = "backgrounds";
+    for (int i = 0; i < 12; ++i)
+    {
+        int w = random.Range(256, 1024), h = random.Range(256, 1024);
+        AddSprite(sets[2], MakeBackground(random, w, h), w, h);
+    }
+
+    // Animation frames that repeat, 2000 sprites out of 100 different ones
+    sets[3].name = "duplicates";
+    SpriteSet unique;
+    for (int i = 0; i < 100; ++i)
+    {
+        int w = random.Range(16, 64), h = random.Range(16, 64);
+        AddSprite(unique, MakePaddedSprite(random, w, h), w, h);
+    }
+    for (int i = 0; i < 2000; ++i)
+        sets[3].pngs.push_back(unique.pngs[random.Range(0, 99)]);
+
+    return sets;
+}
+
+// Times every phase of a packing on its own: the steps that a Bitmap does while loading, the
+// packing with every heuristic, and the output of the pages and the metadata
+static void BenchPhases(const fs::path &root)
+{
+    const pair<const char *, MaxRectsBinPack::FreeRectChoiceHeuristic> heuristics[] = {
+        {"bssf", MaxRectsBinPack::RectBestShortSideFit},
+        {"blsf", MaxRectsBinPack::RectBestLongSideFit},
+        {"baf", MaxRectsBinPack::RectBestAreaFit},
+        {"blr", MaxRectsBinPack::RectBottomLeftRule},
+        {"cpr", MaxRectsBinPack::RectContactPointRule}};
+
+    Options previous = options;
+    options.binary = true;
+    options.xml = true;
+    options.json = true;
+    options.unique = true;
+    options.trim = true;
+
+    printf("%-12s %-12s %12s  %s\n", "set", "phase", "ms", "result");
+    auto print = [](const Result &result)
+    {
+        printf("%-12s %-12s %12.2f ", result.set.data(), result.phase.data(), result.ms);
+        for (auto &[key, value] : result.values)
+            printf(" %s=%.10g", key.data(), value);
+        printf("\n");
+    };
+
+    for (auto &set : MakeSpriteSets())
+    {
+        size_t first = results.size(), count = set.pngs.size();
+        double inputBytes = 0;
+        for (auto &png : set.pngs)
+            inputBytes += png.size();
+
+        vector<uint32_t *> pixels(count);
+        vector<int> widths(count), heights(count);
+        double decode = Time([&]()
+                             {
+            for (size_t i = 0; i < count; ++i)
+            {
+                unsigned char *data;
+                unsigned int w, h;
+                lodepng_decode32(&data, &w, &h, set.pngs[i].data(), set.pngs[i].size());
+                pixels[i] = reinterpret_cast<uint32_t *>(data);
+                widths[i] = static_cast<int>(w);
+                heights[i] = static_cast<int>(h);
+            } });
+        Record("phases", set.name, "decode", decode, {{"images", count}, {"bytes", inputBytes}});
+
+        double premultiply = Time([&]()
+                                  {
+            for (size_t i = 0; i < count; ++i)
+                PremultiplyPixels(pixels[i], static_cast<size_t>(widths[i]) * heights[i]); });
+        Record("phases", set.name, "premultiply", premultiply);
+
+        double trimmedArea = 0, area = 0;
+        double trim = Time([&]()
+                           {
+            for (size_t i = 0; i < count; ++i)
+            {
+                int minX, minY, maxX, maxY;
+                if (FindOpaqueBounds(pixels[i], widths[i], heights[i], minX, minY, maxX, maxY))
+                    trimmedArea += static_cast<double>(maxX - minX + 1) * (maxY - minY + 1);
+                area += static_cast<double>(widths[i]) * heights[i];
+            } });
+        Record("phases", set.name, "trim", trim, {{"trimmed_area", trimmedArea / area}});
+
+        // The bitmaps take over the pixels, they were premultiplied above already
+        vector<Bitmap *> bitmaps(count);
+        for (size_t i = 0; i < count; ++i)
+            bitmaps[i] = new Bitmap(pixels[i], widths[i], heights[i], "sprite" + to_string(i), false, true);
+
+        uint64_t checksum = 0;
+        double hash = Time([&]()
+                           {
+            for (auto bitmap : bitmaps)
+                checksum ^= HashPixels(bitmap->data, bitmap->width, bitmap->height); });
+        Record("phases", set.name, "hash", hash);
+
+        // Same lookup the packer does with --unique
+        int duplicates = 0;
+        double dedup = Time([&]()
+                            {
+            unordered_map<uint64_t, Bitmap *> lookup;
+            for (auto bitmap : bitmaps)
+            {
+                auto found = lookup.find(bitmap->hashValue);
+                if (found != lookup.end() && bitmap->Equals(found->second))
+                    ++duplicates;
+                else
+                    lookup.emplace(bitmap->hashValue, bitmap);
+            } });
+        Record("phases", set.name, "dedup", dedup, {{"duplicates", duplicates}});
+
+        vector<Packer *> packers;
+        for (auto &[name, heuristic] : heuristics)
+        {
+            vector<Packer *> pages;
+            string error;
+            options.choiceHeuristic = heuristic;
+            double pack = Time([&]()
+                               { PackBitmaps(bitmaps, set.name, pages, error); });
+
+            double used = 0, total = 0;
+            for (auto page : pages)
+            {
+                total += static_cast<double>(page->width) * page->height;
+                for (size_t i = 0; i < page->bitmaps.size(); ++i)
+                    if (page->points[i].dupID < 0)
+                        used += static_cast<double>(page->bitmaps[i]->width) * page->bitmaps[i]->height;
+            }
+            Record("phases", set.name, string("pack ") + name, pack,
+                   {{"pages", pages.size()}, {"occupancy", total > 0 ? used / total : 0}});
+
+            if (packers.empty())
+                packers = move(pages);
+            else
+                for (auto page : pages)
+                    delete page;
+        }
+        options.choiceHeuristic = previous.choiceHeuristic;
+
+        vector<Bitmap *> composed;
+        double compose = Time([&]()
+                              {
+            for (auto packer : packers)
+            {
+                composed.push_back(new Bitmap(packer->width, packer->height));
+                packer->Compose(*composed.back());
+            } });
+        Record("phases", set.name, "compose", compose, {{"pages", packers.size()}});
+
+        double outputBytes = 0;
+        double encode = Time([&]()
+                             {
+            for (auto bitmap : composed)
+            {
+                unsigned char *png;
+                size_t size;
+                lodepng_encode32(&png, &size, reinterpret_cast<unsigned char *>(bitmap->data), bitmap->width, bitmap->height);
+                outputBytes += size;
+                free(png);
+            } });
+        Record("phases", set.name, "png encode", encode, {{"bytes", outputBytes}});
+
+        fs::create_directories(root);
+        string outputName = (root / set.name).string();
+        double write = Time([&]()
+                            { SaveMetadata(packers, outputName, set.name, false, nullptr); });
+        double metadataBytes = 0;
+        for (const string extension : {".bin", ".xml", ".json"})
+            metadataBytes += fs::file_size(outputName + extension);
+        Record("phases", set.name, "metadata", write, {{"bytes", metadataBytes}});
+
+        for (size_t i = first; i < results.size(); ++i)
+            print(results[i]);
+        if (checksum == 0)
+            printf("hash mismatch\n");
+
+        for (auto bitmap : composed)
+            delete bitmap;
+        for (auto packer : packers)
+            delete packer;
+        for (auto bitmap : bitmaps)
+            delete bitmap;
+    }
+
+    options = previous;
+}
+
+// Generated rectangle sizes for the packing regression check, packing doesn't need any pixels
+struct RectSet
+{
+    string name;
+    vector<RectSize> sizes;
+};
+
+static vector<RectSet> MakeRectSets()
+{
+    vector<RectSet> sets(6);
+    Random random{4321};
+
+    sets[0].name = "small";
+    for (int i = 0; i < 1500; ++i)
+        sets[0].sizes.push_back({random.Range(4, 32), random.Range(4, 32)});
+
+    sets[1].name = "mixed";
+    for (int i = 0; i < 600; ++i)
+    {
+        int limit = random.Range(0, 9) == 0 ? 256 : 64;
+        sets[1].sizes.push_back({random.Range(8, limit), random.Range(8, limit)});
+    }
+
+    // Long thin strips lying either way, where rotation matters most
+    sets[2].name = "strips";
+    for (int i = 0; i < 400; ++i)
+    {
+        int length = random.Range(32, 256), thickness = random.Range(4, 16);
+        if (random.Range(0, 1))
+            sets[2].sizes.push_back({length, thickness});
+        else
+            sets[2].sizes.push_back({thickness, length});
+    }
+
+    sets[3].name = "large";
+    for (int i = 0; i < 60; ++i)
+        sets[3].sizes.push_back({random.Range(64, 512), random.Range(64, 512)});
+
+    // Tiles that fill their pages exactly when nothing is wasted
+    sets[4].name = "tiles";
+    for (int i = 0; i < 1000; ++i)
+        sets[4].sizes.push_back({31, 31});
+
+    sets[5].name = "pow2";
+    for (int i = 0; i < 300; ++i)
+        sets[5].sizes.push_back({1 << random.Range(2, 7), 1 << random.Range(2, 7)});
+
+    return sets;
+}
+
+// Checks that the rectangles stay inside the bin and don't overlap, sweeping them from left to right
+static bool PlacementValid(vector<Rect> rects, int width, int height)
+{
+    sort(rects.begin(), rects.end(), [](const Rect &a, const Rect &b)
+         { return a.x < b.x; });
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        auto &a = rects[i];
+        if (a.x < 0 || a.y < 0 || a.x + a.width > width || a.y + a.height > height)
+            return false;
+        for (size_t j = i + 1; j < rects.size() && rects[j].x < a.x + a.width; ++j)
+            if (!DisjointRectCollection::Disjoint(a, rects[j]))
+                return false;
+    }
+    return true;
+}
+
+// A case of the packing regression check and what it measured
+struct RegressionCase
+{
+    string set;
+    string kind;
+    string heuristic;
+    string rotate;
+    int pages;
+    double occupancy;
+    double bounds;
+    double ms;
+
+    string Key() const
+    {
+        return set + ' ' + kind + ' ' + heuristic + ' ' + rotate;
+    }
+};
+
+static vector<RegressionCase> LoadBaseline(const string &file)
+{
+    ifstream stream(file);
+    if (!stream)
+    {
+        cerr << "failed to load baseline: " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<RegressionCase> cases;
+    string line;
+    while (getline(stream, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        RegressionCase entry;
+        istringstream fields(line);
+        if (!(fields >> entry.set >> entry.kind >> entry.heuristic >> entry.rotate >> entry.pages >> entry.occupancy >> entry.bounds >> entry.ms))
+        {
+            cerr << "invalid baseline line: " << line << endl;
+            exit(EXIT_FAILURE);
+        }
+        cases.push_back(entry);
+    }
+    return cases;
+}
+
+static void SaveBaseline(const string &file, const vector<RegressionCase> &cases)
+{
+    FILE *stream = fopen(file.data(), "w");
+    if (!stream)
+    {
+        cerr << "failed to save baseline: " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stream, "# set kind heuristic rotate pages occupancy bounds ms, written by: crunch_bench regression --save-baseline FILE\n");
+    for (auto &entry : cases)
+        fprintf(stream, "%s %s %s %s %d %.4f %.4f %.3f\n", entry.set.data(), entry.kind.data(), entry.heuristic.data(),
+                entry.rotate.data(), entry.pages, entry.occupancy, entry.bounds, entry.ms);
+    fclose(stream);
+}
+
+// Fastest of a few runs, so a busy moment of the machine doesn't count as a regression
+static double MinTime(int runs, const function<void()> &body)
+{
+    double best = Time(body);
+    for (int i = 1; i < runs; ++i)
+        best = min(best, Time(body));
+    return best;
+}
+
+// Packs fixed rectangle sets with every heuristic, with and without rotation, once through the Packer
+// pipeline (sorting, multiple pages, padding) and once with the batch insert of MaxRectsBinPack into a
+// single bin. Every placement is checked for overlaps, and the pages and the occupancy of the pages and of
+// the bounds of their images are compared with the baseline file if one is given. The time is only
+// compared with checkTime, the baseline has to come from the same machine and build type for that.
+// Returns false if anything is invalid or got worse
+static bool BenchRegression(const string &baseline, const string &saveBaseline, bool checkTime)
+{
+    const pair<const char *, MaxRectsBinPack::FreeRectChoiceHeuristic> heuristics[] = {
+        {"bssf", MaxRectsBinPack::RectBestShortSideFit},
+        {"blsf", MaxRectsBinPack::RectBestLongSideFit},
+        {"baf", MaxRectsBinPack::RectBestAreaFit},
+        {"blr", MaxRectsBinPack::RectBottomLeftRule},
+        {"cpr", MaxRectsBinPack::RectContactPointRule}};
+    // The fastest of a few runs is only needed to compare the time
+    const int runs = checkTime ? 3 : 1;
+    const int binSize = 512;
+    const size_t batchLimit = 400;
+
+    // Single cases are too short to time reliably, so with checkTime the time is compared for every set and
+    // kind as a whole. Machines vary a lot from run to run, so only taking twice as long plus a millisecond
+    // counts as slower, while the density may not drop at all
+    const double timeTolerance = 2.0;
+    const double timeSlack = 1.0;
+    const double occupancyTolerance = 0.0001;
+
+    unordered_map<string, RegressionCase> expected;
+    if (!baseline.empty())
+        for (auto &entry : LoadBaseline(baseline))
+            expected[entry.Key()] = entry;
+
+    Options previous = options;
+    options.width = 1024;
+    options.height = 1024;
+    options.padding = 1;
+    options.stretch = 0;
+    options.blockAlign = false;
+    options.unique = false;
+    options.verbose = false;
+
+    vector<RegressionCase> cases;
+    map<string, pair<double, double>> times;
+    bool passed = true;
+    printf("%-8s %-9s %-5s %-6s %6s %10s %8s %10s  %s\n", "set", "kind", "heur", "rotate", "pages", "occupancy", "bounds", "ms",
+           "result");
+    auto check = [&](RegressionCase entry, bool valid)
+    {
+        string result = valid ? "" : " INVALID";
+        bool failed = !valid;
+        auto found = expected.find(entry.Key());
+        if (!baseline.empty() && found == expected.end())
+            result += " new";
+        else if (found != expected.end())
+        {
+            auto &base = found->second;
+            if (entry.pages > base.pages)
+            {
+                result += " PAGES " + to_string(base.pages) + " -> " + to_string(entry.pages);
+                failed = true;
+            }
+            if (entry.occupancy < base.occupancy - occupancyTolerance)
+            {
+                result += " OCCUPANCY " + to_string(base.occupancy) + " -> " + to_string(entry.occupancy);
+                failed = true;
+            }
+            if (entry.bounds < base.bounds - occupancyTolerance)
+            {
+                result += " BOUNDS " + to_string(base.bounds) + " -> " + to_string(entry.bounds);
+                failed = true;
+            }
+            auto &time = times[entry.set + ' ' + entry.kind];
+            time.first += base.ms;
+            time.second += entry.ms;
+        }
+        if (failed)
+        {
+            result.erase(0, 1);
+            passed = false;
+        }
+        else
+            result = "ok" + result;
+        printf("%-8s %-9s %-5s %-6s %6d %10.4f %8.4f %10.3f  %s\n", entry.set.data(), entry.kind.data(), entry.heuristic.data(),
+               entry.rotate.data(), entry.pages, entry.occupancy, entry.bounds, entry.ms, result.data());
+        Record("regression", entry.set, entry.kind + ' ' + entry.heuristic + ' ' + entry.rotate, entry.ms / 1000.0,
+               {{"pages", entry.pages}, {"occupancy", entry.occupancy}, {"bounds", entry.bounds}, {"valid", valid ? 1 : 0}});
+        cases.push_back(entry);
+    };
+
+    for (auto &set : MakeRectSets())
+    {
+        double area = 0;
+        for (auto &size : set.sizes)
+            area += static_cast<double>(size.width) * size.height;
+
+        for (auto &[name, heuristic] : heuristics)
+            for (bool rotate : {false, true})
+            {
+                options.choiceHeuristic = heuristic;
+                options.rotate = rotate;
+
+                // The Packer keeps the bitmaps it was given, only their sizes are read
+                vector<Bitmap *> bitmaps;
+                for (size_t i = 0; i < set.sizes.size(); ++i)
+                {
+                    bitmaps.push_back(new Bitmap(set.sizes[i].width, set.sizes[i].height));
+                    bitmaps.back()->name = "rect" + to_string(i);
+                }
+                vector<Packer *> packers;
+                string error;
+                bool packed = false;
+                double ms = MinTime(runs, [&]()
+                                    {
+                    for (auto packer : packers)
+                        delete packer;
+                    packers.clear();
+                    packed = PackBitmaps(bitmaps, set.name, packers, error); }) * 1000.0;
+
+                bool valid = packed;
+                double pageArea = 0, boundsArea = 0;
+                size_t placed = 0;
+                for (auto packer : packers)
+                {
+                    // Padding has to stay free between the images, so the cells include it
+                    vector<Rect> cells;
+                    int right = 0, bottom = 0;
+                    for (size_t i = 0; i < packer->bitmaps.size(); ++i)
+                    {
+                        auto &point = packer->points[i];
+                        int w = packer->bitmaps[i]->width, h = packer->bitmaps[i]->height;
+                        if (point.rot)
+                            swap(w, h);
+                        cells.push_back({point.x, point.y, w + packer->pad, h + packer->pad});
+                        right = max(right, point.x + w);
+                        bottom = max(bottom, point.y + h);
+                    }
+                    valid = valid && PlacementValid(cells, packer->width + packer->pad, packer->height + packer->pad);
+                    pageArea += static_cast<double>(packer->width) * packer->height;
+                    boundsArea += static_cast<double>(right) * bottom;
+                    placed += packer->bitmaps.size();
+                }
+                valid = valid && placed == set.sizes.size();
+                check({set.name, "packer", name, rotate ? "rot" : "norot", static_cast<int>(packers.size()),
+                       pageArea > 0 ? area / pageArea : 0, boundsArea > 0 ? area / boundsArea : 0, ms},
+                      valid);
+
+                for (auto packer : packers)
+                    delete packer;
+                for (auto bitmap : bitmaps)
+                    delete bitmap;
+
+                // The batch insert tries every remaining rectangle for every placement, so it only gets
+                // a single bin and the first few hundred rectangles of the set
+                vector<RectSize> batch(set.sizes.begin(), set.sizes.begin() + min(set.sizes.size(), batchLimit));
+                vector<Rect> rects;
+                double occupancy = 0;
+                ms = MinTime(runs, [&]()
+                             {
+                    MaxRectsBinPack bin(binSize, binSize, rotate);
+                    vector<RectSize> sizes = batch;
+                    bin.Insert(sizes, rects, heuristic);
+                    occupancy = bin.Occupancy(); }) * 1000.0;
+                valid = PlacementValid(rects, binSize, binSize);
+                if (!rotate)
+                    for (auto &rect : rects)
+                        valid = valid && any_of(batch.begin(), batch.end(), [&](const RectSize &size)
+                                                { return size.width == rect.width && size.height == rect.height; });
+                check({set.name, "maxrects", name, rotate ? "rot" : "norot", 1, occupancy, occupancy, ms}, valid);
+            }
+    }
+
+    options = previous;
+
+    for (auto &[name, time] : times)
+        if (checkTime && time.second > time.first * timeTolerance + timeSlack)
+        {
+            printf("%s: SLOWER %.3f ms -> %.3f ms\n", name.data(), time.first, time.second);
+            passed = false;
+        }
+
+    if (!saveBaseline.empty())
+        SaveBaseline(saveBaseline, cases);
+    if (!passed)
+        printf("packing regressed\n");
+    return passed;
+}
+
+// Packs the rectangle sets once and with --optimize, with rotation, and compares the pages and their
+// occupancy. The search stops on time, so the results vary with the machine and aren't checked
+static void BenchOptimize(double seconds)
+{
+    Options previous = options;
+    options.width = 1024;
+    options.height = 1024;
+    options.padding = 1;
+    options.stretch = 0;
+    options.blockAlign = false;
+    options.unique = false;
+    options.rotate = true;
+    options.verbose = false;
+
+    printf("%-8s %-9s %6s %10s %8s %10s\n", "set", "kind", "pages", "occupancy", "bounds", "ms");
+    for (auto &set : MakeRectSets())
+    {
+        double area = 0;
+        vector<Bitmap *> bitmaps;
+        for (size_t i = 0; i < set.sizes.size(); ++i)
+        {
+            area += static_cast<double>(set.sizes[i].width) * set.sizes[i].height;
+            bitmaps.push_back(new Bitmap(set.sizes[i].width, set.sizes[i].height));
+            bitmaps.back()->name = "rect" + to_string(i);
+        }
+
+        for (double optimize : {0.0, seconds})
+        {
+            options.optimize = optimize;
+            vector<Packer *> packers;
+            string error;
+            double time = Time([&]()
+                               { PackBitmaps(bitmaps, set.name, packers, error); });
+
+            double pageArea = 0, boundsArea = 0;
+            for (auto packer : packers)
+            {
+                int right = 0, bottom = 0;
+                for (size_t i = 0; i < packer->bitmaps.size(); ++i)
+                {
+                    auto &point = packer->points[i];
+                    right = max(right, point.x + (point.rot ? packer->bitmaps[i]->height : packer->bitmaps[i]->width));
+                    bottom = max(bottom, point.y + (point.rot ? packer->bitmaps[i]->width : packer->bitmaps[i]->height));
+                }
+                pageArea += static_cast<double>(packer->width) * packer->height;
+                boundsArea += static_cast<double>(right) * bottom;
+            }
+            const char *kind = optimize > 0 ? "optimized" : "once";
+            double occupancy = pageArea > 0 ? area / pageArea : 0, bounds = boundsArea > 0 ? area / boundsArea : 0;
+            printf("%-8s %-9s %6zu %10.4f %8.4f %10.3f\n", set.name.data(), kind, packers.size(), occupancy, bounds,
+                   time * 1000.0);
+            Record("optimize", set.name, kind, time,
+                   {{"pages", static_cast<double>(packers.size())}, {"occupancy", occupancy}, {"bounds", bounds}});
+
+            for (auto packer : packers)
+                delete packer;
+        }
+        for (auto bitmap : bitmaps)
+            delete bitmap;
+    }
+
+    options = previous;
+}
+
+// The zlib stream of a .png, all of its IDAT chunks joined
+static vector<uint8_t> ImageData(const vector<uint8_t> &png)
+{
+    vector<uint8_t> data;
+    if (png.size() < 8)
+        return data;
+    const unsigned char *end = png.data() + png.size();
+    for (const unsigned char *chunk = png.data() + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk, end))
+    {
+        if (lodepng_chunk_length(chunk) > static_cast<size_t>(end - chunk) - 12)
+            break;
+        if (lodepng_chunk_type_equals(chunk, "IDAT"))
+            data.insert(data.end(), lodepng_chunk_data_const(chunk), lodepng_chunk_data_const(chunk) + lodepng_chunk_length(chunk));
+    }
+    return data;
+}
+
+// Decompression throughput of the png decoder: the zlib streams alone and the whole decode, in MB/s
+// of decoded bytes. Runs on the generated sprite sets, and on the .png files of a directory with
+// --corpus, since real sprites compress differently than generated ones
+static void BenchInflate(const string &corpus)
+{
+    const int runs = 3;
+
+    vector<SpriteSet> sets = MakeSpriteSets();
+    sets.pop_back(); // the duplicates are the same sprites as the mixed set
+    if (!corpus.empty())
+    {
+        SpriteSet set{fs::path(corpus).filename().string(), {}};
+        if (set.name.empty())
+            set.name = "corpus";
+        for (auto &entry : fs::recursive_directory_iterator(corpus))
+            if (entry.is_regular_file() && entry.path().extension() == ".png")
+            {
+                MappedFile file(entry.path().string());
+                if (file.loaded)
+                    set.pngs.emplace_back(file.data, file.data + file.size);
+            }
+        if (set.pngs.empty())
+        {
+            cerr << "no .png files in corpus: " << corpus << endl;
+            exit(EXIT_FAILURE);
+        }
+        sets.push_back(move(set));
+    }
+
+    printf("%-12s %8s %12s %12s %14s %14s\n", "set", "files", "input MB", "output MB", "inflate MB/s", "decode MB/s");
+    for (auto &set : sets)
+    {
+        vector<vector<uint8_t>> streams;
+        double inputBytes = 0;
+        for (auto &png : set.pngs)
+        {
+            streams.push_back(ImageData(png));
+            inputBytes += png.size();
+        }
+
+        double inflatedBytes = 0;
+        double inflate = MinTime(runs, [&]()
+                                 {
+            inflatedBytes = 0;
+            for (auto &stream : streams)
+            {
+                unsigned char *data = nullptr;
+                size_t size = 0;
+                if (lodepng_zlib_decompress(&data, &size, stream.data(), stream.size(), &lodepng_default_decompress_settings) == 0)
+                    inflatedBytes += size;
+                free(data);
+            } });
+
+        double decodedBytes = 0;
+        double decode = MinTime(runs, [&]()
+                                {
+            decodedBytes = 0;
+            for (auto &png : set.pngs)
+            {
+                unsigned char *data = nullptr;
+                unsigned int w, h;
+                if (lodepng_decode32(&data, &w, &h, png.data(), png.size()) == 0)
+                    decodedBytes += static_cast<double>(w) * h * 4;
+                free(data);
+            } });
+
+        double inflateRate = inflatedBytes / 1e6 / inflate, decodeRate = decodedBytes / 1e6 / decode;
+        printf("%-12s %8zu %12.2f %12.2f %14.1f %14.1f\n", set.name.data(), set.pngs.size(), inputBytes / 1e6, inflatedBytes / 1e6,
+               inflateRate, decodeRate);
+        Record("inflate", set.name, "inflate", inflate, {{"bytes", inflatedBytes}, {"mb_per_s", inflateRate}});
+        Record("inflate", set.name, "decode", decode, {{"bytes", decodedBytes}, {"mb_per_s", decodeRate}});
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    string filter, json, baseline, saveBaseline, corpus;
+    bool checkTime = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+            json = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline = argv[++i];
+        else if (arg == "--save-baseline" && i + 1 < argc)
+            saveBaseline = argv[++i];
+        else if (arg == "--check-time")
+            checkTime = true;
+        else if (arg == "--corpus" && i + 1 < argc)
+            corpus = argv[++i];
+        else
+            filter = arg;
+    }
+
+    fs::path root = fs::temp_directory_path() / "crunch_bench";
+    fs::remove_all(root);
+
+    if (filter.empty() || filter == "codecs")
+        BenchCodecs(root / "codecs", 2000);
+    if (filter.empty() || filter == "lookup")
+        BenchLookup(root / "lookup", 100000);
+    if (filter.empty() || filter == "metadata")
+        BenchMetadata(root / "metadata", 20000);
+    if (filter.empty() || filter == "phases")
+        BenchPhases(root / "phases");
+    if (filter.empty() || filter == "inflate")
+        BenchInflate(corpus);
+    if (filter.empty() || filter == "optimize")
+        BenchOptimize(2.0);
+    bool passed = true;
+    if (filter.empty() || filter == "regression")
+        passed = BenchRegression(baseline, saveBaseline, checkTime);
+
+    fs::remove_all(root);
+    if (!json.empty())
+        SaveResults(json);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+#include "atlas.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "atlas_reader.hpp"
+#include "stats.hpp"
+
+using namespace std;
+using namespace crunch;
+
+template <typename T>
+static T *RecordAt(vector<uint8_t> &buffer, size_t offset)
+{
+    return reinterpret_cast<T *>(buffer.data() + offset);
+}
+
+void WriteAtlasBin(Buffer &bin, const vector<AtlasTexture> &textures, bool trim, bool rotate, bool mesh)
+{
+    uint32_t imageCount = 0, vertexCount = 0, indexCount = 0;
+    for (auto &texture : textures)
+    {
+        imageCount += static_cast<uint32_t>(texture.images.size());
+        if (mesh)
+            for (auto &image : texture.images)
+            {
+                vertexCount += static_cast<uint32_t>(image.mesh.vertices.size());
+                indexCount += static_cast<uint32_t>(image.mesh.indices.size());
+            }
+    }
+
+    uint32_t slotCount = 1;
+    while (slotCount < imageCount * 2)
+        slotCount *= 2;
+
+    // Lay out the string table first, so every record knows its name offset
+    string strings;
+    vector<uint32_t> textureNames, imageNames;
+    for (auto &texture : textures)
+    {
+        textureNames.push_back(static_cast<uint32_t>(strings.size()));
+        strings.append(texture.name).push_back('\0');
+        for (auto &image : texture.images)
+        {
+            imageNames.push_back(static_cast<uint32_t>(strings.size()));
+            strings.append(image.name).push_back('\0');
+        }
+    }
+    if (strings.empty())
+        strings.push_back('\0');
+
+    AtlasHeader header{};
+    memcpy(header.magic, "crch", 4);
+    header.version = mesh ? atlasMeshVersion : atlasVersion;
+    header.trim = trim;
+    header.rotate = rotate;
+    header.textureCount = static_cast<uint32_t>(textures.size());
+    header.imageCount = imageCount;
+    header.hashSlotCount = slotCount;
+    header.textureOffset = sizeof(AtlasHeader) + (mesh ? sizeof(AtlasMeshHeader) : 0);
+    header.imageOffset = header.textureOffset + header.textureCount * sizeof(AtlasTextureRecord);
+    header.hashOffset = header.imageOffset + imageCount * sizeof(AtlasImageRecord);
+    header.stringOffset = header.hashOffset + slotCount * sizeof(uint32_t);
+    header.stringSize = static_cast<uint32_t>(strings.size());
+
+    size_t size = header.stringOffset + ((strings.size() + 3) & ~size_t(3));
+
+    // The mesh tables follow the strings
+    AtlasMeshHeader meshHeader{};
+    if (mesh)
+    {
+        meshHeader.meshOffset = static_cast<uint32_t>(size);
+        meshHeader.vertexOffset = meshHeader.meshOffset + imageCount * sizeof(AtlasMeshRecord);
+        meshHeader.vertexCount = vertexCount;
+        meshHeader.indexOffset = meshHeader.vertexOffset + vertexCount * sizeof(AtlasVertex);
+        meshHeader.indexCount = indexCount;
+        size = meshHeader.indexOffset + ((indexCount * sizeof(uint16_t) + 3) & ~size_t(3));
+    }
+
+    vector<uint8_t> buffer(size);
+    memcpy(buffer.data(), &header, sizeof(header));
+    if (mesh)
+        memcpy(buffer.data() + sizeof(header), &meshHeader, sizeof(meshHeader));
+    memcpy(buffer.data() + header.stringOffset, strings.data(), strings.size());
+
+    uint32_t *slots = RecordAt<uint32_t>(buffer, header.hashOffset);
+    uint32_t imageIndex = 0, vertexIndex = 0, indexIndex = 0;
+    for (uint32_t t = 0; t < header.textureCount; ++t)
+    {
+        auto &texture = textures[t];
+        auto textureRecord = RecordAt<AtlasTextureRecord>(buffer, header.textureOffset + t * sizeof(AtlasTextureRecord));
+        textureRecord->name = textureNames[t];
+        textureRecord->firstImage = imageIndex;
+        textureRecord->imageCount = static_cast<uint32_t>(texture.images.size());
+
+        for (auto &image : texture.images)
+        {
+            auto record = RecordAt<AtlasImageRecord>(buffer, header.imageOffset + imageIndex * sizeof(AtlasImageRecord));
+            record->name = imageNames[imageIndex];
+            record->texture = t;
+            record->x = image.x;
+            record->y = image.y;
+            record->width = image.width;
+            record->height = image.height;
+            record->frameX = image.frameX;
+            record->frameY = image.frameY;
+            record->frameWidth = image.frameW;
+            record->frameHeight = image.frameH;
+            record->flags = image.rotated ? static_cast<uint32_t>(AtlasImageRotated) : 0;
+            record->hash = AtlasHash(image.name);
+
+            if (mesh)
+            {
+                auto meshRecord = RecordAt<AtlasMeshRecord>(buffer, meshHeader.meshOffset + imageIndex * sizeof(AtlasMeshRecord));
+                meshRecord->firstVertex = vertexIndex;
+                meshRecord->vertexCount = static_cast<uint32_t>(image.mesh.vertices.size());
+                meshRecord->firstIndex = indexIndex;
+                meshRecord->indexCount = static_cast<uint32_t>(image.mesh.indices.size());
+                for (auto &vertex : image.mesh.vertices)
+                    *RecordAt<AtlasVertex>(buffer, meshHeader.vertexOffset + vertexIndex++ * sizeof(AtlasVertex)) = {vertex.x, vertex.y};
+                for (auto index : image.mesh.indices)
+                    *RecordAt<uint16_t>(buffer, meshHeader.indexOffset + indexIndex++ * sizeof(uint16_t)) = index;
+            }
+
+            // Linear probing, the first image with a name wins
+            uint32_t slot = record->hash & (slotCount - 1);
+            while (slots[slot] != 0)
+                slot = (slot + 1) & (slotCount - 1);
+            slots[slot] = ++imageIndex;
+        }
+    }
+
+    bin.Write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+}
+
+void SaveAtlasBin(const string &file, const vector<AtlasTexture> &textures, bool trim, bool rotate, bool mesh)
+{
+    Buffer bin;
+    WriteAtlasBin(bin, textures, trim, rotate, mesh);
+    if (!bin.Save(file))
+    {
+        cerr << "failed to save bin: " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool LoadAtlasBin(const string &file, vector<AtlasTexture> &textures)
+{
+    ifstream bin(file, ios::binary | ios::ate);
+    if (!bin)
+        return false;
+
+    streamsize size = bin.tellg();
+    bin.seekg(0, ios::beg);
+    vector<uint32_t> buffer((size + 3) / 4);
+    if (!bin.read(reinterpret_cast<char *>(buffer.data()), size))
+        return false;
+    AddBytesRead(size);
+
+    AtlasReader reader;
+    if (!reader.Open(buffer.data(), static_cast<size_t>(size)))
+        return false;
+
+    for (uint32_t t = 0; t < reader.TextureCount(); ++t)
+    {
+        auto &record = reader.Texture(t);
+        if (!reader.TextureName(t) || record.firstImage > reader.ImageCount() || record.imageCount > reader.ImageCount() - record.firstImage)
+            return false;
+
+        AtlasTexture texture;
+        texture.name = reader.TextureName(t);
+        for (uint32_t i = record.firstImage, j = record.firstImage + record.imageCount; i < j; ++i)
+        {
+            auto &image = reader.Image(i);
+            if (!reader.ImageName(i))
+                return false;
+            texture.images.push_back({reader.ImageName(i), image.x, image.y, image.width, image.height,
+                                      image.frameX, image.frameY, image.frameWidth, image.frameHeight,
+                                      (image.flags & AtlasImageRotated) != 0, {}});
+            if (reader.HasMeshes())
+            {
+                auto &mesh = reader.Mesh(i);
+                auto vertices = reader.Vertices(mesh);
+                auto indices = reader.Indices(mesh);
+                if (!vertices || !indices)
+                    return false;
+                for (uint32_t k = 0; k < mesh.vertexCount; ++k)
+                    texture.images.back().mesh.vertices.push_back({vertices[k].x, vertices[k].y});
+                texture.images.back().mesh.indices.assign(indices, indices + mesh.indexCount);
+            }
+        }
+        textures.push_back(move(texture));
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef atlas_hpp
+#define atlas_hpp
+
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "mesh.hpp"
+
+using namespace std;
+
+struct AtlasImage
+{
+    string name;
+    int x;
+    int y;
+    int width;
+    int height;
+    int frameX;
+    int frameY;
+    int frameW;
+    int frameH;
+    bool rotated;
+    Mesh mesh;
+};
+
+struct AtlasTexture
+{
+    string name;
+    vector<AtlasImage> images;
+};
+
+// Version 1 binary format (see atlas_reader.hpp), fixed-size records with a hash index over the image names.
+// With meshes it's saved as version 3, which adds the mesh tables
+void WriteAtlasBin(Buffer &bin, const vector<AtlasTexture> &textures, bool trim, bool rotate, bool mesh);
+void SaveAtlasBin(const string &file, const vector<AtlasTexture> &textures, bool trim, bool rotate, bool mesh);
+bool LoadAtlasBin(const string &file, vector<AtlasTexture> &textures);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+
+ Header-only reader for the version 1 crunch binary atlas (--binver 1), and version 3 which is the
+ same with the --mesh outlines of the images.
+
+ The file is a set of fixed-size little-endian tables that can be used straight from memory,
+ e.g. from a memory-mapped file, without parsing or allocating:
+
+   AtlasHeader
+   AtlasMeshHeader                    version 3 only
+   AtlasTextureRecord[textureCount]   images of texture t are images[firstImage, firstImage + imageCount)
+   AtlasImageRecord[imageCount]
+   uint32_t[hashSlotCount]            open addressing hash index over image names, image index + 1 (0 = empty)
+   char[stringSize]                   null-terminated names, referenced by offset from the start of the table
+   AtlasMeshRecord[imageCount]        version 3 only, the mesh of image i
+   AtlasVertex[vertexCount]           version 3 only, vertices of mesh i are vertices[firstVertex, firstVertex + vertexCount)
+   uint16_t[indexCount]               version 3 only, triangles as three indices into the vertices of their mesh
+
+ Usage:
+
+   crunch::AtlasReader atlas;
+   if (atlas.Open(mappedData, mappedSize))
+       if (const crunch::AtlasImageRecord *img = atlas.Find("player/idle0"))
+           draw(atlas.TextureName(img->texture), img->x, img->y, img->width, img->height);
+
+*/
+
+#ifndef crunch_atlas_reader_hpp
+#define crunch_atlas_reader_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace crunch
+{
+    const uint16_t atlasVersion = 1;
+    const uint16_t atlasMeshVersion = 3;
+
+    enum AtlasImageFlags : uint32_t
+    {
+        AtlasImageRotated = 1
+    };
+
+    struct AtlasHeader
+    {
+        char magic[4]; // "crch"
+        uint16_t version;
+        uint8_t trim;
+        uint8_t rotate;
+        uint32_t textureCount;
+        uint32_t imageCount;
+        uint32_t hashSlotCount; // power of two
+        uint32_t textureOffset;
+        uint32_t imageOffset;
+        uint32_t hashOffset;
+        uint32_t stringOffset;
+        uint32_t stringSize;
+    };
+
+    struct AtlasTextureRecord
+    {
+        uint32_t name;
+        uint32_t firstImage;
+        uint32_t imageCount;
+        uint32_t reserved;
+    };
+
+    struct AtlasImageRecord
+    {
+        uint32_t name;
+        uint32_t texture;
+        int32_t x;
+        int32_t y;
+        int32_t width;
+        int32_t height;
+        int32_t frameX;
+        int32_t frameY;
+        int32_t frameWidth;
+        int32_t frameHeight;
+        uint32_t flags;
+        uint32_t hash;
+    };
+
+    struct AtlasMeshHeader
+    {
+        uint32_t meshOffset;
+        uint32_t vertexOffset;
+        uint32_t vertexCount;
+        uint32_t indexOffset;
+        uint32_t indexCount;
+        uint32_t reserved;
+    };
+
+    struct AtlasMeshRecord
+    {
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    // A corner of a pixel in the image as it's stored in the atlas before rotation, so x = 0 is its left edge
+    struct AtlasVertex
+    {
+        int32_t x;
+        int32_t y;
+    };
+
+    static_assert(sizeof(AtlasHeader) == 40, "unexpected AtlasHeader layout");
+    static_assert(sizeof(AtlasTextureRecord) == 16, "unexpected AtlasTextureRecord layout");
+    static_assert(sizeof(AtlasImageRecord) == 48, "unexpected AtlasImageRecord layout");
+    static_assert(sizeof(AtlasMeshHeader) == 24, "unexpected AtlasMeshHeader layout");
+    static_assert(sizeof(AtlasMeshRecord) == 16, "unexpected AtlasMeshRecord layout");
+    static_assert(sizeof(AtlasVertex) == 8, "unexpected AtlasVertex layout");
+
+    // 32-bit FNV-1a, the hash used by the name index
+    inline uint32_t AtlasHash(std::string_view name)
+    {
+        uint32_t hash = 2166136261u;
+        for (char c : name)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    class AtlasReader
+    {
+    public:
+        // Validates the tables, the memory must stay valid (and 4-byte aligned) while the reader is used
+        bool Open(const void *data, size_t size)
+        {
+            base = static_cast<const uint8_t *>(data);
+            header = nullptr;
+            meshHeader = nullptr;
+            if (size < sizeof(AtlasHeader) || reinterpret_cast<uintptr_t>(data) % 4 != 0)
+                return false;
+
+            auto h = reinterpret_cast<const AtlasHeader *>(base);
+            if (memcmp(h->magic, "crch", 4) != 0 || (h->version != atlasVersion && h->version != atlasMeshVersion))
+                return false;
+            if (h->hashSlotCount == 0 || (h->hashSlotCount & (h->hashSlotCount - 1)) != 0 || h->hashSlotCount < h->imageCount)
+                return false;
+            if (!Fits(h->textureOffset, h->textureCount, sizeof(AtlasTextureRecord), size) ||
+                !Fits(h->imageOffset, h->imageCount, sizeof(AtlasImageRecord), size) ||
+                !Fits(h->hashOffset, h->hashSlotCount, sizeof(uint32_t), size) ||
+                !Fits(h->stringOffset, h->stringSize, 1, size))
+                return false;
+            if (h->stringSize == 0 || base[h->stringOffset + h->stringSize - 1] != '\0')
+                return false;
+
+            const AtlasMeshHeader *m = nullptr;
+            if (h->version == atlasMeshVersion)
+            {
+                if (size < sizeof(AtlasHeader) + sizeof(AtlasMeshHeader))
+                    return false;
+                m = reinterpret_cast<const AtlasMeshHeader *>(base + sizeof(AtlasHeader));
+                if (!Fits(m->meshOffset, h->imageCount, sizeof(AtlasMeshRecord), size) ||
+                    !Fits(m->vertexOffset, m->vertexCount, sizeof(AtlasVertex), size) ||
+                    !Fits(m->indexOffset, m->indexCount, sizeof(uint16_t), size))
+                    return false;
+            }
+
+            header = h;
+            meshHeader = m;
+            return true;
+        }
+
+        bool IsOpen() const { return header != nullptr; }
+        bool Trimmed() const { return header->trim != 0; }
+        bool Rotated() const { return header->rotate != 0; }
+        uint32_t TextureCount() const { return header->textureCount; }
+        uint32_t ImageCount() const { return header->imageCount; }
+        bool HasMeshes() const { return meshHeader != nullptr; }
+
+        const AtlasTextureRecord &Texture(uint32_t index) const { return Textures()[index]; }
+        const AtlasImageRecord &Image(uint32_t index) const { return Images()[index]; }
+        const char *TextureName(uint32_t index) const { return String(Texture(index).name); }
+        const char *ImageName(uint32_t index) const { return String(Image(index).name); }
+
+        // The mesh of an image, only if HasMeshes()
+        const AtlasMeshRecord &Mesh(uint32_t index) const
+        {
+            return reinterpret_cast<const AtlasMeshRecord *>(base + meshHeader->meshOffset)[index];
+        }
+
+        // Return nullptr if the mesh points outside of the vertex or index table
+        const AtlasVertex *Vertices(const AtlasMeshRecord &mesh) const
+        {
+            if (mesh.firstVertex > meshHeader->vertexCount || mesh.vertexCount > meshHeader->vertexCount - mesh.firstVertex)
+                return nullptr;
+            return reinterpret_cast<const AtlasVertex *>(base + meshHeader->vertexOffset) + mesh.firstVertex;
+        }
+        const uint16_t *Indices(const AtlasMeshRecord &mesh) const
+        {
+            if (mesh.firstIndex > meshHeader->indexCount || mesh.indexCount > meshHeader->indexCount - mesh.firstIndex)
+                return nullptr;
+            return reinterpret_cast<const uint16_t *>(base + meshHeader->indexOffset) + mesh.firstIndex;
+        }
+
+        // Returns nullptr if an offset doesn't point inside the string table
+        const char *String(uint32_t offset) const
+        {
+            if (offset >= header->stringSize)
+                return nullptr;
+            return reinterpret_cast<const char *>(base + header->stringOffset + offset);
+        }
+
+        // O(1) lookup of an image by name, returns nullptr if there's no such image
+        const AtlasImageRecord *Find(std::string_view name) const
+        {
+            uint32_t hash = AtlasHash(name);
+            uint32_t mask = header->hashSlotCount - 1;
+            const uint32_t *slots = reinterpret_cast<const uint32_t *>(base + header->hashOffset);
+            for (uint32_t i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, ++probes)
+            {
+                uint32_t slot = slots[i];
+                if (slot == 0 || slot > header->imageCount)
+                    return nullptr;
+
+                const AtlasImageRecord &image = Images()[slot - 1];
+                if (image.hash == hash)
+                {
+                    const char *imageName = String(image.name);
+                    if (imageName && name == imageName)
+                        return &image;
+                }
+            }
+            return nullptr;
+        }
+
+    private:
+        const uint8_t *base = nullptr;
+        const AtlasHeader *header = nullptr;
+        const AtlasMeshHeader *meshHeader = nullptr;
+
+        const AtlasTextureRecord *Textures() const { return reinterpret_cast<const AtlasTextureRecord *>(base + header->textureOffset); }
+        const AtlasImageRecord *Images() const { return reinterpret_cast<const AtlasImageRecord *>(base + header->imageOffset); }
+
+        static bool Fits(uint64_t offset, uint64_t count, uint64_t itemSize, uint64_t size)
+        {
+            return offset % 4 == 0 && offset <= size && count * itemSize <= size - offset;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include "cache.hpp"
+#include "cli.hpp"
+#include "hash.hpp"
+#include "log.hpp"
+#include "options.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "trace.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct Job
+{
+    int line;
+    string output;
+    vector<string> inputs;
+    // The images registered with the decode cache, released when the job is done
+    vector<string> images;
+    Options options;
+    uint64_t hash = 0;
+    uintmax_t inputSize = 0;
+    int result = EXIT_SUCCESS;
+    long long milliseconds = 0;
+    string log;
+};
+
+// Splits a job line into arguments, double quotes group an argument with spaces
+static vector<string> SplitArguments(const string &line)
+{
+    vector<string> arguments;
+    string argument;
+    bool quoted = false, started = false;
+    for (char c : line)
+    {
+        if (c == '"')
+        {
+            quoted = !quoted;
+            started = true;
+        }
+        else if (!quoted && (c == ' ' || c == '\t' || c == '\r'))
+        {
+            if (started)
+                arguments.push_back(argument);
+            argument.clear();
+            started = false;
+        }
+        else
+        {
+            argument += c;
+            started = true;
+        }
+    }
+    if (started)
+        arguments.push_back(argument);
+    return arguments;
+}
+
+static void LoadJobs(const string &jobFile, int argc, const char *argv[], int offset, const Options &batchOptions,
+                     vector<Job> &jobs)
+{
+    ifstream stream(jobFile);
+    if (!stream)
+    {
+        cerr << "failed to load job file: " << jobFile << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    string line;
+    for (int lineNumber = 1; getline(stream, line); ++lineNumber)
+    {
+        vector<string> arguments = SplitArguments(line);
+        if (arguments.empty() || arguments[0].starts_with('#'))
+            continue;
+
+        if (arguments.size() < 2)
+        {
+            cerr << "invalid job on line " << lineNumber << ", expected: \"[OUTPUT] [INPUT1,INPUT2,INPUT3...] [OPTIONS...]\"" << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        // The shared options come first, so the job's own options override them
+        arguments.insert(arguments.begin() + 2, argv + offset, argv + argc);
+
+        vector<const char *> jobArgv{argv[0]};
+        for (auto &argument : arguments)
+            jobArgv.push_back(argument.c_str());
+
+        options = Options();
+        ParseArguments(static_cast<int>(jobArgv.size()), jobArgv.data(), 3);
+        if (options.watch || !options.stats.empty())
+        {
+            cerr << (options.watch ? "--watch" : "--stats") << " can't be used in a batch job, on line " << lineNumber << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (options.trace != batchOptions.trace)
+        {
+            cerr << "--trace has to be given after the job file, it traces the whole batch, on line " << lineNumber << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        Job job;
+        job.line = lineNumber;
+        job.output = NormalizePath(arguments[0]);
+        job.inputs = SplitInputs(arguments[1]);
+        job.options = options;
+        for (size_t i = 1; i < jobArgv.size(); ++i)
+            HashString(job.hash, jobArgv[i]);
+        jobs.push_back(move(job));
+    }
+}
+
+int RunBatch(const string &jobFile, int argc, const char *argv[], int offset)
+{
+    auto start = chrono::steady_clock::now();
+
+    options = Options();
+    ParseArguments(argc, argv, offset);
+    Options batchOptions = options;
+
+    vector<Job> jobs;
+    LoadJobs(jobFile, argc, argv, offset, batchOptions, jobs);
+
+    // Count the uses of every image, so images shared by several jobs are decoded once,
+    // and start the biggest jobs first so the small ones fill the gaps at the end
+    DecodeCache cache;
+    for (auto &job : jobs)
+    {
+        options = job.options;
+        vector<string> inputs;
+        for (auto &input : job.inputs)
+            if (fs::exists(input))
+                inputs.push_back(input);
+
+        vector<ImageFile> images;
+        FindImages(inputs, "", images);
+        for (auto &image : images)
+        {
+            cache.Register(image.path);
+            job.images.push_back(image.path);
+            error_code error;
+            uintmax_t size = fs::file_size(image.path, error);
+            if (!error)
+                job.inputSize += size;
+        }
+    }
+    options = batchOptions;
+
+    vector<int> order(jobs.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b)
+                { return jobs[a].inputSize > jobs[b].inputSize; });
+
+    // The logs are printed in job file order as soon as the earlier jobs are done
+    vector<bool> done(jobs.size());
+    mutex logMutex;
+    int nextLog = 0;
+
+    ParallelFor(static_cast<int>(jobs.size()), [&](int i)
+                {
+        Job &job = jobs[order[i]];
+        {
+            options = job.options;
+            TraceSpan span("Job", job.output);
+            LogCapture capture;
+            auto jobStart = chrono::steady_clock::now();
+            job.result = CrunchAtlas(job.hash, job.output, job.inputs, &cache);
+            for (auto &image : job.images)
+                cache.Release(image);
+            job.milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - jobStart).count();
+            job.log = capture.stream.str();
+        }
+
+        lock_guard<mutex> lock(logMutex);
+        done[order[i]] = true;
+        while (nextLog < jobs.size() && done[nextLog])
+            cout << jobs[nextLog++].log;
+        cout.flush(); });
+    options = batchOptions;
+
+    int packed = 0, unchanged = 0, failed = 0;
+    cout << "batch results:" << endl;
+    for (auto &job : jobs)
+    {
+        string status = "packed";
+        if (job.result == EXIT_SKIPPED)
+        {
+            status = "unchanged";
+            ++unchanged;
+        }
+        else if (job.result != EXIT_SUCCESS)
+        {
+            status = "failed";
+            ++failed;
+        }
+        else
+            ++packed;
+        cout << '\t' << status << '\t' << job.output << " (line " << job.line << ", " << job.milliseconds << " ms)" << endl;
+    }
+
+    auto milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    cout << jobs.size() << " jobs: " << packed << " packed, " << unchanged << " unchanged, " << failed << " failed ("
+         << milliseconds << " ms)" << endl;
+
+    if (!options.trace.empty())
+        SaveTrace(options.trace);
+
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
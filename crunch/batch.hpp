@@ -0,0 +1,13 @@
+#ifndef batch_hpp
+#define batch_hpp
+
+#include <string>
+
+using namespace std;
+
+// --batch: packs every atlas of a job file in one process. Each line of the file is a job written like the
+// command line, "OUTPUT INPUT1,INPUT2 [OPTIONS...]", the options after the job file apply to every job.
+// The jobs run on the shared thread pool and images used by several jobs are decoded once
+int RunBatch(const string &jobFile, int argc, const char *argv[], int offset);
+
+#endif
@@ -0,0 +1,533 @@
+#include "bcn.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "parallel.hpp"
+
+using namespace std;
+
+static const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+bool IsBlockCompressed(PixelFormat format)
+{
+    return format == PixelFormat::BC1 || format == PixelFormat::BC3 || format == PixelFormat::BC7;
+}
+
+int BlockBytes(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::BC1:
+        return 8;
+    case PixelFormat::BC3:
+    case PixelFormat::BC7:
+        return 16;
+    case PixelFormat::RGBA4444:
+    case PixelFormat::RGB565:
+    case PixelFormat::RGBA5551:
+        return 2;
+    case PixelFormat::Palette:
+        return 1;
+    default:
+        return 4;
+    }
+}
+
+// Finds the mean and the dominant direction of the selected pixels with power iteration
+static void PrincipalAxis(const uint8_t *rgba, const bool *used, int channels, float *mean, float *axis)
+{
+    int count = 0;
+    for (int c = 0; c < 4; ++c)
+        mean[c] = axis[c] = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        if (!used[i])
+            continue;
+        for (int c = 0; c < channels; ++c)
+            mean[c] += rgba[i * 4 + c];
+        ++count;
+    }
+    if (count == 0)
+        return;
+    for (int c = 0; c < channels; ++c)
+        mean[c] /= count;
+
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        if (!used[i])
+            continue;
+        for (int a = 0; a < channels; ++a)
+            for (int b = a; b < channels; ++b)
+                cov[a][b] += (rgba[i * 4 + a] - mean[a]) * (rgba[i * 4 + b] - mean[b]);
+    }
+    for (int a = 0; a < channels; ++a)
+        for (int b = 0; b < a; ++b)
+            cov[a][b] = cov[b][a];
+
+    float v[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int a = 0; a < channels; ++a)
+        {
+            for (int b = 0; b < channels; ++b)
+                next[a] += cov[a][b] * v[b];
+            length = max(length, fabs(next[a]));
+        }
+        if (length == 0.0f)
+            return;
+        for (int a = 0; a < channels; ++a)
+            v[a] = next[a] / length;
+    }
+
+    float length = 0.0f;
+    for (int c = 0; c < channels; ++c)
+        length += v[c] * v[c];
+    length = sqrt(length);
+    for (int c = 0; c < channels; ++c)
+        axis[c] = v[c] / length;
+}
+
+// Projects the selected pixels on the axis and returns the extreme points of the line
+static void AxisEndpoints(const uint8_t *rgba, const bool *used, int channels, const float *mean, const float *axis, float *e0, float *e1)
+{
+    float tMin = 0.0f, tMax = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        if (!used[i])
+            continue;
+        float t = 0.0f;
+        for (int c = 0; c < channels; ++c)
+            t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+        tMin = min(tMin, t);
+        tMax = max(tMax, t);
+    }
+    for (int c = 0; c < channels; ++c)
+    {
+        e0[c] = mean[c] + axis[c] * tMin;
+        e1[c] = mean[c] + axis[c] * tMax;
+    }
+}
+
+// Solves the least squares endpoints for the given interpolation weights (0 = e0, 1 = e1)
+static bool FitEndpoints(const uint8_t *rgba, const bool *used, const float *weights, int channels, float *e0, float *e1)
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ap[4] = {}, bp[4] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        if (!used[i])
+            continue;
+        float b = weights[i], a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; ++c)
+        {
+            ap[c] += a * rgba[i * 4 + c];
+            bp[c] += b * rgba[i * 4 + c];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabs(det) < 1e-6f)
+        return false;
+    for (int c = 0; c < channels; ++c)
+    {
+        e0[c] = (ap[c] * bb - bp[c] * ab) / det;
+        e1[c] = (bp[c] * aa - ap[c] * ab) / det;
+    }
+    return true;
+}
+
+static inline int Clamp(int value, int low, int high)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+// ================================================================
+// BC1 / BC3
+// ================================================================
+
+static uint16_t Quantize565(const float *color)
+{
+    int r = Clamp(static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+    int g = Clamp(static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+    int b = Clamp(static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void Expand565(uint16_t color, int *rgb)
+{
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Builds the palette for the endpoints, returns the number of opaque entries (4 or 3)
+static int ColorPalette(uint16_t c0, uint16_t c1, bool threeColor, int palette[4][3])
+{
+    Expand565(c0, palette[0]);
+    Expand565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c)
+    {
+        if (threeColor)
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+        else
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+    return threeColor ? 3 : 4;
+}
+
+static int ColorIndices(const uint8_t *rgba, const bool *used, uint16_t c0, uint16_t c1, bool threeColor, int *indices)
+{
+    int palette[4][3];
+    int entries = ColorPalette(c0, c1, threeColor, palette);
+    int error = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        if (!used[i])
+        {
+            indices[i] = 3;
+            continue;
+        }
+        int best = 0, bestError = INT32_MAX;
+        for (int j = 0; j < entries; ++j)
+        {
+            int e = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                int d = rgba[i * 4 + c] - palette[j][c];
+                e += d * d;
+            }
+            if (e < bestError)
+            {
+                bestError = e;
+                best = j;
+            }
+        }
+        indices[i] = best;
+        error += bestError;
+    }
+    return error;
+}
+
+// Encodes the color part of a BC1/BC3 block, pixels not marked as used become transparent (three color mode)
+static void EncodeColorBlock(const uint8_t *rgba, const bool *used, bool threeColor, uint8_t *out)
+{
+    static const float weights4[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    static const float weights3[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+    const float *weightTable = threeColor ? weights3 : weights4;
+
+    float mean[4], axis[4], e0[4], e1[4];
+    PrincipalAxis(rgba, used, 3, mean, axis);
+    AxisEndpoints(rgba, used, 3, mean, axis, e0, e1);
+
+    uint16_t c0 = Quantize565(e1), c1 = Quantize565(e0);
+    int indices[16];
+    int error = ColorIndices(rgba, used, c0, c1, threeColor, indices);
+
+    // Refine the endpoints with least squares over the chosen indices
+    for (int iteration = 0; iteration < 2 && error > 0; ++iteration)
+    {
+        float weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = weightTable[indices[i]];
+        if (!FitEndpoints(rgba, used, weights, 3, e0, e1))
+            break;
+
+        uint16_t n0 = Quantize565(e0), n1 = Quantize565(e1);
+        int newIndices[16];
+        int newError = ColorIndices(rgba, used, n0, n1, threeColor, newIndices);
+        if (newError >= error)
+            break;
+        c0 = n0;
+        c1 = n1;
+        error = newError;
+        memcpy(indices, newIndices, sizeof(indices));
+    }
+
+    // Order the endpoints so the decoder picks the intended mode
+    if ((threeColor && c0 > c1) || (!threeColor && c0 < c1))
+    {
+        swap(c0, c1);
+        for (int i = 0; i < 16; ++i)
+        {
+            if (indices[i] < 2)
+                indices[i] ^= 1;
+            else if (!threeColor)
+                indices[i] ^= 1;
+        }
+    }
+    else if (!threeColor && c0 == c1)
+    {
+        for (int i = 0; i < 16; ++i)
+            indices[i] = 0;
+    }
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; ++i)
+        bits |= static_cast<uint32_t>(indices[i]) << (i * 2);
+
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    out[4] = bits & 0xff;
+    out[5] = (bits >> 8) & 0xff;
+    out[6] = (bits >> 16) & 0xff;
+    out[7] = bits >> 24;
+}
+
+void EncodeBC1Block(const uint8_t *rgba, uint8_t *out)
+{
+    bool used[16];
+    bool transparent = false;
+    for (int i = 0; i < 16; ++i)
+    {
+        used[i] = rgba[i * 4 + 3] >= 128;
+        transparent |= !used[i];
+    }
+    EncodeColorBlock(rgba, used, transparent, out);
+}
+
+void EncodeBC3Block(const uint8_t *rgba, uint8_t *out)
+{
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        a0 = max(a0, static_cast<int>(rgba[i * 4 + 3]));
+        a1 = min(a1, static_cast<int>(rgba[i * 4 + 3]));
+    }
+
+    uint64_t alphaBits = 0;
+    if (a0 != a1)
+    {
+        // Eight alpha mode: a0 > a1, index 0 = a0, index 1 = a1, indices 2-7 interpolate between them
+        for (int i = 0; i < 16; ++i)
+        {
+            int a = rgba[i * 4 + 3];
+            int step = (7 * (a0 - a) + (a0 - a1) / 2) / (a0 - a1);
+            uint64_t index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+            alphaBits |= index << (i * 3);
+        }
+    }
+
+    out[0] = static_cast<uint8_t>(a0);
+    out[1] = static_cast<uint8_t>(a1);
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (alphaBits >> (i * 8)) & 0xff;
+
+    bool used[16];
+    for (int i = 0; i < 16; ++i)
+        used[i] = true;
+    EncodeColorBlock(rgba, used, false, out + 8);
+}
+
+// ================================================================
+// BC7 (mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4-bit indices)
+// ================================================================
+
+static void QuantizeBC7(const float *color, int pbit, int *quantized)
+{
+    for (int c = 0; c < 4; ++c)
+        quantized[c] = Clamp(static_cast<int>((color[c] - pbit) / 2.0f + 0.5f), 0, 127);
+}
+
+static int BC7Indices(const uint8_t *rgba, const int *q0, int p0, const int *q1, int p1, int *indices)
+{
+    int e0[4], e1[4], palette[16][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        e0[c] = (q0[c] << 1) | p0;
+        e1[c] = (q1[c] << 1) | p1;
+    }
+    for (int j = 0; j < 16; ++j)
+        for (int c = 0; c < 4; ++c)
+            palette[j][c] = ((64 - bc7Weights[j]) * e0[c] + bc7Weights[j] * e1[c] + 32) >> 6;
+
+    // Guess the index from the projection on the endpoint line, then check its neighbours
+    int dir[4], lengthSq = 0;
+    for (int c = 0; c < 4; ++c)
+    {
+        dir[c] = e1[c] - e0[c];
+        lengthSq += dir[c] * dir[c];
+    }
+
+    int error = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        const uint8_t *p = rgba + i * 4;
+        int guess = 0;
+        if (lengthSq > 0)
+        {
+            int dot = 0;
+            for (int c = 0; c < 4; ++c)
+                dot += (p[c] - e0[c]) * dir[c];
+            guess = Clamp(static_cast<int>(dot * 15.0f / lengthSq + 0.5f), 0, 15);
+        }
+
+        int best = guess, bestError = INT32_MAX;
+        for (int j = max(0, guess - 1); j <= min(15, guess + 1); ++j)
+        {
+            int e = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                int d = p[c] - palette[j][c];
+                e += d * d;
+            }
+            if (e < bestError)
+            {
+                bestError = e;
+                best = j;
+            }
+        }
+        indices[i] = best;
+        error += bestError;
+    }
+    return error;
+}
+
+struct BC7Candidate
+{
+    int q0[4];
+    int q1[4];
+    int p0;
+    int p1;
+    int indices[16];
+    int error = INT32_MAX;
+};
+
+static void TryBC7Endpoints(const uint8_t *rgba, const float *e0, const float *e1, BC7Candidate &best)
+{
+    for (int pbits = 0; pbits < 4; ++pbits)
+    {
+        BC7Candidate candidate;
+        candidate.p0 = pbits & 1;
+        candidate.p1 = pbits >> 1;
+        QuantizeBC7(e0, candidate.p0, candidate.q0);
+        QuantizeBC7(e1, candidate.p1, candidate.q1);
+        candidate.error = BC7Indices(rgba, candidate.q0, candidate.p0, candidate.q1, candidate.p1, candidate.indices);
+        if (candidate.error < best.error)
+            best = candidate;
+    }
+}
+
+struct BitWriter
+{
+    uint8_t *out;
+    int position = 0;
+
+    void Write(uint32_t value, int bits)
+    {
+        for (int i = 0; i < bits; ++i, ++position)
+            if ((value >> i) & 1)
+                out[position >> 3] |= static_cast<uint8_t>(1 << (position & 7));
+    }
+};
+
+void EncodeBC7Block(const uint8_t *rgba, uint8_t *out)
+{
+    bool used[16];
+    bool solid = true;
+    for (int i = 0; i < 16; ++i)
+    {
+        used[i] = true;
+        solid &= memcmp(rgba, rgba + i * 4, 4) == 0;
+    }
+
+    float mean[4], axis[4], e0[4], e1[4];
+    PrincipalAxis(rgba, used, 4, mean, axis);
+    AxisEndpoints(rgba, used, 4, mean, axis, e0, e1);
+
+    BC7Candidate best;
+    TryBC7Endpoints(rgba, e0, e1, best);
+
+    // Refine the endpoints with least squares over the chosen indices
+    for (int iteration = 0; iteration < 2 && !solid && best.error > 0; ++iteration)
+    {
+        float weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = bc7Weights[best.indices[i]] / 64.0f;
+        if (!FitEndpoints(rgba, used, weights, 4, e0, e1))
+            break;
+
+        int previousError = best.error;
+        TryBC7Endpoints(rgba, e0, e1, best);
+        if (best.error >= previousError)
+            break;
+    }
+
+    // The anchor index is stored without its top bit, swap the endpoints if it's set
+    if (best.indices[0] & 8)
+    {
+        swap(best.q0, best.q1);
+        swap(best.p0, best.p1);
+        for (int i = 0; i < 16; ++i)
+            best.indices[i] = 15 - best.indices[i];
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer{out};
+    writer.Write(1 << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+        writer.Write(best.q0[c], 7);
+        writer.Write(best.q1[c], 7);
+    }
+    writer.Write(best.p0, 1);
+    writer.Write(best.p1, 1);
+    writer.Write(best.indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        writer.Write(best.indices[i], 4);
+}
+
+// ================================================================
+
+void CompressBlocks(const uint32_t *pixels, int width, int height, PixelFormat format, vector<uint8_t> &out)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    int blockBytes = BlockBytes(format);
+    out.resize(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+
+    ParallelFor(blocksY, [&](int by)
+                {
+        uint8_t rgba[64];
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            // Edge blocks repeat the last row and column
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                {
+                    int px = min(bx * 4 + x, width - 1), py = min(by * 4 + y, height - 1);
+                    memcpy(rgba + (y * 4 + x) * 4, pixels + static_cast<size_t>(py) * width + px, 4);
+                }
+
+            uint8_t *block = out.data() + (static_cast<size_t>(by) * blocksX + bx) * blockBytes;
+            switch (format)
+            {
+            case PixelFormat::BC1:
+                EncodeBC1Block(rgba, block);
+                break;
+            case PixelFormat::BC3:
+                EncodeBC3Block(rgba, block);
+                break;
+            case PixelFormat::BC7:
+                EncodeBC7Block(rgba, block);
+                break;
+            default:
+                break;
+            }
+        } });
+}
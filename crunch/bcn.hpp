@@ -0,0 +1,25 @@
+#ifndef bcn_hpp
+#define bcn_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "options.hpp"
+
+using namespace std;
+
+// True for the BCn formats, which store 4x4 pixel blocks instead of single pixels
+bool IsBlockCompressed(PixelFormat format);
+
+// Size in bytes of one 4x4 block (BCn formats) or one pixel (other formats)
+int BlockBytes(PixelFormat format);
+
+// Encodes a 4x4 block of RGBA pixels (16 * 4 bytes, row by row)
+void EncodeBC1Block(const uint8_t *rgba, uint8_t *out);
+void EncodeBC3Block(const uint8_t *rgba, uint8_t *out);
+void EncodeBC7Block(const uint8_t *rgba, uint8_t *out);
+
+// Compresses a whole RGBA8 image into BCn blocks, block rows are spread over the worker threads
+void CompressBlocks(const uint32_t *pixels, int width, int height, PixelFormat format, vector<uint8_t> &out);
+
+#endif
@@ -31,7 +31,7 @@
 #include <iostream>
 #include <cstdint>
 
-void WriteString(ofstream &bin, const string &value)
+void WriteString(Buffer &bin, const string &value)
 {
     switch (options.binaryStringFormat)
     {
@@ -47,18 +47,18 @@ void WriteString(ofstream &bin, const string &value)
     }
 }
 
-void WriteStringNullTerminated(ofstream &bin, const string &value)
+void WriteStringNullTerminated(Buffer &bin, const string &value)
 {
-    bin.write(value.data(), value.length() + 1);
+    bin << value << '\0';
 }
 
-void WriteStringPrefixed(ofstream &bin, const string &value)
+void WriteStringPrefixed(Buffer &bin, const string &value)
 {
     WriteShort(bin, static_cast<int16_t>(value.length()));
-    bin.write(value.data(), value.length());
+    bin << value;
 }
 
-void WriteString7BitPrefixed(ofstream &bin, const string &value)
+void WriteString7BitPrefixed(Buffer &bin, const string &value)
 {
     // Using 7-bit encoding algorithm from dotnet
     // https://github.com/dotnet/runtime/blob/main/src/libraries/System.Private.CoreLib/src/System/IO/BinaryWriter.cs#L473
@@ -71,18 +71,23 @@ void WriteString7BitPrefixed(ofstream &bin, const string &value)
     }
 
     WriteByte(bin, static_cast<uint8_t>(length));
-    bin.write(value.data(), value.length());
+    bin << value;
 }
 
-void WriteShort(ofstream &bin, int16_t value)
+void WriteShort(Buffer &bin, int16_t value)
 {
-    bin.put(static_cast<uint8_t>(value & 0xff));
-    bin.put(static_cast<uint8_t>((value >> 8) & 0xff));
+    bin << static_cast<char>(value & 0xff) << static_cast<char>((value >> 8) & 0xff);
 }
 
-void WriteByte(ofstream &bin, char value)
+void WriteInt(Buffer &bin, int32_t value)
 {
-    bin.write(&value, 1);
+    for (int i = 0; i < 4; ++i)
+        bin << static_cast<char>((value >> (i * 8)) & 0xff);
+}
+
+void WriteByte(Buffer &bin, char value)
+{
+    bin << value;
 }
 
 int16_t ReadShort(ifstream &bin)
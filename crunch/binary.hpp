@@ -31,14 +31,17 @@
 #include <fstream>
 #include <string>
 
+#include "buffer.hpp"
+
 using namespace std;
 
-void WriteString(ofstream &bin, const string &value);
-void WriteStringNullTerminated(ofstream &bin, const string &value);
-void WriteStringPrefixed(ofstream &bin, const string &value);
-void WriteString7BitPrefixed(ofstream &bin, const string &value);
-void WriteShort(ofstream &bin, int16_t value);
-void WriteByte(ofstream &bin, char value);
+void WriteString(Buffer &bin, const string &value);
+void WriteStringNullTerminated(Buffer &bin, const string &value);
+void WriteStringPrefixed(Buffer &bin, const string &value);
+void WriteString7BitPrefixed(Buffer &bin, const string &value);
+void WriteShort(Buffer &bin, int16_t value);
+void WriteInt(Buffer &bin, int32_t value);
+void WriteByte(Buffer &bin, char value);
 int16_t ReadShort(ifstream &bin);
 
 #endif
@@ -26,89 +26,174 @@
 
 #include "bitmap.hpp"
 
+#include <cstring>
 #include <iostream>
 
 #define LODEPNG_NO_COMPILE_CPP
 #include "third_party/lodepng.h"
+#include "buffer.hpp"
 #include "hash.hpp"
+#include "log.hpp"
+#include "mapped.hpp"
 #include "options.hpp"
+#include "qoi.hpp"
+#include "quantize.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
-Bitmap::Bitmap(const string &file, const string &name, bool premultiply, bool trim)
-    : name(name)
+string FailedToLoad(const string &file)
 {
-    // Load the png file
-    unsigned char *pdata;
-    unsigned int pw, ph;
-    if (lodepng_decode32_file(&pdata, &pw, &ph, file.data()))
+    return string("failed to load ") + (file.ends_with(".qoi") ? "qoi: " : "png: ") + file;
+}
+
+Bitmap *Bitmap::Decode(const string &file, const string &name, bool premultiply, bool trim, string &error)
+{
+    MappedFile input(file);
+    if (!input.loaded)
     {
-        cerr << "failed to load png: " << file << endl;
-        exit(EXIT_FAILURE);
+        error = FailedToLoad(file);
+        return nullptr;
     }
+    AddBytesRead(input.size);
 
-    int w = static_cast<int>(pw);
-    int h = static_cast<int>(ph);
-    uint32_t *pixels = reinterpret_cast<uint32_t *>(pdata);
+    return Decode(file, input.data, input.size, name, premultiply, trim, error);
+}
 
-    // Premultiply all the pixels by their alpha
-    if (premultiply)
+Bitmap *Bitmap::Decode(const string &file, const uint8_t *bytes, size_t size, const string &name, bool premultiply,
+                       bool trim, string &error)
+{
+    TraceSpan span("Bitmap", file);
+    PhaseTimer timer(Phase::Decode);
+
+    int w, h;
+    uint32_t *pixels;
+    if (file.ends_with(".qoi"))
     {
-        int count = w * h;
-        uint32_t c, a, r, g, b;
-        float m;
-        for (int i = 0; i < count; ++i)
+        // Decode the qoi file
+        uint8_t *qdata;
+        if (!QoiDecode(bytes, size, &qdata, w, h))
         {
-            c = pixels[i];
-            a = c >> 24;
-            m = static_cast<float>(a) / 255.0f;
-            r = static_cast<uint32_t>((c & 0xff) * m);
-            g = static_cast<uint32_t>(((c >> 8) & 0xff) * m);
-            b = static_cast<uint32_t>(((c >> 16) & 0xff) * m);
-            pixels[i] = (a << 24) | (b << 16) | (g << 8) | r;
+            error = FailedToLoad(file);
+            return nullptr;
         }
+        pixels = reinterpret_cast<uint32_t *>(qdata);
+    }
+    else
+    {
+        // Decode the png file
+        unsigned char *pdata;
+        unsigned int pw, ph;
+        if (lodepng_decode32(&pdata, &pw, &ph, bytes, size))
+        {
+            error = FailedToLoad(file);
+            return nullptr;
+        }
+        w = static_cast<int>(pw);
+        h = static_cast<int>(ph);
+        pixels = reinterpret_cast<uint32_t *>(pdata);
     }
 
-    // TODO: skip if all corners contain opaque pixels?
+    auto bitmap = new Bitmap(name);
+    bitmap->Load(pixels, w, h, premultiply, trim, file);
+    return bitmap;
+}
 
-    // Get pixel bounds
-    int minX = w - 1;
-    int minY = h - 1;
-    int maxX = 0;
-    int maxY = 0;
-    if (trim)
+Bitmap::Bitmap(const string &name)
+    : name(name)
+{
+}
+
+Bitmap::Bitmap(uint32_t *pixels, int width, int height, const string &name, bool premultiply, bool trim)
+    : name(name)
+{
+    Load(pixels, width, height, premultiply, trim, name);
+}
+
+Bitmap::Bitmap(uint32_t *pixels, int width, int height, int frameX, int frameY, int frameW, int frameH,
+               uint64_t hashValue, const string &name)
+    : name(name), width(width), height(height), frameX(frameX), frameY(frameY), frameW(frameW), frameH(frameH),
+      data(pixels), hashValue(hashValue)
+{
+    if (options.mesh != MeshHull::None)
     {
-        uint32_t p;
-        for (int y = 0; y < h; ++y)
+        PhaseTimer timer(Phase::Trim);
+        mesh = BuildMesh(data, width, height, options.mesh, options.meshVertices);
+    }
+}
+
+void PremultiplyPixels(uint32_t *pixels, size_t count)
+{
+    uint32_t c, a, r, g, b;
+    float m;
+    for (size_t i = 0; i < count; ++i)
+    {
+        c = pixels[i];
+        a = c >> 24;
+        m = static_cast<float>(a) / 255.0f;
+        r = static_cast<uint32_t>((c & 0xff) * m);
+        g = static_cast<uint32_t>(((c >> 8) & 0xff) * m);
+        b = static_cast<uint32_t>(((c >> 16) & 0xff) * m);
+        pixels[i] = (a << 24) | (b << 16) | (g << 8) | r;
+    }
+}
+
+bool FindOpaqueBounds(const uint32_t *pixels, int w, int h, int &minX, int &minY, int &maxX, int &maxY)
+{
+    // TODO: skip if all corners contain opaque pixels?
+    minX = w - 1;
+    minY = h - 1;
+    maxX = 0;
+    maxY = 0;
+    uint32_t p;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
         {
-            for (int x = 0; x < w; ++x)
+            p = pixels[static_cast<size_t>(y) * w + x];
+            if ((p >> 24) > 0)
             {
-                p = pixels[y * w + x];
-                if ((p >> 24) > 0)
-                {
-                    minX = min(x, minX);
-                    minY = min(y, minY);
-                    maxX = max(x, maxX);
-                    maxY = max(y, maxY);
-                }
+                minX = min(x, minX);
+                minY = min(y, minY);
+                maxX = max(x, maxX);
+                maxY = max(y, maxY);
             }
         }
-        if (maxX < minX || maxY < minY)
-        {
-            minX = 0;
-            minY = 0;
-            maxX = w - 1;
-            maxY = h - 1;
-            if (options.verbose)
-                cout << "image is completely transparent: " << file << endl;
-        }
     }
-    else
+    return maxX >= minX && maxY >= minY;
+}
+
+uint64_t HashPixels(const uint32_t *pixels, int width, int height)
+{
+    uint64_t hash = 0;
+    HashCombine(hash, static_cast<uint64_t>(width));
+    HashCombine(hash, static_cast<uint64_t>(height));
+    HashData(hash, reinterpret_cast<const char *>(pixels), sizeof(uint32_t) * static_cast<size_t>(width) * height);
+    return hash;
+}
+
+void Bitmap::Load(uint32_t *pixels, int w, int h, bool premultiply, bool trim, const string &source)
+{
+    PhaseTimer timer(Phase::Trim);
+
+    // Premultiply all the pixels by their alpha
+    if (premultiply)
+        PremultiplyPixels(pixels, static_cast<size_t>(w) * h);
+
+    // Get pixel bounds
+    int minX = 0;
+    int minY = 0;
+    int maxX = w - 1;
+    int maxY = h - 1;
+    if (trim && !FindOpaqueBounds(pixels, w, h, minX, minY, maxX, maxY))
     {
         minX = 0;
         minY = 0;
         maxX = w - 1;
         maxY = h - 1;
+        if (options.verbose)
+            Out() << "image is completely transparent: " << source << endl;
     }
 
     // Calculate our trimmed size
@@ -127,30 +212,40 @@ Bitmap::Bitmap(const string &file, const string &name, bool premultiply, bool tr
     else
     {
         // Create the trimmed image data
-        data = reinterpret_cast<uint32_t *>(calloc(width * height, sizeof(uint32_t)));
+        data = reinterpret_cast<uint32_t *>(calloc(static_cast<size_t>(width) * height, sizeof(uint32_t)));
         frameX = -minX;
         frameY = -minY;
 
         // Copy trimmed pixels over to the trimmed pixel array
         for (int y = minY; y <= maxY; ++y)
             for (int x = minX; x <= maxX; ++x)
-                data[(y - minY) * width + (x - minX)] = pixels[y * w + x];
+                data[static_cast<size_t>(y - minY) * width + (x - minX)] = pixels[static_cast<size_t>(y) * w + x];
 
         // Free the untrimmed pixels
         free(pixels);
     }
 
+    if (options.mesh != MeshHull::None)
+        mesh = BuildMesh(data, width, height, options.mesh, options.meshVertices);
+
     // Generate a hash for the bitmap
-    hashValue = 0;
-    HashCombine(hashValue, static_cast<uint64_t>(width));
-    HashCombine(hashValue, static_cast<uint64_t>(height));
-    HashData(hashValue, reinterpret_cast<char *>(data), sizeof(uint32_t) * width * height);
+    PhaseTimer hashTimer(Phase::Hash);
+    hashValue = HashPixels(data, width, height);
 }
 
 Bitmap::Bitmap(int width, int height)
     : width(width), height(height)
 {
-    data = reinterpret_cast<uint32_t *>(calloc(width * height, sizeof(uint32_t)));
+    data = reinterpret_cast<uint32_t *>(calloc(static_cast<size_t>(width) * height, sizeof(uint32_t)));
+}
+
+Bitmap::Bitmap(const Bitmap &source, const string &name)
+    : name(name), width(source.width), height(source.height), frameX(source.frameX), frameY(source.frameY),
+      frameW(source.frameW), frameH(source.frameH), hashValue(source.hashValue), mesh(source.mesh)
+{
+    size_t size = sizeof(uint32_t) * static_cast<size_t>(width) * height;
+    data = reinterpret_cast<uint32_t *>(malloc(size));
+    memcpy(data, source.data, size);
 }
 
 Bitmap::~Bitmap()
@@ -158,16 +253,54 @@ Bitmap::~Bitmap()
     free(data);
 }
 
-void Bitmap::SaveAs(const string &file)
+bool Bitmap::SaveAs(const string &file)
 {
     unsigned char *pdata = reinterpret_cast<unsigned char *>(data);
     unsigned int pw = static_cast<unsigned int>(width);
     unsigned int ph = static_cast<unsigned int>(height);
-    if (lodepng_encode32_file(file.data(), pdata, pw, ph))
+    unsigned char *png = nullptr;
+    size_t size = 0;
+    unsigned error;
+    {
+        PhaseTimer timer(Phase::Encode);
+        error = lodepng_encode32(&png, &size, pdata, pw, ph);
+    }
+    bool saved = !error && SaveFile(file, png, size);
+    free(png);
+    if (!saved)
+        cerr << "failed to save png: " << file << endl;
+    return saved;
+}
+
+bool Bitmap::SaveAsQoi(const string &file)
+{
+    vector<uint8_t> qoi;
+    {
+        PhaseTimer timer(Phase::Encode);
+        QoiEncode(reinterpret_cast<uint8_t *>(data), width, height, qoi);
+    }
+    if (!SaveFile(file, qoi.data(), qoi.size()))
+    {
+        cerr << "failed to save qoi: " << file << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Bitmap::SaveAsPalette(const string &file, Dither dither)
+{
+    vector<uint8_t> png;
+    bool encoded;
+    {
+        PhaseTimer timer(Phase::Encode);
+        encoded = EncodePalettePng(data, width, height, dither, png);
+    }
+    if (!encoded || !SaveFile(file, png.data(), png.size()))
     {
-        cout << "failed to save png: " << file << endl;
-        exit(EXIT_FAILURE);
+        cerr << "failed to save png: " << file << endl;
+        return false;
     }
+    return true;
 }
 
 void Bitmap::CopyPixels(const Bitmap *src, int tx, int ty)
@@ -188,7 +321,7 @@ void Bitmap::CopyPixelsRot(const Bitmap *src, int tx, int ty)
 bool Bitmap::Equals(const Bitmap *other) const
 {
     if (width == other->width && height == other->height)
-        return memcmp(data, other->data, sizeof(uint32_t) * width * height) == 0;
+        return memcmp(data, other->data, sizeof(uint32_t) * static_cast<size_t>(width) * height) == 0;
     return false;
 }
 
@@ -219,10 +352,10 @@ void Bitmap::StretchPixels(int rectX, int rectY, int rectWidth, int rectHeight,
 
 void Bitmap::CopyPixel(const Bitmap *src, int srcX, int srcY, int x, int y)
 {
-    data[y * width + x] = src->data[srcY * src->width + srcX];
+    data[static_cast<size_t>(y) * width + x] = src->data[static_cast<size_t>(srcY) * src->width + srcX];
 }
 
 void Bitmap::CopyPixel(int srcX, int srcY, int x, int y)
 {
-    data[y * width + x] = data[srcY * width + srcX];
+    data[static_cast<size_t>(y) * width + x] = data[static_cast<size_t>(srcY) * width + srcX];
 }
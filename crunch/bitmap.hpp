@@ -31,6 +31,8 @@
 #include <string>
 #include <vector>
 
+#include "mesh.hpp"
+
 using namespace std;
 
 struct Bitmap
@@ -44,18 +46,45 @@ struct Bitmap
     int frameH;
     uint32_t *data;
     uint64_t hashValue;
-    Bitmap(const string &file, const string &name, bool premultiply, bool trim);
+    // Outline of the opaque pixels with --mesh, empty otherwise
+    Mesh mesh;
+    // Reads and decodes a .png or .qoi file, the file name picks the format. Returns nullptr and sets the error
+    // if the file can't be read or decoded
+    static Bitmap *Decode(const string &file, const string &name, bool premultiply, bool trim, string &error);
+    // The same for the bytes of a file that was already read
+    static Bitmap *Decode(const string &file, const uint8_t *bytes, size_t size, const string &name, bool premultiply,
+                          bool trim, string &error);
+    // Takes ownership of the RGBA8 pixels, which must be allocated with malloc
+    Bitmap(uint32_t *pixels, int width, int height, const string &name, bool premultiply, bool trim);
+    // Takes ownership of pixels that are already premultiplied and trimmed, with the frame and hash they had
+    Bitmap(uint32_t *pixels, int width, int height, int frameX, int frameY, int frameW, int frameH, uint64_t hashValue,
+           const string &name);
     Bitmap(int width, int height);
+    Bitmap(const Bitmap &source, const string &name);
     ~Bitmap();
-    void SaveAs(const string &file);
+    // The saves print the error and return false if the file can't be written
+    bool SaveAs(const string &file);
+    bool SaveAsQoi(const string &file);
+    // Saves an 8 bit palette png with at most 256 colors
+    bool SaveAsPalette(const string &file, Dither dither);
     void CopyPixels(const Bitmap *src, int tx, int ty);
     void CopyPixelsRot(const Bitmap *src, int tx, int ty);
     bool Equals(const Bitmap *other) const;
     void StretchPixels(int tx, int ty, int rectWidth, int rectHeight, int amount);
 
 private:
+    explicit Bitmap(const string &name);
+    void Load(uint32_t *pixels, int w, int h, bool premultiply, bool trim, const string &source);
     void CopyPixel(int srcX, int srcY, int x, int y);
     void CopyPixel(const Bitmap *src, int srcX, int srcY, int x, int y);
 };
 
+// The steps of loading a bitmap, also used on their own by the benchmarks
+void PremultiplyPixels(uint32_t *pixels, size_t count);
+// Bounds of the pixels that aren't fully transparent, returns false if there are none
+bool FindOpaqueBounds(const uint32_t *pixels, int w, int h, int &minX, int &minY, int &maxX, int &maxY);
+uint64_t HashPixels(const uint32_t *pixels, int width, int height);
+// The error of an image file that can't be read or decoded
+string FailedToLoad(const string &file);
+
 #endif
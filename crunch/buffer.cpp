@@ -0,0 +1,34 @@
+#include "buffer.hpp"
+
+#include <fstream>
+
+#include "stats.hpp"
+
+using namespace std;
+
+bool Buffer::AppendFile(const string &file)
+{
+    ifstream stream(file, ios::binary | ios::ate);
+    if (!stream)
+        return false;
+
+    streamsize size = stream.tellg();
+    stream.seekg(0, ios::beg);
+    size_t offset = data.size();
+    data.resize(offset + size);
+    AddBytesRead(size);
+    return static_cast<bool>(stream.read(data.data() + offset, size));
+}
+
+bool Buffer::Save(const string &file) const
+{
+    return SaveFile(file, data.data(), data.size());
+}
+
+bool SaveFile(const string &file, const void *data, size_t size)
+{
+    PhaseTimer timer(Phase::Write);
+    AddBytesWritten(size);
+    ofstream stream(file, ios::binary);
+    return static_cast<bool>(stream.write(reinterpret_cast<const char *>(data), size));
+}
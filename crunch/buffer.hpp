@@ -0,0 +1,65 @@
+#ifndef buffer_hpp
+#define buffer_hpp
+
+#include <charconv>
+#include <concepts>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Growable in-memory output, files are formatted into it and then written with a single call
+struct Buffer
+{
+    vector<char> data;
+
+    Buffer &operator<<(string_view value)
+    {
+        data.insert(data.end(), value.begin(), value.end());
+        return *this;
+    }
+
+    Buffer &operator<<(const char *value)
+    {
+        return *this << string_view(value);
+    }
+
+    Buffer &operator<<(const string &value)
+    {
+        return *this << string_view(value);
+    }
+
+    Buffer &operator<<(char value)
+    {
+        data.push_back(value);
+        return *this;
+    }
+
+    template <integral T>
+    Buffer &operator<<(T value)
+    {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        data.insert(data.end(), digits, result.ptr);
+        return *this;
+    }
+
+    void Write(const char *bytes, size_t size)
+    {
+        data.insert(data.end(), bytes, bytes + size);
+    }
+
+    void Append(const Buffer &other)
+    {
+        data.insert(data.end(), other.data.begin(), other.data.end());
+    }
+
+    bool AppendFile(const string &file);
+    bool Save(const string &file) const;
+};
+
+// Writes the bytes to a file with a single call, returns false if the file couldn't be written
+bool SaveFile(const string &file, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,60 @@
+#include "cache.hpp"
+
+#include <filesystem>
+
+#include "options.hpp"
+#include "pixelcache.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// The same file decoded with different options gives different pixels
+static string CacheKey(const string &file)
+{
+    return fs::absolute(file).lexically_normal().string() + (options.premultiply ? "|p" : "|") + (options.trim ? "t" : "") +
+           (options.mesh != MeshHull::None ? "|m" + to_string(static_cast<int>(options.mesh)) + "/" + to_string(options.meshVertices) : "");
+}
+
+void DecodeCache::Register(const string &file)
+{
+    lock_guard<mutex> guard(lock);
+    auto &entry = entries[CacheKey(file)];
+    if (!entry)
+        entry = make_shared<Entry>();
+    ++entry->uses;
+    ++entry->remaining;
+}
+
+void DecodeCache::Release(const string &file)
+{
+    lock_guard<mutex> guard(lock);
+    auto found = entries.find(CacheKey(file));
+    if (found == entries.end() || --found->second->remaining > 0)
+        return;
+    delete found->second->bitmap;
+    entries.erase(found);
+}
+
+Bitmap *DecodeCache::Load(const string &file, const string &name, const uint8_t *bytes, size_t size, string &error)
+{
+    string key = CacheKey(file);
+    shared_ptr<Entry> entry;
+    {
+        lock_guard<mutex> guard(lock);
+        auto found = entries.find(key);
+        if (found != entries.end() && found->second->uses > 1)
+            entry = found->second;
+    }
+
+    if (!entry)
+        return DecodeBitmap(file, bytes, size, name, error);
+
+    call_once(entry->decoded, [&]()
+              { entry->bitmap = DecodeBitmap(file, bytes, size, name, entry->error); });
+    if (!entry->bitmap)
+    {
+        error = entry->error;
+        return nullptr;
+    }
+    return new Bitmap(*entry->bitmap, name);
+}
@@ -0,0 +1,42 @@
+#ifndef cache_hpp
+#define cache_hpp
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "bitmap.hpp"
+
+using namespace std;
+
+// Decoded images shared by the atlases of a batch, so an image used by several atlases is only decoded once.
+// The uses are registered up front and released when their atlas is done, whether it loaded the image, was
+// unchanged or failed, and the cached pixels are freed once the last use is released
+struct DecodeCache
+{
+    // Counts a use of the image, decoded with the current premultiply and trim options
+    void Register(const string &file);
+
+    // Releases a use registered with the same options
+    void Release(const string &file);
+
+    // Returns a new bitmap of the image decoded from the bytes of the file, only images registered more
+    // than once are kept in the cache. Returns nullptr with the error if the image can't be decoded
+    Bitmap *Load(const string &file, const string &name, const uint8_t *bytes, size_t size, string &error);
+
+private:
+    struct Entry
+    {
+        once_flag decoded;
+        Bitmap *bitmap = nullptr;
+        string error;
+        int uses = 0;
+        int remaining = 0;
+    };
+
+    mutex lock;
+    unordered_map<string, shared_ptr<Entry>> entries;
+};
+
+#endif
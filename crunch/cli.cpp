@@ -1,16 +1,35 @@
 #include "cli.hpp"
 
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 
 #include "options.hpp"
+#include "pipeline.hpp"
 
 using namespace std;
 using namespace rbp;
 
-const static string expectedSize = "4096, 2048, 1024, 512, 256, 128, or 64",
+const static string expectedSize = "16384, 8192, 4096, 2048, 1024, 512, 256, 128, or 64",
                     expectedPaddingOrStretch = "integer from 0 to 16",
-                    expectedBinaryStringFormat = "0, 16 or 7";
+                    expectedBinaryStringFormat = "0, 16 or 7",
+                    expectedBinaryVersion = "0, 1 or 2",
+                    expectedThreads = "integer from 0 to 256",
+                    expectedTextureFormat = "png, qoi, dds or ktx2",
+                    expectedPixelFormat = "rgba8, bc1, bc3, bc7, rgba4444, rgb565, rgba5551 or palette",
+                    expectedDither = "none, ordered or diffusion",
+                    expectedHeuristic = "bssf, blsf, baf, blr or cpr",
+                    expectedSeconds = "number of seconds from 0 to 3600",
+                    expectedSeed = "integer from 0 to 4294967295",
+                    expectedRounds = "integer from 0 to 1000000",
+                    expectedMips = "integer from 1 to 5",
+                    expectedMipFilter = "box or kaiser",
+                    expectedMesh = "convex or concave",
+                    expectedMeshVertices = "integer from 4 to 64",
+                    expectedFile = "file name",
+                    expectedDirectory = "directory",
+                    expectedCacheSize = "megabytes from 1 to 1048576";
 
 void PrintHelp(int argc, const char *argv[])
 {
@@ -39,7 +58,7 @@ void PrintHelp(int argc, const char *argv[])
 
 static int GetPackSize(const string &str)
 {
-    for (int i = 64; i <= 4096; i *= 2)
+    for (int i = 64; i <= 16384; i *= 2)
         if (str == to_string(i))
             return i;
     cerr << "invalid size: " << str << endl;
@@ -67,6 +86,41 @@ static int GetStretch(const string &str)
     return 0;
 }
 
+static int GetMips(const string &str)
+{
+    for (int i = 1; i <= 5; ++i)
+        if (str == to_string(i))
+            return i;
+    cerr << "invalid mip level: " << str << endl;
+    exit(EXIT_FAILURE);
+    return 0;
+}
+
+static MipFilter GetMipFilter(const string &str)
+{
+    if (str == "box")
+        return MipFilter::Box;
+    if (str == "kaiser")
+        return MipFilter::Kaiser;
+    cerr << "invalid mip filter: " << str << endl;
+    exit(EXIT_FAILURE);
+}
+
+static string MipFilterName(MipFilter filter)
+{
+    return filter == MipFilter::Kaiser ? "kaiser" : "box";
+}
+
+static int GetThreads(const string &str)
+{
+    for (int i = 0; i <= 256; ++i)
+        if (str == to_string(i))
+            return i;
+    cerr << "invalid thread count: " << str << endl;
+    exit(EXIT_FAILURE);
+    return 0;
+}
+
 static BinaryStringFormat GetBinaryStringFormat(const string &str)
 {
     if (str == "0")
@@ -80,6 +134,154 @@ static BinaryStringFormat GetBinaryStringFormat(const string &str)
     exit(EXIT_FAILURE);
 }
 
+static int GetBinaryVersion(const string &str)
+{
+    if (str == "0")
+        return 0;
+    if (str == "1")
+        return 1;
+    if (str == "2")
+        return 2;
+
+    cerr << "invalid binary version: " << str << endl;
+    exit(EXIT_FAILURE);
+}
+
+static TextureFormat GetTextureFormat(const string &str)
+{
+    if (str == "png")
+        return TextureFormat::Png;
+    if (str == "qoi")
+        return TextureFormat::Qoi;
+    if (str == "dds")
+        return TextureFormat::Dds;
+    if (str == "ktx2")
+        return TextureFormat::Ktx2;
+
+    cerr << "invalid texture format: " << str << endl;
+    exit(EXIT_FAILURE);
+}
+
+static string TextureFormatName(TextureFormat format)
+{
+    switch (format)
+    {
+    case TextureFormat::Qoi:
+        return "qoi";
+    case TextureFormat::Dds:
+        return "dds";
+    case TextureFormat::Ktx2:
+        return "ktx2";
+    default:
+        return "png";
+    }
+}
+
+static PixelFormat GetPixelFormat(const string &str)
+{
+    if (str == "rgba8")
+        return PixelFormat::RGBA8;
+    if (str == "bc1")
+        return PixelFormat::BC1;
+    if (str == "bc3")
+        return PixelFormat::BC3;
+    if (str == "bc7")
+        return PixelFormat::BC7;
+    if (str == "rgba4444")
+        return PixelFormat::RGBA4444;
+    if (str == "rgb565")
+        return PixelFormat::RGB565;
+    if (str == "rgba5551")
+        return PixelFormat::RGBA5551;
+    if (str == "palette")
+        return PixelFormat::Palette;
+
+    cerr << "invalid pixel format: " << str << endl;
+    exit(EXIT_FAILURE);
+}
+
+static string PixelFormatName(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::BC1:
+        return "bc1";
+    case PixelFormat::BC3:
+        return "bc3";
+    case PixelFormat::BC7:
+        return "bc7";
+    case PixelFormat::RGBA4444:
+        return "rgba4444";
+    case PixelFormat::RGB565:
+        return "rgb565";
+    case PixelFormat::RGBA5551:
+        return "rgba5551";
+    case PixelFormat::Palette:
+        return "palette";
+    default:
+        return "rgba8";
+    }
+}
+
+static Dither GetDither(const string &str)
+{
+    if (str == "none")
+        return Dither::None;
+    if (str == "ordered")
+        return Dither::Ordered;
+    if (str == "diffusion")
+        return Dither::Diffusion;
+    cerr << "invalid dither: " << str << endl;
+    exit(EXIT_FAILURE);
+}
+
+static string DitherName(Dither dither)
+{
+    switch (dither)
+    {
+    case Dither::Ordered:
+        return "ordered";
+    case Dither::Diffusion:
+        return "diffusion";
+    default:
+        return "none";
+    }
+}
+
+static MeshHull GetMeshHull(const string &str)
+{
+    if (str == "convex")
+        return MeshHull::Convex;
+    if (str == "concave")
+        return MeshHull::Concave;
+
+    cerr << "invalid mesh: " << str << endl;
+    exit(EXIT_FAILURE);
+}
+
+static string MeshHullName(MeshHull hull)
+{
+    switch (hull)
+    {
+    case MeshHull::Convex:
+        return "convex";
+    case MeshHull::Concave:
+        return "concave";
+    default:
+        return "false";
+    }
+}
+
+static int GetMeshVertices(const string &str)
+{
+    for (int i = 4; i <= 64; ++i)
+        if (str == to_string(i))
+            return i;
+    cerr << "invalid mesh vertex count: " << str << endl;
+    exit(EXIT_FAILURE);
+    return 8;
+}
+
 static MaxRectsBinPack::FreeRectChoiceHeuristic GetChoiceHeuristic(const string &str)
 {
     if (str == "bssf")
@@ -97,6 +299,54 @@ static MaxRectsBinPack::FreeRectChoiceHeuristic GetChoiceHeuristic(const string
     exit(EXIT_FAILURE);
 }
 
+static double GetOptimizeSeconds(const string &str)
+{
+    char *end = nullptr;
+    double seconds = strtod(str.c_str(), &end);
+    if (str.empty() || *end != '\0' || !(seconds >= 0 && seconds <= 3600))
+    {
+        cerr << "invalid optimize time: " << str << endl;
+        exit(EXIT_FAILURE);
+    }
+    return seconds;
+}
+
+static int GetRounds(const string &str)
+{
+    char *end = nullptr;
+    long rounds = strtol(str.c_str(), &end, 10);
+    if (str.empty() || !isdigit(static_cast<unsigned char>(str[0])) || *end != '\0' || rounds > 1000000)
+    {
+        cerr << "invalid round count: " << str << endl;
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<int>(rounds);
+}
+
+static uint32_t GetSeed(const string &str)
+{
+    char *end = nullptr;
+    unsigned long long seed = strtoull(str.c_str(), &end, 10);
+    if (str.empty() || !isdigit(static_cast<unsigned char>(str[0])) || *end != '\0' || seed > UINT32_MAX)
+    {
+        cerr << "invalid seed: " << str << endl;
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<uint32_t>(seed);
+}
+
+static int GetCacheSize(const string &str)
+{
+    char *end = nullptr;
+    long size = strtol(str.c_str(), &end, 10);
+    if (str.empty() || !isdigit(static_cast<unsigned char>(str[0])) || *end != '\0' || size < 1 || size > 1048576)
+    {
+        cerr << "invalid cache size: " << str << endl;
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<int>(size);
+}
+
 static void PrintNoArgument(const string &expected, const string &argument)
 {
     cerr << "expected " << expected << " for argument " << argument << endl;
@@ -126,6 +376,27 @@ void ParseArguments(int argc, const char *argv[], int offset)
             options.json = true;
         else if (arg == "--binary" || arg == "-b")
             options.binary = true;
+        else if (arg == "--texture" || arg == "-tx")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedTextureFormat, arg);
+            options.textureFormat = GetTextureFormat(nextArg);
+            i++;
+        }
+        else if (arg == "--pixels" || arg == "-px")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedPixelFormat, arg);
+            options.pixelFormat = GetPixelFormat(nextArg);
+            i++;
+        }
+        else if (arg == "--dither" || arg == "-dt")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedDither, arg);
+            options.dither = GetDither(nextArg);
+            i++;
+        }
 
         // ================================================================
 
@@ -164,6 +435,22 @@ void ParseArguments(int argc, const char *argv[], int offset)
             options.stretch = GetStretch(nextArg);
             i++;
         }
+        else if (arg == "--blockalign" || arg == "-ba")
+            options.blockAlign = true;
+        else if (arg == "--mips" || arg == "-mp")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedMips, arg);
+            options.mips = GetMips(nextArg);
+            i++;
+        }
+        else if (arg == "--mipfilter" || arg == "-mf")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedMipFilter, arg);
+            options.mipFilter = GetMipFilter(nextArg);
+            i++;
+        }
 
         // ================================================================
 
@@ -175,13 +462,50 @@ void ParseArguments(int argc, const char *argv[], int offset)
             options.trim = true;
         else if (arg == "--rotate" || arg == "-r")
             options.rotate = true;
+        else if (arg == "--grid" || arg == "-gd")
+            options.grid = true;
+        else if (arg == "--mesh" || arg == "-ms")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedMesh, arg);
+            options.mesh = GetMeshHull(nextArg);
+            i++;
+        }
+        else if (arg == "--meshverts" || arg == "-mv")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedMeshVertices, arg);
+            options.meshVertices = GetMeshVertices(nextArg);
+            i++;
+        }
         else if (arg == "--heuristic" || arg == "-hr")
         {
             if (noArgumentAhead)
-                PrintNoArgument(expectedBinaryStringFormat, arg);
+                PrintNoArgument(expectedHeuristic, arg);
             options.choiceHeuristic = GetChoiceHeuristic(nextArg);
             i++;
         }
+        else if (arg == "--optimize" || arg == "-op")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedSeconds, arg);
+            options.optimize = GetOptimizeSeconds(nextArg);
+            i++;
+        }
+        else if (arg == "--rounds" || arg == "-rn")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedRounds, arg);
+            options.rounds = GetRounds(nextArg);
+            i++;
+        }
+        else if (arg == "--seed" || arg == "-sd")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedSeed, arg);
+            options.seed = GetSeed(nextArg);
+            i++;
+        }
 
         // ================================================================
 
@@ -192,6 +516,13 @@ void ParseArguments(int argc, const char *argv[], int offset)
             options.binaryStringFormat = GetBinaryStringFormat(nextArg);
             i++;
         }
+        else if (arg == "--binver" || arg == "-bv")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedBinaryVersion, arg);
+            options.binaryVersion = GetBinaryVersion(nextArg);
+            i++;
+        }
         else if (arg == "--force" || arg == "-f")
             options.force = true;
         else if (arg == "--verbose" || arg == "-v")
@@ -202,6 +533,43 @@ void ParseArguments(int argc, const char *argv[], int offset)
             options.splitSubdirectories = true;
         else if (arg == "--nozero" || arg == "-nz")
             options.noZero = true;
+        else if (arg == "--threads" || arg == "-th")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedThreads, arg);
+            options.threads = GetThreads(nextArg);
+            i++;
+        }
+        else if (arg == "--watch" || arg == "-wt")
+            options.watch = true;
+        else if (arg == "--stats" || arg == "-ss")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedFile, arg);
+            options.stats = NormalizePath(nextArg);
+            i++;
+        }
+        else if (arg == "--trace" || arg == "-tr")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedFile, arg);
+            options.trace = NormalizePath(nextArg);
+            i++;
+        }
+        else if (arg == "--cache" || arg == "-ca")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedDirectory, arg);
+            options.cache = NormalizePath(nextArg);
+            i++;
+        }
+        else if (arg == "--cachesize" || arg == "-cs")
+        {
+            if (noArgumentAhead)
+                PrintNoArgument(expectedCacheSize, arg);
+            options.cacheSize = GetCacheSize(nextArg);
+            i++;
+        }
         else
         {
             cerr << "unexpected argument: " << arg << endl;
@@ -215,12 +583,46 @@ void ParseArguments(int argc, const char *argv[], int offset)
     if (height != -1)
         options.height = height;
 
+    if (options.pixelFormat == PixelFormat::Palette && options.textureFormat != TextureFormat::Png)
+    {
+        cerr << "pixel format palette requires --texture png" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if ((options.textureFormat == TextureFormat::Png || options.textureFormat == TextureFormat::Qoi) &&
+        options.pixelFormat != PixelFormat::RGBA8 && options.pixelFormat != PixelFormat::Palette)
+    {
+        cerr << "pixel format " << PixelFormatName(options.pixelFormat) << " requires --texture dds or ktx2" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if ((options.textureFormat == TextureFormat::Png || options.textureFormat == TextureFormat::Qoi) && options.mips != 0)
+    {
+        cerr << "--mips requires --texture dds or ktx2" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.watch && options.splitSubdirectories)
+    {
+        cerr << "--watch can't be combined with --split" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.watch && (!options.stats.empty() || !options.trace.empty()))
+    {
+        cerr << "--watch can't be combined with " << (options.stats.empty() ? "--trace" : "--stats") << endl;
+        exit(EXIT_FAILURE);
+    }
+
     if (options.verbose)
     {
         cout << "options..." << endl;
         cout << "\t--xml: " << (options.xml ? "true" : "false") << endl;
         cout << "\t--json: " << (options.json ? "true" : "false") << endl;
         cout << "\t--binary: " << (options.binary ? "true" : "false") << endl;
+        cout << "\t--texture: " << TextureFormatName(options.textureFormat) << endl;
+        cout << "\t--pixels: " << PixelFormatName(options.pixelFormat) << endl;
+        cout << "\t--dither: " << DitherName(options.dither) << endl;
 
         if (options.width == options.height)
             cout << "\t--size: " << options.width << endl;
@@ -230,17 +632,34 @@ void ParseArguments(int argc, const char *argv[], int offset)
             cout << "\t--height: " << options.height << endl;
         }
         cout << "\t--padding: " << options.padding << endl;
+        cout << "\t--stretch: " << options.stretch << endl;
+        cout << "\t--blockalign: " << (options.blockAlign ? "true" : "false") << endl;
+        cout << "\t--mips: " << options.mips << endl;
+        cout << "\t--mipfilter: " << MipFilterName(options.mipFilter) << endl;
 
         cout << "\t--premultiply: " << (options.premultiply ? "true" : "false") << endl;
         cout << "\t--unique: " << (options.unique ? "true" : "false") << endl;
         cout << "\t--trim: " << (options.trim ? "true" : "false") << endl;
         cout << "\t--rotate: " << (options.rotate ? "true" : "false") << endl;
+        cout << "\t--grid: " << (options.grid ? "true" : "false") << endl;
+        cout << "\t--mesh: " << MeshHullName(options.mesh) << endl;
+        cout << "\t--meshverts: " << options.meshVertices << endl;
+        cout << "\t--optimize: " << options.optimize << endl;
+        cout << "\t--rounds: " << options.rounds << endl;
+        cout << "\t--seed: " << options.seed << endl;
 
         cout << "\t--binstr: " << (options.binaryStringFormat == BinaryStringFormat::NullTerminated ? "0" : (options.binaryStringFormat == BinaryStringFormat::Prefix16 ? "16" : "7")) << endl;
+        cout << "\t--binver: " << options.binaryVersion << endl;
         cout << "\t--force: " << (options.force ? "true" : "false") << endl;
         cout << "\t--verbose: " << (options.verbose ? "true" : "false") << endl;
         cout << "\t--time: " << (options.useTimeForHash ? "true" : "false") << endl;
         cout << "\t--split: " << (options.splitSubdirectories ? "true" : "false") << endl;
         cout << "\t--nozero: " << (options.noZero ? "true" : "false") << endl;
+        cout << "\t--threads: " << options.threads << endl;
+        cout << "\t--watch: " << (options.watch ? "true" : "false") << endl;
+        cout << "\t--stats: " << (options.stats.empty() ? "false" : options.stats) << endl;
+        cout << "\t--trace: " << (options.trace.empty() ? "false" : options.trace) << endl;
+        cout << "\t--cache: " << (options.cache.empty() ? "false" : options.cache) << endl;
+        cout << "\t--cachesize: " << options.cacheSize << endl;
     }
 }
@@ -11,9 +11,11 @@ const string version = "v0.13";
 static const string helpMessage = R"(
 usage:
   crunch [OUTPUT] [INPUT1,INPUT2,INPUT3...] [OPTIONS...]
+  crunch --batch [JOBFILE] [OPTIONS...]
     
 example:
   crunch bin/atlases/atlas assets/characters,assets/tiles -p -t -v -u -r
+  crunch --batch atlases.txt -p -t (every line of atlases.txt is "[OUTPUT] [INPUT1,INPUT2,INPUT3...] [OPTIONS...]")
     
 options:
   name           | alias |
@@ -23,29 +25,48 @@ options:
   --xml          |  -x   |  saves the atlas data as a .xml file
   --json         |  -j   |  saves the atlas data as a .json file
   --binary       |  -b   |  saves the atlas data as a .bin file
+  --texture T    |  -tx  |  file format of the atlas textures (T can be png, qoi, dds, ktx2)
+  --pixels F     |  -px  |  pixel format of the textures (F can be rgba8, bc1, bc3, bc7, rgba4444, rgb565, rgba5551 for dds and ktx2, palette for png)
+  --dither D     |  -dt  |  dithering of the 16-bit and palette formats (D can be none (default), ordered, diffusion)
   -----------------------------------------------------------------------------------------------------------------------------------------------
-  --size N       |  -s   |  max atlas size (N can be 4096, 2048, 1024, 512, 256, 128, or 64)
-  --width N      |  -w   |  max atlas width (overrides --size) (N can be 4096, 2048, 1024, 512, 256, 128, or 64)
-  --height N     |  -h   |  max atlas height (overrides --size) (N can be 4096, 2048, 1024, 512, 256, 128, or 64)
+  --size N       |  -s   |  max atlas size (N can be 16384, 8192, 4096, 2048, 1024, 512, 256, 128, or 64)
+  --width N      |  -w   |  max atlas width (overrides --size) (N can be 16384, 8192, 4096, 2048, 1024, 512, 256, 128, or 64)
+  --height N     |  -h   |  max atlas height (overrides --size) (N can be 16384, 8192, 4096, 2048, 1024, 512, 256, 128, or 64)
   --padding N    |  -pd  |  padding between images (N can be from 0 to 16)
   --stretch N    |  -st  |  makes images' edges stretched by N pixels (N can be from 0 to 16)
+  --blockalign   |  -ba  |  aligns images with their padding to 4x4 pixel blocks, so compressed blocks don't bleed between images
+  --mips N       |  -mp  |  saves dds and ktx2 textures with all their mip levels, images are kept apart down to level N (N can be from 1 to 5)
+  --mipfilter F  |  -mf  |  filter that makes the mip levels (F can be box (default), kaiser)
   -----------------------------------------------------------------------------------------------------------------------------------------------
   --premultiply  |  -p   |  premultiplies the pixels of the bitmaps by their alpha channel
   --unique       |  -u   |  remove duplicate bitmaps from the atlas
   --trim         |  -t   |  trims excess transparency off the bitmaps
   --rotate       |  -r   |  enabled rotating bitmaps 90 degrees clockwise when packing
+  --grid         |  -gd  |  places the bitmaps in a grid of cells the size of the largest one (bitmaps that all have the same size always are)
+  --mesh H       |  -ms  |  saves a polygon around the opaque pixels of every bitmap as vertices and triangles (H can be convex, concave)
+  --meshverts N  |  -mv  |  max vertices of a --mesh polygon (N can be from 4 to 64, default 8)
   --heuristic H  |  -hr  |  use specific heuristic rule for packing images (H can be bssf (BestShortSideFit), blsf (BestLongSideFit), baf (BestAreaFit), blr (BottomLeftRule), cpr (ContactPointRule))
+  --optimize S   |  -op  |  searches for S seconds for an order, heuristic and rotation of the images that needs fewer or smaller pages (S can be from 0 to 3600, 0 - pack once (default))
+  --rounds N     |  -rn  |  searches for N rounds of the --optimize search, the same seed and rounds always pack the same atlas, --optimize then only stops it early (N can be from 0 to 1000000, 0 - no limit (default))
+  --seed N       |  -sd  |  seed of the --optimize search, a seed always tries the same packings in the same order (default 0)
   -----------------------------------------------------------------------------------------------------------------------------------------------
   --binstr T     |  -bs  |  string type in binary format (T can be: 0 - null-termainated, 16 - prefixed (int16), 7 - 7-bit prefixed)
+  --binver V     |  -bv  |  binary format version (V can be: 0 - sequential (default), 1 - fixed-size records with a name hash index, see atlas_reader.hpp, 2 - sequential with 32-bit numbers)
   --force        |  -f   |  ignore the hash, forcing the packer to repack
   --verbose      |  -v   |  print to the debug console as the packer works
   --time         |  -tm  |  use file's last write time instead of its content for hashing
   --split        |  -sp  |  split output textures by subdirectories
   --nozero       |  -nz  |  if there's ony one packed texture, then zero at the end of its name will be omitted (ex. images0.png -> images.png)
+  --threads N    |  -th  |  number of worker threads (N can be from 0 to 256, 0 - one per hardware thread (default))
+  --watch        |  -wt  |  keeps running and repacks the atlas whenever the inputs change (can't be combined with --split)
+  --stats FILE   |  -ss  |  writes a json report of the run to FILE: time per phase, peak memory, bytes read and written, page occupancy
+  --trace FILE   |  -tr  |  writes the timeline of the run to FILE as chrome trace events (open it in chrome://tracing or ui.perfetto.dev)
+  --cache DIR    |  -ca  |  keeps the decoded images in DIR by their contents, so later runs and other atlases don't decode them again
+  --cachesize MB |  -cs  |  megabytes the --cache directory is pruned back to, the least recently used images are removed first (MB can be from 1 to 1048576, default 1024)
     
 binary format:
   crch (0x68637263 in hex or 1751347811 in decimal)
-  [int16] version (current version is 0)
+  [int16] version (current version is 0, 2 with --mesh)
   [byte] --trim enabled
   [byte] --rotate enabled
   [byte] string type (0 - null-termainated, 1 - prefixed (int16), 2 - 7-bit prefixed)
@@ -62,6 +83,29 @@ binary format:
       [int16] img_frame_width     (if --trim enabled)
       [int16] img_frame_height    (if --trim enabled)
       [byte] img_rotated          (if --rotate enabled)
+      [int16] num_vertices        (if --mesh enabled, version 2)
+      [int16] vertex_x, vertex_y  (num_vertices times)
+      [int16] num_indices         (if --mesh enabled, version 2)
+      [int16] index               (num_indices times, three per triangle)
+  with --binver 2 the version is 4, 5 with --mesh, and every int16 above but the version is an int32
+
+binary format version 1 (--binver 1), all fields are little endian and 4-byte aligned:
+  [char[4]] crch
+  [uint16] version (1)
+  [byte] --trim enabled
+  [byte] --rotate enabled
+  [uint32] num_textures, num_images, num_hash_slots
+  [uint32] texture_offset, image_offset, hash_offset, string_offset, string_size
+  textures (num_textures times): [uint32] name, first_image, num_images, reserved
+  images (num_images times): [uint32] name, texture
+                             [int32] x, y, width, height, frame_x, frame_y, frame_width, frame_height
+                             [uint32] flags (1 - rotated), name_hash (FNV-1a)
+  hash slots (num_hash_slots times): [uint32] image index + 1, 0 if empty (linear probing)
+  strings: null-terminated names, name fields are offsets into this table
+  with --mesh the version is 3, the header is followed by [uint32] mesh_offset, vertex_offset, num_vertices, index_offset, num_indices, reserved
+  meshes (num_images times): [uint32] first_vertex, num_vertices, first_index, num_indices
+  vertices (num_vertices times): [int32] x, y
+  indices (num_indices times): [uint16] index into the vertices of the mesh, three per triangle
     )";
 
 void PrintHelp(int argc, const char *argv[]);
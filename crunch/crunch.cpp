@@ -0,0 +1,181 @@
+#include "crunch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#define LODEPNG_NO_COMPILE_CPP
+#include "third_party/lodepng.h"
+#include "bitmap.hpp"
+#include "log.hpp"
+#include "packer.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "qoi.hpp"
+#include "quantize.hpp"
+#include "texture.hpp"
+
+using namespace std;
+
+// Decodes or copies the image into a new bitmap, returns nullptr with the error if the image is invalid
+static Bitmap *LoadImage(const PackImage &image, string &error)
+{
+    uint32_t *pixels = nullptr;
+    int width = image.width, height = image.height;
+    if (image.encoded)
+    {
+        bool qoi = image.encodedSize >= 4 && memcmp(image.encoded, "qoif", 4) == 0;
+        if (qoi)
+        {
+            uint8_t *qdata;
+            if (!QoiDecode(image.encoded, image.encodedSize, &qdata, width, height))
+            {
+                error = "failed to load qoi: " + image.name;
+                return nullptr;
+            }
+            pixels = reinterpret_cast<uint32_t *>(qdata);
+        }
+        else
+        {
+            unsigned char *pdata;
+            unsigned int pw, ph;
+            if (lodepng_decode32(&pdata, &pw, &ph, image.encoded, image.encodedSize))
+            {
+                error = "failed to load png: " + image.name;
+                return nullptr;
+            }
+            width = static_cast<int>(pw);
+            height = static_cast<int>(ph);
+            pixels = reinterpret_cast<uint32_t *>(pdata);
+        }
+    }
+    else
+    {
+        if (!image.pixels || width <= 0 || height <= 0)
+        {
+            error = "image has no pixels: " + image.name;
+            return nullptr;
+        }
+        size_t size = sizeof(uint32_t) * width * height;
+        pixels = reinterpret_cast<uint32_t *>(malloc(size));
+        memcpy(pixels, image.pixels, size);
+    }
+    return new Bitmap(pixels, width, height, image.name, options.premultiply, options.trim);
+}
+
+static bool EncodeTexture(const Packer &packer, const Bitmap &bitmap, vector<uint8_t> &texture)
+{
+    switch (options.textureFormat)
+    {
+    case TextureFormat::Png:
+    {
+        if (options.pixelFormat == PixelFormat::Palette)
+            return EncodePalettePng(bitmap.data, bitmap.width, bitmap.height, options.dither, texture);
+        unsigned char *png;
+        size_t size;
+        if (lodepng_encode32(&png, &size, reinterpret_cast<const unsigned char *>(bitmap.data), bitmap.width,
+                             bitmap.height))
+            return false;
+        texture.assign(png, png + size);
+        free(png);
+        break;
+    }
+    case TextureFormat::Qoi:
+        QoiEncode(reinterpret_cast<const uint8_t *>(bitmap.data), bitmap.width, bitmap.height, texture);
+        break;
+    case TextureFormat::Dds:
+        texture = packer.GetTexture(bitmap, options.pixelFormat, options.premultiply, options.dither, options.mips,
+                                    options.mipFilter).EncodeDds();
+        break;
+    case TextureFormat::Ktx2:
+        texture = packer.GetTexture(bitmap, options.pixelFormat, options.premultiply, options.dither, options.mips,
+                                    options.mipFilter).EncodeKtx2();
+        break;
+    }
+    return true;
+}
+
+// Packs with the options of the calling thread, the bitmaps are freed before returning
+static void PackInMemory(const string &name, const vector<PackImage> &images, bool encodeTextures, PackResult &result)
+{
+    vector<Bitmap *> bitmaps(images.size());
+    vector<string> errors(images.size());
+    ParallelFor(static_cast<int>(images.size()), [&](int i)
+                { bitmaps[i] = LoadImage(images[i], errors[i]); });
+
+    vector<Packer *> packers;
+    for (auto &error : errors)
+        if (!error.empty())
+        {
+            result.error = error;
+            break;
+        }
+
+    if (result.error.empty() && PackBitmaps(bitmaps, name, packers, result.error))
+    {
+        bool noZero = options.noZero && packers.size() == 1;
+
+        result.pages.resize(packers.size());
+        // Not vector<bool>, its bits can't be set from several threads at once
+        vector<char> encoded(packers.size(), true);
+        ParallelFor(static_cast<int>(packers.size()), [&](int i)
+                    {
+            Packer &packer = *packers[i];
+            PackPage &page = result.pages[i];
+            page.name = name + (noZero ? "" : to_string(i));
+            page.width = packer.width;
+            page.height = packer.height;
+
+            Bitmap bitmap(packer.width, packer.height);
+            packer.Compose(bitmap);
+            if (encodeTextures)
+                encoded[i] = EncodeTexture(packer, bitmap, page.texture);
+            auto bytes = reinterpret_cast<const uint8_t *>(bitmap.data);
+            page.pixels.assign(bytes, bytes + sizeof(uint32_t) * bitmap.width * bitmap.height); });
+
+        for (int i = 0; i < packers.size(); ++i)
+            if (!encoded[i])
+            {
+                result.error = "failed to encode texture: " + result.pages[i].name;
+                break;
+            }
+
+        if (result.error.empty())
+        {
+            AtlasMetadata metadata;
+            FormatMetadata(packers, name, noZero, metadata, nullptr);
+            result.bin = move(metadata.bin);
+            result.xml = move(metadata.xml);
+            result.json = move(metadata.json);
+            result.success = true;
+        }
+    }
+
+    for (auto bitmap : bitmaps)
+        delete bitmap;
+    for (auto packer : packers)
+        delete packer;
+}
+
+PackResult PackImages(const string &name, const vector<PackImage> &images, const Options &packOptions,
+                      bool encodeTextures)
+{
+    // The pipeline reads the options of the current thread, so they are swapped in for the call
+    // and the log goes into the result instead of the standard output
+    Options previous = options;
+    options = packOptions;
+    options.splitSubdirectories = false;
+    options.stats.clear();
+    options.trace.clear();
+
+    PackResult result;
+    {
+        LogCapture capture;
+        PackInMemory(name, images, encodeTextures, result);
+        result.log = capture.stream.str();
+    }
+
+    options = previous;
+    if (!result.success)
+        result.pages.clear();
+    return result;
+}
@@ -0,0 +1,93 @@
+/*
+
+ Library interface of crunch (the crunch_lib target), packs an atlas in memory without touching the disk.
+
+ The images are given as RGBA8 pixels or as the bytes of .png and .qoi files, and the result holds the
+ pages and the .bin, .xml and .json files as buffers. Nothing is shared between calls except the thread
+ pool, so several atlases can be packed at the same time from different threads.
+
+ Usage:
+
+   Options options;
+   options.json = true;
+   options.trim = true;
+
+   vector<PackImage> images(2);
+   images[0].name = "player/idle0";
+   images[0].encoded = pngBytes;
+   images[0].encodedSize = pngSize;
+   images[1].name = "player/idle1";
+   images[1].pixels = rgba;
+   images[1].width = 32;
+   images[1].height = 32;
+
+   PackResult result = PackImages("atlas", images, options);
+   if (result.success)
+       upload(result.pages[0].texture, result.json);
+
+*/
+
+#ifndef crunch_hpp
+#define crunch_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+// An image to pack, either RGBA8 pixels (not premultiplied, rows without gaps) or the bytes of a .png or .qoi file.
+// The memory is only read during the call
+struct PackImage
+{
+    string name;
+
+    const uint8_t *pixels = nullptr;
+    int width = 0;
+    int height = 0;
+
+    const uint8_t *encoded = nullptr;
+    size_t encodedSize = 0;
+};
+
+struct PackPage
+{
+    // Name of the page in the metadata, the atlas name followed by the page index unless --nozero applies
+    string name;
+    int width = 0;
+    int height = 0;
+
+    // RGBA8 pixels of the page, premultiplied if the options say so
+    vector<uint8_t> pixels;
+
+    // The page as a .png, .qoi, .dds or .ktx2 file, depending on the texture format of the options
+    vector<uint8_t> texture;
+};
+
+struct PackResult
+{
+    bool success = false;
+    string error;
+
+    vector<PackPage> pages;
+
+    // The metadata files enabled by the options, the other buffers stay empty
+    Buffer bin;
+    Buffer xml;
+    Buffer json;
+
+    // What the packing printed, only filled with the verbose option
+    string log;
+};
+
+// Packs the images into an atlas with the given options, the options that only concern files on disk
+// (force, useTimeForHash, splitSubdirectories, watch, stats, trace) are ignored. Encoding the pages into texture files
+// can be skipped when only the pixels are needed. Safe to call from several threads at once
+PackResult PackImages(const string &name, const vector<PackImage> &images, const Options &options,
+                      bool encodeTextures = true);
+
+#endif
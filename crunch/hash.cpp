@@ -27,12 +27,16 @@
 #include "hash.hpp"
 
 #include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <vector>
 
+#include "buffer.hpp"
+#include "readahead.hpp"
+#include "trace.hpp"
+
 using namespace std;
 using namespace filesystem;
 
@@ -45,7 +49,7 @@ void HashData(uint64_t &hash, const char *data, uint64_t size)
 {
     uint64_t seed = 131;
     uint64_t v = 0;
-    for (int i = 0; i < size; ++i)
+    for (uint64_t i = 0; i < size; ++i)
     {
         v = v * seed + data[i];
     }
@@ -54,56 +58,121 @@ void HashData(uint64_t &hash, const char *data, uint64_t size)
     HashCombine(hash, v);
 }
 
-void HashString(uint64_t &hash, const string &str)
+static uint64_t RotateLeft(uint64_t v, int bits)
 {
-    HashData(hash, str.data(), str.size());
+    return (v << bits) | (v >> (64 - bits));
 }
 
-void HashFile(uint64_t &hash, const string &file, bool checkTime)
+static uint64_t Avalanche(uint64_t v)
 {
-    if (checkTime)
-    {
-        auto time = last_write_time(file);
-        HashCombine(hash, chrono::duration_cast<chrono::seconds>(time.time_since_epoch()).count());
-        return;
-    }
-    ifstream stream(file, ios::binary | ios::ate);
-    streamsize size = stream.tellg();
-    stream.seekg(0, ios::beg);
-    vector<char> buffer(size);
-    if (!stream.read(buffer.data(), size))
-    {
-        cerr << "failed to read file: " << file << endl;
-        exit(EXIT_FAILURE);
-    }
-    HashData(hash, buffer.data(), size);
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdull;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ull;
+    v ^= v >> 33;
+    return v;
 }
 
-static void HashFile(uint64_t &hash, const directory_entry &file, bool checkTime)
+uint64_t HashBytes(const uint8_t *data, size_t size, uint64_t seed)
 {
-    if (checkTime)
+    // Four independent lanes of 8 bytes each, the same rounds as xxHash64
+    const uint64_t prime1 = 0x9e3779b185ebca87ull, prime2 = 0xc2b2ae3d27d4eb4full;
+    uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
     {
-        auto time = file.last_write_time();
-        HashCombine(hash, chrono::duration_cast<chrono::seconds>(time.time_since_epoch()).count());
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t v;
+            memcpy(&v, data + i + lane * 8, 8);
+            lanes[lane] = RotateLeft(lanes[lane] + v * prime2, 31) * prime1;
+        }
     }
-    else
-        HashFile(hash, file.path().string(), false);
+
+    uint64_t hash = Avalanche(seed ^ size);
+    for (uint64_t lane : lanes)
+        hash = RotateLeft(hash ^ Avalanche(lane), 27) * prime1 + prime2;
+    for (; i < size; ++i)
+        hash = RotateLeft(hash ^ (data[i] * prime1), 11) * prime2;
+    return Avalanche(hash);
 }
 
-void HashFiles(uint64_t &hash, const string &root, bool checkTime)
+void HashString(uint64_t &hash, const string &str)
+{
+    HashData(hash, str.data(), str.size());
+}
+
+// An input file or a directory found while walking the inputs, in the order they're hashed
+struct HashItem
+{
+    string path;
+    bool directory;
+    file_time_type time;
+};
+
+static void ListFiles(const string &root, bool checkTime, vector<HashItem> &items)
 {
     for (const auto &entry : directory_iterator(root))
     {
         if (entry.is_directory())
         {
-            HashString(hash, entry.path().string());
-            HashFiles(hash, entry.path().string(), checkTime);
+            items.push_back({entry.path().string(), true, {}});
+            ListFiles(entry.path().string(), checkTime, items);
         }
         else
-            HashFile(hash, entry, checkTime);
+            items.push_back({entry.path().string(), false, checkTime ? entry.last_write_time() : file_time_type()});
     }
 }
 
+bool HashInputs(uint64_t &hash, const vector<string> &inputs, bool checkTime, string &error)
+{
+    vector<HashItem> items;
+    for (auto &input : inputs)
+        if (is_directory(input))
+            ListFiles(input, checkTime, items);
+        else
+            items.push_back({input, false, checkTime ? last_write_time(input) : file_time_type()});
+
+    if (checkTime)
+    {
+        for (auto &item : items)
+            if (item.directory)
+                HashString(hash, item.path);
+            else
+                HashCombine(hash, chrono::duration_cast<chrono::seconds>(item.time.time_since_epoch()).count());
+        return true;
+    }
+
+    // The directories are walked first, so all the files can be read ahead while the earlier ones are hashed
+    vector<string> files;
+    for (auto &item : items)
+        if (!item.directory)
+            files.push_back(item.path);
+    ReadAhead reads(files);
+
+    int index = 0;
+    for (auto &item : items)
+    {
+        if (item.directory)
+        {
+            HashString(hash, item.path);
+            continue;
+        }
+
+        TraceSpan span("HashFile", item.path);
+        const uint8_t *data;
+        size_t size;
+        if (!reads.Wait(index, data, size))
+        {
+            error = "failed to read file: " + item.path;
+            return false;
+        }
+        HashData(hash, reinterpret_cast<const char *>(data), size);
+        reads.Release(index++);
+    }
+    return true;
+}
+
 bool LoadHash(uint64_t &hash, const string &file)
 {
     ifstream stream(file);
@@ -116,6 +185,6 @@ bool LoadHash(uint64_t &hash, const string &file)
 
 void SaveHash(uint64_t hash, const string &file)
 {
-    ofstream stream(file);
-    stream << hash << endl;
+    string text = to_string(hash) + '\n';
+    SaveFile(file, text.data(), text.size());
 }
@@ -29,12 +29,17 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 void HashCombine(uint64_t &hash, uint64_t v);
 void HashString(uint64_t &hash, const std::string &str);
-void HashFile(uint64_t &hash, const std::string &file, bool checkTime);
-void HashFiles(uint64_t &hash, const std::string &root, bool checkTime);
+// Hashes the input files and the files in the input directories, or only their times with checkTime.
+// Returns false with the error if a file can't be read
+bool HashInputs(uint64_t &hash, const std::vector<std::string> &inputs, bool checkTime, std::string &error);
 void HashData(uint64_t &hash, const char *data, uint64_t size);
+// 64-bit hash of the bytes that is fast and spread well enough to name files by their contents,
+// different seeds give independent hashes
+uint64_t HashBytes(const uint8_t *data, size_t size, uint64_t seed);
 bool LoadHash(uint64_t &hash, const std::string &file);
 void SaveHash(uint64_t hash, const std::string &file);
 
@@ -0,0 +1,23 @@
+#include "log.hpp"
+
+#include <iostream>
+
+using namespace std;
+
+static thread_local ostream *currentOut = nullptr;
+
+ostream &Out()
+{
+    return currentOut ? *currentOut : cout;
+}
+
+LogCapture::LogCapture()
+    : previous(currentOut)
+{
+    currentOut = &stream;
+}
+
+LogCapture::~LogCapture()
+{
+    currentOut = previous;
+}
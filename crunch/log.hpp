@@ -0,0 +1,26 @@
+#ifndef log_hpp
+#define log_hpp
+
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+
+// Standard output of the current thread, this is cout unless a LogCapture is active on the thread
+ostream &Out();
+
+// Collects everything written to Out() on this thread, so parallel jobs can print their logs in order
+struct LogCapture
+{
+    ostringstream stream;
+
+    LogCapture();
+    ~LogCapture();
+    LogCapture(const LogCapture &) = delete;
+    LogCapture &operator=(const LogCapture &) = delete;
+
+private:
+    ostream *previous;
+};
+
+#endif
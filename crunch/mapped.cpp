@@ -0,0 +1,86 @@
+#include "mapped.hpp"
+
+#include <cstdio>
+#include <filesystem>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "options.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Maps the whole file, returns nullptr if that isn't possible
+static void *MapFile(const string &file, size_t size, bool prefetch)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(file.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return nullptr;
+    HANDLE section = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (!section)
+        return nullptr;
+    void *mapping = MapViewOfFile(section, FILE_MAP_READ, 0, 0, size);
+    CloseHandle(section);
+    return mapping;
+#else
+    int handle = open(file.data(), O_RDONLY | O_CLOEXEC);
+    if (handle < 0)
+        return nullptr;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, handle, 0);
+    close(handle);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    if (prefetch)
+        madvise(mapping, size, MADV_WILLNEED);
+    return mapping;
+#endif
+}
+
+MappedFile::MappedFile(const string &file, bool prefetch)
+{
+    error_code error;
+    size = static_cast<size_t>(fs::file_size(file, error));
+    if (error)
+    {
+        size = 0;
+        return;
+    }
+
+    if (size >= mapThreshold && !options.watch)
+        mapping = MapFile(file, size, prefetch);
+    if (mapping)
+    {
+        data = static_cast<const uint8_t *>(mapping);
+        loaded = true;
+        return;
+    }
+
+    FILE *stream = fopen(file.data(), "rb");
+    if (!stream)
+        return;
+    buffer.reset(new uint8_t[size]);
+    loaded = fread(buffer.get(), 1, size, stream) == size;
+    fclose(stream);
+    data = buffer.get();
+}
+
+MappedFile::~MappedFile()
+{
+    if (!mapping)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
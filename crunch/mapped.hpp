@@ -0,0 +1,37 @@
+#ifndef mapped_hpp
+#define mapped_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+// Files from this size on are mapped instead of read, for smaller ones the mapping costs more than the copy
+const size_t mapThreshold = 64 << 10;
+
+// The contents of a whole file, mapped read-only so the decoders and the hasher read the page cache
+// without a copy on the heap. Files below mapThreshold, and files that can't be mapped, are read into
+// memory instead. The mapping is dropped when this is destroyed.
+// Reading a mapped page past the end of a file that was truncated meanwhile raises SIGBUS, so with --watch,
+// where the inputs are read while an editor may still be saving them, files are always read instead
+// and a file that's cut short only fails to load
+struct MappedFile
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    bool loaded = false;
+
+    // The pages are read in order, with prefetch the kernel also starts reading them in the background
+    explicit MappedFile(const string &file, bool prefetch = false);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+private:
+    void *mapping = nullptr;
+    unique_ptr<uint8_t[]> buffer;
+};
+
+#endif
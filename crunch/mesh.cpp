@@ -0,0 +1,468 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+
+using namespace std;
+
+// How far around the corner of a grown polygon a pixel corner is looked for, in pixels
+const int cornerSearch = 3;
+
+// The polygons are built in the space of the lines they were scanned in (rows, or columns with x and y
+// swapped), turning clockwise on screen, so Cross is positive at convex vertices and negative at reflex ones
+static int64_t Cross(const MeshVertex &o, const MeshVertex &a, const MeshVertex &b)
+{
+    return static_cast<int64_t>(a.x - o.x) * (b.y - o.y) - static_cast<int64_t>(a.y - o.y) * (b.x - o.x);
+}
+
+static int64_t Cross(int64_t ax, int64_t ay, int64_t bx, int64_t by)
+{
+    return ax * by - ay * bx;
+}
+
+static bool Same(const MeshVertex &a, const MeshVertex &b)
+{
+    return a.x == b.x && a.y == b.y;
+}
+
+// Twice the area of the polygon
+static int64_t Area2(const vector<MeshVertex> &polygon)
+{
+    int64_t area = 0;
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+        area += static_cast<int64_t>(polygon[j].x) * polygon[i].y - static_cast<int64_t>(polygon[i].x) * polygon[j].y;
+    return area;
+}
+
+// The opaque pixels of every line as [start, end), lines without any take the range of the line before.
+// Returns false if the image is completely transparent
+struct LineRanges
+{
+    int length;
+    int lines;
+    int first;
+    int last;
+    vector<int> start;
+    vector<int> end;
+};
+
+static bool FindLineRanges(const uint32_t *pixels, int width, int height, bool columns, LineRanges &ranges)
+{
+    ranges.length = columns ? height : width;
+    ranges.lines = columns ? width : height;
+    ranges.first = -1;
+    ranges.last = -1;
+    ranges.start.assign(ranges.lines, 0);
+    ranges.end.assign(ranges.lines, 0);
+
+    size_t step = columns ? width : 1, lineStep = columns ? 1 : width;
+    for (int line = 0; line < ranges.lines; ++line)
+    {
+        const uint32_t *p = pixels + line * lineStep;
+        int start = 0, end = ranges.length;
+        while (start < end && (p[start * step] >> 24) == 0)
+            ++start;
+        while (end > start && (p[(end - 1) * step] >> 24) == 0)
+            --end;
+
+        if (start == end)
+        {
+            if (ranges.first >= 0)
+            {
+                ranges.start[line] = ranges.start[line - 1];
+                ranges.end[line] = ranges.end[line - 1];
+            }
+            continue;
+        }
+        if (ranges.first < 0)
+            ranges.first = line;
+        ranges.last = line;
+        ranges.start[line] = start;
+        ranges.end[line] = end;
+    }
+    return ranges.first >= 0;
+}
+
+// Drops repeated vertices and the ones in the middle of a straight edge
+static void Clean(vector<MeshVertex> &polygon)
+{
+    vector<MeshVertex> kept;
+    kept.reserve(polygon.size());
+    for (auto &v : polygon)
+    {
+        if (!kept.empty() && Same(kept.back(), v))
+            continue;
+        while (kept.size() >= 2 && Cross(kept[kept.size() - 2], kept.back(), v) == 0)
+            kept.pop_back();
+        kept.push_back(v);
+    }
+    while (kept.size() >= 3 && Cross(kept[kept.size() - 2], kept.back(), kept[0]) == 0)
+        kept.pop_back();
+    while (kept.size() >= 3 && Cross(kept.back(), kept[0], kept[1]) == 0)
+        kept.erase(kept.begin());
+    polygon = move(kept);
+}
+
+// The outline of the line ranges, it has a step wherever a line starts or ends somewhere else
+static vector<MeshVertex> Outline(const LineRanges &ranges)
+{
+    vector<MeshVertex> outline;
+    for (int y = ranges.first; y <= ranges.last; ++y)
+    {
+        outline.push_back({ranges.end[y], y});
+        outline.push_back({ranges.end[y], y + 1});
+    }
+    for (int y = ranges.last; y >= ranges.first; --y)
+    {
+        outline.push_back({ranges.start[y], y + 1});
+        outline.push_back({ranges.start[y], y});
+    }
+    Clean(outline);
+    return outline;
+}
+
+static vector<MeshVertex> ConvexHull(vector<MeshVertex> points)
+{
+    sort(points.begin(), points.end(), [](const MeshVertex &a, const MeshVertex &b)
+         { return a.x != b.x ? a.x < b.x : a.y < b.y; });
+    vector<MeshVertex> hull(points.size() * 2);
+    size_t k = 0;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        while (k >= 2 && Cross(hull[k - 2], hull[k - 1], points[i]) <= 0)
+            --k;
+        hull[k++] = points[i];
+    }
+    for (size_t i = points.size() - 1, lower = k + 1; i-- > 0;)
+    {
+        while (k >= lower && Cross(hull[k - 2], hull[k - 1], points[i]) <= 0)
+            --k;
+        hull[k++] = points[i];
+    }
+    hull.resize(k - 1);
+    return hull;
+}
+
+// Grows the polygon until it has at most maxVertices vertices, always taking the step that adds the least
+// area: dropping a reflex vertex, or replacing an edge by a corner where the edges before and after it meet.
+// The corner is moved out to the nearest pixel corner that keeps the old edges inside. Every step keeps the
+// polygon monotone in y and inside the lines, so it stays simple and still covers the pixels
+static bool Simplify(vector<MeshVertex> &polygon, int maxVertices, int length, int lines)
+{
+    int count = static_cast<int>(polygon.size());
+    if (count <= maxVertices)
+        return true;
+
+    vector<MeshVertex> v = polygon;
+    vector<int> prev(count), next(count), version(count, 0);
+    vector<bool> alive(count, true);
+    for (int i = 0; i < count; ++i)
+    {
+        prev[i] = (i + count - 1) % count;
+        next[i] = (i + 1) % count;
+    }
+
+    struct Candidate
+    {
+        int64_t cost;
+        int vertex;
+        int version;
+        bool collapse;
+        MeshVertex corner;
+    };
+    auto later = [](const Candidate &a, const Candidate &b)
+    {
+        return tie(a.cost, a.vertex, a.collapse) > tie(b.cost, b.vertex, b.collapse);
+    };
+    priority_queue<Candidate, vector<Candidate>, decltype(later)> queue(later);
+
+    auto evaluate = [&](int i)
+    {
+        int a = prev[i], n = next[i], b = next[n];
+        const MeshVertex &va = v[a], &vi = v[i], &vn = v[n], &vb = v[b];
+
+        // Dropping a reflex vertex adds the triangle it cuts out
+        int64_t turn = Cross(va, vi, vn);
+        if (turn <= 0)
+            queue.push({-turn, i, version[i], false, vi});
+
+        // The lines of the edges a-i and b-n meet beyond i and n at a + s (i - a) = b + t (n - b)
+        int64_t d1x = vi.x - va.x, d1y = vi.y - va.y, d2x = vn.x - vb.x, d2y = vn.y - vb.y;
+        int64_t den = Cross(d1x, d1y, d2x, d2y);
+        if (den == 0)
+            return;
+        int64_t bax = vb.x - va.x, bay = vb.y - va.y;
+        int64_t sNum = Cross(bax, bay, d2x, d2y), tNum = Cross(bax, bay, d1x, d1y);
+        auto atLeast = [den](int64_t num, int64_t value)
+        {
+            return den > 0 ? num >= value * den : num <= value * den;
+        };
+        if (!atLeast(sNum, 1) || !atLeast(tNum, 1))
+            return;
+
+        double s = static_cast<double>(sNum) / den;
+        double px = va.x + s * d1x, py = va.y + s * d1y;
+        int64_t oldArea = Cross(va, vi, vn) + Cross(va, vn, vb);
+        int minY = min(va.y, vb.y), maxY = max(va.y, vb.y);
+
+        // The corner may be any point of the wedge beyond the meeting point between the two lines
+        bool found = false;
+        Candidate best{0, i, version[i], true, vi};
+        int x0 = static_cast<int>(px) - cornerSearch, y0 = static_cast<int>(py) - cornerSearch;
+        for (int y = max(y0, max(minY, 0)); y <= min(y0 + cornerSearch * 2 + 1, min(maxY, lines)); ++y)
+            for (int x = max(x0, 0); x <= min(x0 + cornerSearch * 2 + 1, length); ++x)
+            {
+                MeshVertex q{x, y};
+                if (Same(q, va) || Same(q, vb) || Cross(vi, vn, q) > 0)
+                    continue;
+                int64_t u = Cross(q.x - vb.x, q.y - vb.y, d2x, d2y), w = Cross(d1x, d1y, q.x - va.x, q.y - va.y);
+                if (!atLeast(u, 0) || !atLeast(w, 0))
+                    continue;
+                int64_t cost = Cross(va, q, vb) - oldArea;
+                if (cost >= 0 && (!found || cost < best.cost))
+                {
+                    best.cost = cost;
+                    best.corner = q;
+                    found = true;
+                }
+            }
+        if (found)
+            queue.push(best);
+    };
+
+    auto refresh = [&](int i)
+    {
+        ++version[i];
+        evaluate(i);
+    };
+
+    for (int i = 0; i < count; ++i)
+        evaluate(i);
+
+    int remaining = count;
+    while (remaining > maxVertices && !queue.empty())
+    {
+        Candidate candidate = queue.top();
+        queue.pop();
+        int i = candidate.vertex;
+        if (!alive[i] || version[i] != candidate.version)
+            continue;
+
+        if (candidate.collapse)
+        {
+            int n = next[i], b = next[n];
+            v[i] = candidate.corner;
+            alive[n] = false;
+            next[i] = b;
+            prev[b] = i;
+            int p = prev[i];
+            for (int j : {prev[p], p, i, b, next[b]})
+                refresh(j);
+        }
+        else
+        {
+            int a = prev[i], b = next[i];
+            alive[i] = false;
+            next[a] = b;
+            prev[b] = a;
+            for (int j : {prev[prev[a]], prev[a], a, b, next[b]})
+                refresh(j);
+        }
+        --remaining;
+    }
+
+    int i = 0;
+    while (!alive[i])
+        ++i;
+    polygon.clear();
+    for (int j = i;;)
+    {
+        polygon.push_back(v[j]);
+        j = next[j];
+        if (j == i)
+            break;
+    }
+    Clean(polygon);
+    return static_cast<int>(polygon.size()) <= maxVertices;
+}
+
+// Checks that no two edges touch except neighbours at their shared vertex
+static bool IsSimple(const vector<MeshVertex> &polygon)
+{
+    size_t n = polygon.size();
+    if (n < 3 || Area2(polygon) <= 0)
+        return false;
+
+    auto onSegment = [](const MeshVertex &p, const MeshVertex &a, const MeshVertex &b)
+    {
+        return min(a.x, b.x) <= p.x && p.x <= max(a.x, b.x) && min(a.y, b.y) <= p.y && p.y <= max(a.y, b.y);
+    };
+    auto sign = [](int64_t value)
+    {
+        return (value > 0) - (value < 0);
+    };
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = i + 1; j < n; ++j)
+        {
+            const MeshVertex &a = polygon[i], &b = polygon[(i + 1) % n], &c = polygon[j], &d = polygon[(j + 1) % n];
+            bool adjacent = j == i + 1 || (i == 0 && j == n - 1);
+            int d1 = sign(Cross(c, d, a)), d2 = sign(Cross(c, d, b)), d3 = sign(Cross(a, b, c)), d4 = sign(Cross(a, b, d));
+            if (adjacent)
+            {
+                // Neighbours may only share their vertex, not fold back over each other
+                const MeshVertex &shared = j == i + 1 ? b : a, &other1 = j == i + 1 ? a : b, &other2 = j == i + 1 ? d : c;
+                if (Cross(other1, shared, other2) == 0 &&
+                    static_cast<int64_t>(other1.x - shared.x) * (other2.x - shared.x) + static_cast<int64_t>(other1.y - shared.y) * (other2.y - shared.y) > 0)
+                    return false;
+                continue;
+            }
+            if (d1 * d2 < 0 && d3 * d4 < 0)
+                return false;
+            if ((d1 == 0 && onSegment(a, c, d)) || (d2 == 0 && onSegment(b, c, d)) ||
+                (d3 == 0 && onSegment(c, a, b)) || (d4 == 0 && onSegment(d, a, b)))
+                return false;
+        }
+    return true;
+}
+
+// Checks that the polygon covers the pixels of every line. Between two lines the polygon has no vertices,
+// so the two edges that cross the band are straight and only need to be outside the range at both ends
+static bool Covers(const vector<MeshVertex> &polygon, const LineRanges &ranges)
+{
+    size_t n = polygon.size();
+    for (int y = ranges.first; y <= ranges.last; ++y)
+    {
+        int crossing = 0, left = 0, right = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            MeshVertex p = polygon[i], q = polygon[(i + 1) % n];
+            if (p.y > q.y)
+                swap(p, q);
+            if (p.y > y || q.y < y + 1)
+                continue;
+            ++crossing;
+
+            // The edge has to pass the start of the range on its left, or the end on its right, at the top
+            // and at the bottom of the band
+            bool isLeft = true, isRight = true;
+            for (int c : {y, y + 1})
+            {
+                int64_t dy = q.y - p.y, edge = static_cast<int64_t>(p.x) * dy + static_cast<int64_t>(c - p.y) * (q.x - p.x);
+                isLeft = isLeft && edge <= static_cast<int64_t>(ranges.start[y]) * dy;
+                isRight = isRight && edge >= static_cast<int64_t>(ranges.end[y]) * dy;
+            }
+            left += isLeft;
+            right += isRight;
+        }
+        if (crossing != 2 || left != 1 || right != 1)
+            return false;
+    }
+    return true;
+}
+
+static bool InTriangle(const MeshVertex &p, const MeshVertex &a, const MeshVertex &b, const MeshVertex &c)
+{
+    return Cross(a, b, p) >= 0 && Cross(b, c, p) >= 0 && Cross(c, a, p) >= 0;
+}
+
+// Ear clipping, the polygons are small enough for its quadratic cost
+static vector<uint16_t> Triangulate(const vector<MeshVertex> &polygon)
+{
+    vector<uint16_t> indices;
+    vector<int> remaining(polygon.size());
+    for (size_t i = 0; i < polygon.size(); ++i)
+        remaining[i] = static_cast<int>(i);
+
+    while (remaining.size() > 3)
+    {
+        size_t m = remaining.size();
+        bool clipped = false;
+        for (size_t k = 0; k < m && !clipped; ++k)
+        {
+            int a = remaining[(k + m - 1) % m], b = remaining[k], c = remaining[(k + 1) % m];
+            int64_t turn = Cross(polygon[a], polygon[b], polygon[c]);
+            if (turn < 0)
+                continue;
+            bool ear = true;
+            for (size_t r = 0; r < m && ear && turn > 0; ++r)
+            {
+                int other = remaining[r];
+                if (other != a && other != b && other != c && InTriangle(polygon[other], polygon[a], polygon[b], polygon[c]))
+                    ear = false;
+            }
+            if (!ear)
+                continue;
+            if (turn > 0)
+                indices.insert(indices.end(), {static_cast<uint16_t>(a), static_cast<uint16_t>(b), static_cast<uint16_t>(c)});
+            remaining.erase(remaining.begin() + k);
+            clipped = true;
+        }
+        if (!clipped)
+            return {};
+    }
+    if (Cross(polygon[remaining[0]], polygon[remaining[1]], polygon[remaining[2]]) > 0)
+        indices.insert(indices.end(), {static_cast<uint16_t>(remaining[0]), static_cast<uint16_t>(remaining[1]), static_cast<uint16_t>(remaining[2])});
+    return indices;
+}
+
+// Builds the outline of the lines, grows it to the budget and checks the result
+static bool BuildPolygon(const LineRanges &ranges, bool convex, int maxVertices, vector<MeshVertex> &polygon)
+{
+    polygon = Outline(ranges);
+    if (convex)
+        polygon = ConvexHull(polygon);
+    return Simplify(polygon, maxVertices, ranges.length, ranges.lines) && IsSimple(polygon) && Covers(polygon, ranges);
+}
+
+Mesh BuildMesh(const uint32_t *pixels, int width, int height, MeshHull hull, int maxVertices)
+{
+    Mesh mesh;
+    LineRanges rows;
+    if (!FindLineRanges(pixels, width, height, false, rows))
+    {
+        mesh.vertices = {{0, 0}, {width, 0}, {width, height}, {0, height}};
+        mesh.indices = {0, 1, 2, 0, 2, 3};
+        return mesh;
+    }
+
+    vector<MeshVertex> polygon, candidate;
+    bool found = BuildPolygon(rows, hull == MeshHull::Convex, maxVertices, polygon);
+
+    // Concave outlines of rows can't follow notches from above or below, the ones of columns can
+    if (hull == MeshHull::Concave)
+    {
+        LineRanges columns;
+        FindLineRanges(pixels, width, height, true, columns);
+        if (BuildPolygon(columns, false, maxVertices, candidate))
+        {
+            // Back to x and y, which turns the polygon the other way
+            for (auto &vertex : candidate)
+                swap(vertex.x, vertex.y);
+            reverse(candidate.begin(), candidate.end());
+            if (!found || Area2(candidate) < Area2(polygon))
+                polygon = move(candidate);
+            found = true;
+        }
+        if (!found)
+            found = BuildPolygon(rows, true, maxVertices, polygon);
+    }
+
+    if (found)
+        mesh.indices = Triangulate(polygon);
+
+    // The bounds of the opaque pixels are always a valid outline
+    if (!found || mesh.indices.empty())
+    {
+        int left = width, right = 0;
+        for (int y = rows.first; y <= rows.last; ++y)
+        {
+            left = min(left, rows.start[y]);
+            right = max(right, rows.end[y]);
+        }
+        polygon = {{left, rows.first}, {right, rows.first}, {right, rows.last + 1}, {left, rows.last + 1}};
+        mesh.indices = {0, 1, 2, 0, 2, 3};
+    }
+    mesh.vertices = move(polygon);
+    return mesh;
+}
@@ -0,0 +1,31 @@
+#ifndef mesh_hpp
+#define mesh_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "options.hpp"
+
+using namespace std;
+
+struct MeshVertex
+{
+    int x;
+    int y;
+};
+
+// Polygon around the opaque pixels of an image, in pixels of the image as it's stored in the atlas before
+// rotation (so trimmed if trimming is on), and its triangles as a list of three indices each
+struct Mesh
+{
+    vector<MeshVertex> vertices;
+    vector<uint16_t> indices;
+};
+
+// Outlines the pixels that aren't fully transparent with at most maxVertices vertices (at least 4). The
+// polygon covers every one of them and stays inside the image, vertices are on pixel corners. A concave
+// hull follows the outline in rows or columns, whichever gives the smaller area, and is then grown where
+// that costs the least area until it's within the budget
+Mesh BuildMesh(const uint32_t *pixels, int width, int height, MeshHull hull, int maxVertices);
+
+#endif
@@ -0,0 +1,86 @@
+#include "metadata.hpp"
+
+#include <cstdint>
+#include <iostream>
+
+#include "binary.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+void WriteBinHeader(Buffer &bin)
+{
+    bin << "crch";
+    bool mesh = options.mesh != MeshHull::None;
+    if (options.binaryVersion == 2)
+        WriteShort(bin, mesh ? binWideMeshVersion : binWideVersion);
+    else
+        WriteShort(bin, mesh ? binMeshVersion : binVersion);
+    WriteByte(bin, options.trim);
+    WriteByte(bin, options.rotate);
+    WriteByte(bin, (char)options.binaryStringFormat);
+}
+
+void WriteBinNumber(Buffer &bin, int value)
+{
+    if (options.binaryVersion == 2)
+        WriteInt(bin, value);
+    else if (value >= INT16_MIN && value <= INT16_MAX)
+        WriteShort(bin, static_cast<int16_t>(value));
+    else
+    {
+        cerr << "number too large for the version 0 binary format: " << value << ", use --binver 2" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+size_t BinNumberSize()
+{
+    return options.binaryVersion == 2 ? 4 : 2;
+}
+
+int ReadBinNumber(const char *bytes)
+{
+    auto b = reinterpret_cast<const uint8_t *>(bytes);
+    if (options.binaryVersion == 2)
+        return static_cast<int32_t>(b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24));
+    return static_cast<int16_t>(b[0] | (b[1] << 8));
+}
+
+void WriteXmlHeader(Buffer &xml)
+{
+    xml << "<atlas>\n";
+    xml << "\t<trim>" << (options.trim ? "true" : "false") << "</trim>\n";
+    xml << "\t<rotate>" << (options.rotate ? "true" : "false") << "</rotate>\n";
+    if (options.mesh != MeshHull::None)
+        xml << "\t<mesh>true</mesh>\n";
+}
+
+void WriteXmlFooter(Buffer &xml)
+{
+    xml << "</atlas>\n";
+}
+
+void WriteJsonHeader(Buffer &json)
+{
+    json << "{\n";
+    json << "\t\"trim\": " << (options.trim ? "true" : "false") << ",\n";
+    json << "\t\"rotate\": " << (options.rotate ? "true" : "false") << ",\n";
+    if (options.mesh != MeshHull::None)
+        json << "\t\"mesh\": true,\n";
+    json << "\t\"textures\": {\n";
+}
+
+void WriteJsonFooter(Buffer &json)
+{
+    json << "\n\t}\n}\n";
+}
+
+void SaveBuffer(const Buffer &buffer, const string &file)
+{
+    if (!buffer.Save(file))
+    {
+        cerr << "failed to save file: " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+}
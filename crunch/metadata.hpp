@@ -0,0 +1,38 @@
+#ifndef metadata_hpp
+#define metadata_hpp
+
+#include <string>
+
+#include "buffer.hpp"
+
+using namespace std;
+
+const int binVersion = 0;
+
+// Version of a version 0 .bin that has a mesh after every image (--mesh)
+const int binMeshVersion = 2;
+
+// Versions of a .bin with int32 numbers instead of int16 (--binver 2), without and with meshes
+const int binWideVersion = 4;
+const int binWideMeshVersion = 5;
+
+// Offset of the texture count in a version 0 .bin
+const size_t binTextureCountOffset = 9;
+
+// Writes a number of the sequential .bin, an int16 or with --binver 2 an int32. Fails if it doesn't fit
+void WriteBinNumber(Buffer &bin, int value);
+// Bytes of a number in the sequential .bin
+size_t BinNumberSize();
+// Reads a number written by WriteBinNumber
+int ReadBinNumber(const char *bytes);
+
+// Headers and footers around the texture sections of the .bin, .xml and .json files
+void WriteBinHeader(Buffer &bin);
+void WriteXmlHeader(Buffer &xml);
+void WriteXmlFooter(Buffer &xml);
+void WriteJsonHeader(Buffer &json);
+void WriteJsonFooter(Buffer &json);
+
+void SaveBuffer(const Buffer &buffer, const string &file);
+
+#endif
@@ -0,0 +1,288 @@
+#include "mips.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "bitmap.hpp"
+#include "parallel.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CRUNCH_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Rows of a level that are filtered as one piece of work when a page isn't split into cells
+const int mipBandRows = 16;
+
+// Taps of the Kaiser filter, the source pixels 2x - 2 to 2x + 3 of destination pixel x
+const int kaiserTaps = 6;
+
+// The weights add up to 1 << kaiserBits
+const int kaiserBits = 12;
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window
+static double BesselI0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; ++k)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Sinc windowed by a Kaiser window 3 destination pixels wide (alpha 4), in fixed point. Rounding is moved
+// to the middle taps, so the weights still add up to one
+static const array<int16_t, kaiserTaps> &KaiserWeights()
+{
+    static const array<int16_t, kaiserTaps> weights = []()
+    {
+        const double pi = 3.14159265358979323846, halfWidth = 1.5, alpha = 4;
+        array<double, kaiserTaps> w;
+        double total = 0;
+        for (int t = 0; t < kaiserTaps; ++t)
+        {
+            double d = (t - 2.5) / 2;
+            double sinc = sin(pi * d) / (pi * d);
+            double window = BesselI0(alpha * sqrt(1 - (d / halfWidth) * (d / halfWidth))) / BesselI0(alpha);
+            w[t] = sinc * window;
+            total += w[t];
+        }
+
+        array<int16_t, kaiserTaps> fixed;
+        int sum = 0;
+        for (int t = 0; t < kaiserTaps; ++t)
+        {
+            fixed[t] = static_cast<int16_t>(lround(w[t] / total * (1 << kaiserBits)));
+            sum += fixed[t];
+        }
+        fixed[2] += static_cast<int16_t>(((1 << kaiserBits) - sum) / 2);
+        fixed[3] += static_cast<int16_t>((1 << kaiserBits) - sum - ((1 << kaiserBits) - sum) / 2);
+        return fixed;
+    }();
+    return weights;
+}
+
+static inline uint32_t Channel(uint32_t pixel, int shift)
+{
+    return (pixel >> shift) & 0xff;
+}
+
+// Average of four pixels, channel by channel
+static inline uint32_t Average(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        result |= ((Channel(a, shift) + Channel(b, shift) + Channel(c, shift) + Channel(d, shift) + 2) >> 2) << shift;
+    return result;
+}
+
+// Halves the rows [y0, y1) of the next level with a 2x2 box. A side of 1 pixel stays 1, the pixels of an
+// odd side are clamped
+static void DownsampleBox(const uint32_t *src, int width, int height, uint32_t *dst, int y0, int y1)
+{
+    int dstWidth = max(1, width / 2);
+    for (int y = y0; y < y1; ++y)
+    {
+        const uint32_t *row0 = src + static_cast<size_t>(min(2 * y, height - 1)) * width;
+        const uint32_t *row1 = src + static_cast<size_t>(min(2 * y + 1, height - 1)) * width;
+        uint32_t *out = dst + static_cast<size_t>(y) * dstWidth;
+        int x = 0;
+
+#ifdef CRUNCH_SSE2
+        // Four destination pixels from 2 rows of 8 source pixels
+        if (width % 2 == 0)
+        {
+            const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+            for (; x + 4 <= dstWidth; x += 4)
+            {
+                __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2 * x));
+                __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2 * x + 4));
+                __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x));
+                __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x + 4));
+
+                // Columns added up row by row, then neighbouring pixels added up
+                __m128i lo0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+                __m128i hi0 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+                __m128i lo1 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+                __m128i hi1 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+                __m128i sum0 = _mm_add_epi16(_mm_unpacklo_epi64(lo0, hi0), _mm_unpackhi_epi64(lo0, hi0));
+                __m128i sum1 = _mm_add_epi16(_mm_unpacklo_epi64(lo1, hi1), _mm_unpackhi_epi64(lo1, hi1));
+                sum0 = _mm_srli_epi16(_mm_add_epi16(sum0, two), 2);
+                sum1 = _mm_srli_epi16(_mm_add_epi16(sum1, two), 2);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(sum0, sum1));
+            }
+        }
+#endif
+
+        for (; x < dstWidth; ++x)
+        {
+            int left = min(2 * x, width - 1), right = min(2 * x + 1, width - 1);
+            out[x] = Average(row0[left], row0[right], row1[left], row1[right]);
+        }
+    }
+}
+
+// Halves the rows [y0, y1) of a cell of the next level with the Kaiser filter, clamping the taps to the
+// cell. Rows first into 16-bit sums with 4 bits of fraction, then the columns of those
+static void DownsampleKaiser(const uint32_t *src, int width, int height, uint32_t *dst, const MipCell &cell, int y0, int y1)
+{
+    auto &weights = KaiserWeights();
+    int dstWidth = max(1, width / 2), dstHeight = max(1, height / 2);
+    int x0 = cell.x / 2, x1 = min(dstWidth, max(x0 + 1, (cell.x + cell.width) / 2));
+    int top = cell.y, bottom = min(height, cell.y + cell.height) - 1;
+    int left = cell.x, right = min(width, cell.x + cell.width) - 1;
+    y1 = min(y1, dstHeight);
+
+    // The source rows the destination rows need, filtered horizontally
+    int rowFirst = max(top, 2 * y0 - 2), rowLast = min(bottom, 2 * (y1 - 1) + 3);
+    int columns = x1 - x0;
+    vector<int16_t> rows(static_cast<size_t>(rowLast - rowFirst + 1) * columns * 4);
+    for (int sy = rowFirst; sy <= rowLast; ++sy)
+    {
+        auto in = reinterpret_cast<const uint8_t *>(src + static_cast<size_t>(sy) * width);
+        int16_t *out = rows.data() + static_cast<size_t>(sy - rowFirst) * columns * 4;
+        for (int x = x0; x < x1; ++x, out += 4)
+        {
+            int taps[kaiserTaps];
+            for (int t = 0; t < kaiserTaps; ++t)
+                taps[t] = min(right, max(left, 2 * x - 2 + t)) * 4;
+
+#ifdef CRUNCH_SSE2
+            // The channels of two taps interleaved, so one multiply-add weighs both
+            const __m128i zero = _mm_setzero_si128();
+            __m128i sum = _mm_setzero_si128();
+            for (int t = 0; t < kaiserTaps; t += 2)
+            {
+                int32_t a, b;
+                memcpy(&a, in + taps[t], 4);
+                memcpy(&b, in + taps[t + 1], 4);
+                __m128i pair = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b)), zero);
+                __m128i weight = _mm_set1_epi32(static_cast<uint16_t>(weights[t]) | (static_cast<uint32_t>(static_cast<uint16_t>(weights[t + 1])) << 16));
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, weight));
+            }
+            sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (kaiserBits - 5))), kaiserBits - 4);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packs_epi32(sum, sum));
+#else
+            int32_t sums[4] = {};
+            for (int t = 0; t < kaiserTaps; ++t)
+                for (int c = 0; c < 4; ++c)
+                    sums[c] += in[taps[t] + c] * weights[t];
+            for (int c = 0; c < 4; ++c)
+                out[c] = static_cast<int16_t>((sums[c] + (1 << (kaiserBits - 5))) >> (kaiserBits - 4));
+#endif
+        }
+    }
+
+    for (int y = y0; y < y1; ++y)
+    {
+        const int16_t *taps[kaiserTaps];
+        for (int t = 0; t < kaiserTaps; ++t)
+            taps[t] = rows.data() + static_cast<size_t>(min(bottom, max(top, 2 * y - 2 + t)) - rowFirst) * columns * 4;
+
+        auto out = reinterpret_cast<uint8_t *>(dst + static_cast<size_t>(y) * dstWidth + x0);
+        for (int i = 0; i < columns; ++i, out += 4)
+        {
+            int32_t sums[4];
+#ifdef CRUNCH_SSE2
+            __m128i sum = _mm_setzero_si128();
+            for (int t = 0; t < kaiserTaps; t += 2)
+            {
+                __m128i a = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(taps[t] + i * 4));
+                __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(taps[t + 1] + i * 4));
+                __m128i weight = _mm_set1_epi32(static_cast<uint16_t>(weights[t]) | (static_cast<uint32_t>(static_cast<uint16_t>(weights[t + 1])) << 16));
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weight));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), sum);
+#else
+            sums[0] = sums[1] = sums[2] = sums[3] = 0;
+            for (int t = 0; t < kaiserTaps; ++t)
+                for (int c = 0; c < 4; ++c)
+                    sums[c] += taps[t][i * 4 + c] * weights[t];
+#endif
+
+            // The negative lobes can overshoot, and premultiplied colors can't be above their alpha
+            int alpha = min(255, max(0, (sums[3] + (1 << (kaiserBits + 3))) >> (kaiserBits + 4)));
+            for (int c = 0; c < 3; ++c)
+                out[c] = static_cast<uint8_t>(min(alpha, max(0, (sums[c] + (1 << (kaiserBits + 3))) >> (kaiserBits + 4))));
+            out[3] = static_cast<uint8_t>(alpha);
+        }
+    }
+}
+
+// Back to colors that aren't multiplied by their alpha, for pages that are stored that way
+static void Unpremultiply(vector<uint32_t> &pixels)
+{
+    static const array<uint32_t, 256> scales = []()
+    {
+        array<uint32_t, 256> s{};
+        for (uint32_t a = 1; a < 256; ++a)
+            s[a] = (255 * 65536 + a / 2) / a;
+        return s;
+    }();
+
+    for (auto &pixel : pixels)
+    {
+        uint32_t a = pixel >> 24, scale = scales[a], result = pixel & 0xff000000;
+        for (int shift = 0; shift < 24; shift += 8)
+            result |= min<uint32_t>(255, (Channel(pixel, shift) * scale + 32768) >> 16) << shift;
+        pixel = result;
+    }
+}
+
+vector<MipLevel> BuildMips(const uint32_t *pixels, int width, int height, bool premultiplied, MipFilter filter,
+                           const vector<MipCell> &cells, int levels)
+{
+    vector<MipLevel> chain;
+    vector<uint32_t> premultipliedPixels;
+    const uint32_t *src = pixels;
+    if (!premultiplied)
+    {
+        premultipliedPixels.assign(pixels, pixels + static_cast<size_t>(width) * height);
+        PremultiplyPixels(premultipliedPixels.data(), premultipliedPixels.size());
+        src = premultipliedPixels.data();
+    }
+
+    for (int level = 1; width > 1 || height > 1; ++level)
+    {
+        int dstWidth = max(1, width / 2), dstHeight = max(1, height / 2);
+        MipLevel next{dstWidth, dstHeight, vector<uint32_t>(static_cast<size_t>(dstWidth) * dstHeight)};
+        uint32_t *dst = next.pixels.data();
+        int bands = (dstHeight + mipBandRows - 1) / mipBandRows;
+
+        if (filter == MipFilter::Box)
+            ParallelFor(bands, [&](int band)
+                        { DownsampleBox(src, width, height, dst, band * mipBandRows, min(dstHeight, (band + 1) * mipBandRows)); });
+        else if (level <= levels)
+        {
+            // The cells of the level above, which are still aligned to whole pixels
+            int shift = level - 1;
+            ParallelFor(static_cast<int>(cells.size()), [&](int i)
+                        {
+                auto &cell = cells[i];
+                MipCell scaled{cell.x >> shift, cell.y >> shift, max(1, cell.width >> shift), max(1, cell.height >> shift)};
+                DownsampleKaiser(src, width, height, dst, scaled, scaled.y / 2, max(scaled.y / 2 + 1, (scaled.y + scaled.height) / 2)); });
+        }
+        else
+        {
+            MipCell page{0, 0, width, height};
+            ParallelFor(bands, [&](int band)
+                        { DownsampleKaiser(src, width, height, dst, page, band * mipBandRows, (band + 1) * mipBandRows); });
+        }
+
+        chain.push_back(move(next));
+        src = chain.back().pixels.data();
+        width = dstWidth;
+        height = dstHeight;
+    }
+
+    if (!premultiplied)
+        for (auto &level : chain)
+            Unpremultiply(level.pixels);
+    return chain;
+}
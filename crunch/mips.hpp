@@ -0,0 +1,34 @@
+#ifndef mips_hpp
+#define mips_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "options.hpp"
+
+using namespace std;
+
+// Part of a page that is filtered apart from the pixels around it, its position and size are multiples
+// of 2 to the power of the levels it's kept apart for
+struct MipCell
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+struct MipLevel
+{
+    int width;
+    int height;
+    vector<uint32_t> pixels;
+};
+
+// Builds the levels of a page below the first one, down to 1x1. The pixels are filtered premultiplied, so
+// transparent pixels don't darken the edges of the images, and are returned premultiplied only if the page
+// is. Down to the given level the Kaiser filter stays inside the cells, the box filter does by itself
+vector<MipLevel> BuildMips(const uint32_t *pixels, int width, int height, bool premultiplied, MipFilter filter,
+                           const vector<MipCell> &cells, int levels);
+
+#endif
@@ -0,0 +1,278 @@
+#include "optimize.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <tuple>
+
+#include "log.hpp"
+#include "packer.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+// Candidates packed every round, fixed so the search doesn't depend on the number of threads
+static const int RoundSize = 16;
+
+// The best candidate of a round replaces the current way even if it's worse by up to this share of its
+// cost, which lets the search leave a local minimum. The share shrinks every round, and after enough
+// rounds without a new best the search goes back to the best way with the full share again
+static const double StartThreshold = 0.02;
+static const double ThresholdDecay = 0.95;
+static const int StallRounds = 40;
+
+// A way to pack the bitmaps, order holds indices into the bitmaps and upright is by bitmap index
+struct Plan
+{
+    vector<int> order;
+    MaxRectsBinPack::FreeRectChoiceHeuristic heuristic;
+    vector<bool> upright;
+};
+
+// Fewer pages are better, then less page area, then less of the images sticking out of the half the pages
+// would shrink to, then less area within the bounds of the images
+struct Score
+{
+    int pages = numeric_limits<int>::max();
+    int64_t area = 0;
+    int64_t overflow = 0;
+    int64_t bounds = 0;
+
+    bool operator<(const Score &other) const
+    {
+        return tie(pages, area, overflow, bounds) < tie(other.pages, other.area, other.overflow, other.bounds);
+    }
+
+    double Cost() const
+    {
+        if (pages == numeric_limits<int>::max())
+            return numeric_limits<double>::infinity();
+        return static_cast<double>(area) + static_cast<double>(overflow) + static_cast<double>(bounds);
+    }
+};
+
+// splitmix64, every candidate gets its own stream from the seed, its round and its place in the round
+struct Random
+{
+    uint64_t state;
+
+    uint64_t Next()
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // From low to high, both included
+    int Range(int low, int high)
+    {
+        return low + static_cast<int>(Next() % static_cast<uint64_t>(high - low + 1));
+    }
+};
+
+static Random CandidateRandom(int round, int candidate)
+{
+    Random random{options.seed};
+    random.state = random.Next() ^ static_cast<uint64_t>(round);
+    random.state = random.Next() ^ static_cast<uint64_t>(candidate);
+    return random;
+}
+
+// Packs the bitmaps the way PackBitmaps does, and throws the pages away
+static Score Evaluate(const vector<Bitmap *> &bitmaps, const Plan &plan, int stretch, int align)
+{
+    vector<Bitmap *> remaining(plan.order.size());
+    vector<bool> upright(options.rotate ? plan.order.size() : 0);
+    for (size_t i = 0; i < plan.order.size(); ++i)
+    {
+        remaining[i] = bitmaps[plan.order[i]];
+        if (options.rotate)
+            upright[i] = plan.upright[plan.order[i]];
+    }
+
+    Score score;
+    score.pages = 0;
+    while (!remaining.empty())
+    {
+        Packer packer(options.width, options.height, options.padding, stretch, align);
+        packer.Pack(remaining, options.unique, options.rotate, plan.heuristic, upright);
+        if (packer.bitmaps.empty())
+            return Score();
+
+        int right = 0, bottom = 0;
+        for (size_t i = 0; i < packer.bitmaps.size(); ++i)
+        {
+            auto &point = packer.points[i];
+            int w = point.rot ? packer.bitmaps[i]->height : packer.bitmaps[i]->width;
+            int h = point.rot ? packer.bitmaps[i]->width : packer.bitmaps[i]->height;
+            right = max(right, point.x + w + stretch);
+            bottom = max(bottom, point.y + h + stretch);
+        }
+        // The page is halved across whichever side is the closer to fitting
+        int64_t overWidth = static_cast<int64_t>(max(0, right - packer.width / 2)) * bottom;
+        int64_t overHeight = static_cast<int64_t>(max(0, bottom - packer.height / 2)) * right;
+        ++score.pages;
+        score.area += static_cast<int64_t>(packer.width) * packer.height;
+        score.overflow += min(overWidth, overHeight);
+        score.bounds += static_cast<int64_t>(right) * bottom;
+    }
+    return score;
+}
+
+// A way a few random changes away: bitmaps swapped, moved or a run of them reversed, another heuristic, or
+// a bitmap kept upright or let rotate. Most swaps are between neighbours, which are of about the same size
+static Plan Mutate(const Plan &plan, Random &random)
+{
+    Plan next = plan;
+    int count = static_cast<int>(next.order.size());
+    for (int changes = random.Range(1, 3); changes > 0; --changes)
+    {
+        int kind = random.Range(0, options.rotate ? 9 : 8);
+        int a = random.Range(0, count - 1);
+        int b = kind < 2 ? clamp(a + random.Range(-8, 8), 0, count - 1) : random.Range(0, count - 1);
+        if (kind < 4)
+            swap(next.order[a], next.order[b]);
+        else if (kind < 7)
+        {
+            if (a < b)
+                rotate(next.order.begin() + a, next.order.begin() + a + 1, next.order.begin() + b + 1);
+            else
+                rotate(next.order.begin() + b, next.order.begin() + a, next.order.begin() + a + 1);
+        }
+        else if (kind < 8)
+            reverse(next.order.begin() + min(a, b), next.order.begin() + max(a, b) + 1);
+        else if (kind < 9)
+            next.heuristic = static_cast<MaxRectsBinPack::FreeRectChoiceHeuristic>(random.Range(0, 4));
+        else
+            next.upright[next.order[a]] = !next.upright[next.order[a]];
+    }
+    return next;
+}
+
+// Index of the best score, the first of equal ones
+static int BestIndex(const vector<Score> &scores)
+{
+    return static_cast<int>(min_element(scores.begin(), scores.end()) - scores.begin());
+}
+
+void OptimizePacking(vector<Bitmap *> &bitmaps, MaxRectsBinPack::FreeRectChoiceHeuristic &heuristic,
+                     vector<bool> &upright, int stretch, int align)
+{
+    if (bitmaps.size() < 2)
+        return;
+
+    TraceSpan span("OptimizePacking");
+    auto start = chrono::steady_clock::now();
+    bool verbose = options.verbose;
+    options.verbose = false;
+    if (verbose)
+    {
+        Out() << "optimizing the packing of " << bitmaps.size() << " images for ";
+        if (options.rounds > 0)
+            Out() << options.rounds << " rounds" << (options.optimize > 0 ? " or " : "");
+        if (options.optimize > 0)
+            Out() << options.optimize << " seconds";
+        Out() << "..." << endl;
+    }
+
+    // The search starts from the best of the usual orders (largest area, longest side, height, width and
+    // perimeter first) with every heuristic, the way as given comes first so it wins a tie
+    int count = static_cast<int>(bitmaps.size());
+    const function<int(const Bitmap *)> keys[] = {
+        [](const Bitmap *) { return 0; },
+        [](const Bitmap *b) { return max(b->width, b->height); },
+        [](const Bitmap *b) { return b->height; },
+        [](const Bitmap *b) { return b->width; },
+        [](const Bitmap *b) { return b->width + b->height; }};
+    vector<Plan> candidates;
+    for (auto &key : keys)
+    {
+        Plan plan{vector<int>(count), heuristic, vector<bool>(count, false)};
+        for (int i = 0; i < count; ++i)
+            plan.order[i] = i;
+        stable_sort(plan.order.begin(), plan.order.end(), [&](int a, int b) { return key(bitmaps[a]) < key(bitmaps[b]); });
+        for (int h = 0; h < 5; ++h)
+        {
+            candidates.push_back(plan);
+            candidates.back().heuristic = static_cast<MaxRectsBinPack::FreeRectChoiceHeuristic>((heuristic + h) % 5);
+        }
+    }
+    vector<Score> scores(candidates.size());
+    ParallelFor(static_cast<int>(candidates.size()), [&](int i) { scores[i] = Evaluate(bitmaps, candidates[i], stretch, align); });
+
+    Score given = scores[0];
+    int first = BestIndex(scores);
+    Plan best = candidates[first], current = best;
+    Score bestScore = scores[first], currentScore = bestScore;
+
+    // --rounds is the budget that packs the same atlas every time, the time only stops the search early
+    double threshold = StartThreshold;
+    int rounds = 0, stalled = 0;
+    bool timedOut = false;
+    candidates.resize(RoundSize);
+    scores.resize(RoundSize);
+    while (bestScore.pages != numeric_limits<int>::max() && (options.rounds == 0 || rounds < options.rounds))
+    {
+        if (options.optimize > 0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() >= options.optimize)
+        {
+            timedOut = true;
+            break;
+        }
+
+        ++rounds;
+        ParallelFor(RoundSize, [&](int i)
+                    {
+            Random random = CandidateRandom(rounds, i);
+            candidates[i] = Mutate(current, random);
+            scores[i] = Evaluate(bitmaps, candidates[i], stretch, align); });
+
+        int chosen = BestIndex(scores);
+        if (scores[chosen] < bestScore)
+        {
+            best = candidates[chosen];
+            bestScore = scores[chosen];
+            stalled = 0;
+        }
+        else if (++stalled >= StallRounds)
+        {
+            current = best;
+            currentScore = bestScore;
+            threshold = StartThreshold;
+            stalled = 0;
+            continue;
+        }
+        if (scores[chosen].Cost() <= currentScore.Cost() * (1 + threshold))
+        {
+            current = candidates[chosen];
+            currentScore = scores[chosen];
+        }
+        threshold *= ThresholdDecay;
+    }
+
+    options.verbose = verbose;
+    if (verbose)
+    {
+        Out() << "optimized in " << rounds << " rounds, pages: " << bestScore.pages << " (packed once " << given.pages
+              << "), pixels: " << bestScore.area << " (packed once " << given.area << ')' << endl;
+        if (timedOut && options.rounds > 0)
+            Out() << "the time ran out before " << options.rounds
+                  << " rounds, the packing depends on the speed of the machine" << endl;
+    }
+    if (!(bestScore < given))
+        return;
+
+    vector<Bitmap *> ordered(count);
+    upright.assign(options.rotate ? count : 0, false);
+    for (int i = 0; i < count; ++i)
+    {
+        ordered[i] = bitmaps[best.order[i]];
+        if (options.rotate)
+            upright[i] = best.upright[best.order[i]];
+    }
+    bitmaps = ordered;
+    heuristic = best.heuristic;
+}
@@ -0,0 +1,20 @@
+#ifndef optimize_hpp
+#define optimize_hpp
+
+#include <vector>
+
+#include "bitmap.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+// Searches for --rounds rounds, or until --optimize seconds have passed, for a way to pack the bitmaps into
+// fewer or smaller pages than packing them once as they're given. A way is the order the bitmaps are taken in
+// from the back, the heuristic and, with --rotate, which bitmaps are kept upright (upright[i] for bitmaps[i], as Packer::Pack takes it). The best
+// way found replaces the arguments, which stay as they are if nothing better was found.
+// The candidates only depend on --seed and not on the number of threads, so the same --rounds always packs
+// the same atlas unless the time runs out first
+void OptimizePacking(vector<Bitmap *> &bitmaps, MaxRectsBinPack::FreeRectChoiceHeuristic &heuristic,
+                     vector<bool> &upright, int stretch, int align);
+
+#endif
@@ -1,3 +1,3 @@
 #include "options.hpp"
 
-Options options{};
+thread_local Options options{};
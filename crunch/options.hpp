@@ -1,6 +1,9 @@
 #ifndef options_hpp
 #define options_hpp
 
+#include <cstdint>
+#include <string>
+
 #include "third_party/MaxRectsBinPack.h"
 
 using namespace rbp;
@@ -12,31 +15,95 @@ enum class BinaryStringFormat : char
     Prefix7 = 2
 };
 
+enum class TextureFormat : char
+{
+    Png = 0,
+    Dds = 1,
+    Ktx2 = 2,
+    Qoi = 3
+};
+
+enum class PixelFormat : char
+{
+    RGBA8 = 0,
+    BC1 = 1,
+    BC3 = 2,
+    BC7 = 3,
+    RGBA4444 = 4,
+    RGB565 = 5,
+    RGBA5551 = 6,
+    Palette = 7
+};
+
+enum class Dither : char
+{
+    None = 0,
+    Ordered = 1,
+    Diffusion = 2
+};
+
+enum class MipFilter : char
+{
+    Box = 0,
+    Kaiser = 1
+};
+
+enum class MeshHull : char
+{
+    None = 0,
+    Convex = 1,
+    Concave = 2
+};
+
 struct Options
 {
     bool xml = false;
     bool json = false;
     bool binary = false;
+    TextureFormat textureFormat = TextureFormat::Png;
+    PixelFormat pixelFormat = PixelFormat::RGBA8;
+    Dither dither = Dither::None;
 
     int width = 4096;
     int height = 4096;
     int padding = 1;
     int stretch = 0;
+    bool blockAlign = false;
+    int mips = 0;
+    MipFilter mipFilter = MipFilter::Box;
 
     bool premultiply = false;
     bool unique = false;
     bool trim = false;
     bool rotate = false;
+    bool grid = false;
+    MeshHull mesh = MeshHull::None;
+    int meshVertices = 8;
     MaxRectsBinPack::FreeRectChoiceHeuristic choiceHeuristic = MaxRectsBinPack::FreeRectChoiceHeuristic::RectBestShortSideFit;
+    // Seconds and rounds spent searching for a better packing, both 0 packs the images once. With both the
+    // search stops at whichever comes first
+    double optimize = 0;
+    int rounds = 0;
+    uint32_t seed = 0;
 
     BinaryStringFormat binaryStringFormat = BinaryStringFormat::NullTerminated;
+    int binaryVersion = 0;
     bool force = false;
     bool verbose = false;
     bool useTimeForHash = false;
     bool splitSubdirectories = false;
     bool noZero = false;
+    int threads = 0;
+    bool watch = false;
+    std::string stats;
+    std::string trace;
+    std::string cache;
+    // Megabytes the cache directory is pruned back to, its least recently used files are removed first
+    int cacheSize = 1024;
 };
 
-extern Options options;
+// Every thread has its own options, so atlases with different options can be packed at the same time.
+// ParallelFor runs its iterations with the options of the calling thread
+extern thread_local Options options;
 
 #endif
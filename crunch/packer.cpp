@@ -27,22 +27,39 @@
 #include "packer.hpp"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 #include "third_party/MaxRectsBinPack.h"
+#include "third_party/lodepng.h"
+#include "bcn.hpp"
 #include "binary.hpp"
+#include "log.hpp"
+#include "metadata.hpp"
+#include "mips.hpp"
 #include "options.hpp"
+#include "qoi.hpp"
+#include "stats.hpp"
+#include "texture.hpp"
+#include "trace.hpp"
 
 using namespace std;
 using namespace rbp;
 
-Packer::Packer(int width, int height, int pad, int stretch)
-    : width(width), height(height), pad(pad), stretch(stretch)
+// Rows of the page composed at a time when it's saved as a band stream
+static const int BandHeight = 64;
+
+Packer::Packer(int width, int height, int pad, int stretch, int align)
+    : width(width), height(height), pad(pad), stretch(stretch), align(align)
 {
 }
 
-void Packer::Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsBinPack::FreeRectChoiceHeuristic choiceHeuristic)
+void Packer::Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsBinPack::FreeRectChoiceHeuristic choiceHeuristic,
+                  const vector<bool> &upright)
 {
+    TraceSpan span("Packer::Pack");
     MaxRectsBinPack packer(width + pad, height + pad, rotate);
 
     int ww = 0, hh = 0;
@@ -52,7 +69,7 @@ void Packer::Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsB
         auto bitmap = bitmaps.back();
 
         if (options.verbose)
-            cout << '\t' << bitmaps.size() << ": " << bitmap->name << endl;
+            Out() << '\t' << bitmaps.size() << ": " << bitmap->name << endl;
 
         // Check to see if this is a duplicate of an already packed bitmap
         if (unique)
@@ -70,8 +87,13 @@ void Packer::Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsB
         }
 
         // If it's not a duplicate, pack it into the atlas
+        // Cells are rounded up to the alignment, so every cell starts on an aligned position
+        int cellWidth = (bitmap->width + expandAmount + align - 1) / align * align;
+        int cellHeight = (bitmap->height + expandAmount + align - 1) / align * align;
 
-        Rect rect = packer.Insert(bitmap->width + expandAmount, bitmap->height + expandAmount, choiceHeuristic);
+        if (rotate && !upright.empty())
+            packer.SetAllowFlip(!upright[bitmaps.size() - 1]);
+        Rect rect = packer.Insert(cellWidth, cellHeight, choiceHeuristic);
 
         if (rect.width == 0 || rect.height == 0)
             break;
@@ -84,7 +106,7 @@ void Packer::Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsB
         p.x = rect.x + stretch;
         p.y = rect.y + stretch;
         p.dupID = -1;
-        p.rot = rotate && bitmap->width != (rect.width - expandAmount);
+        p.rot = rotate && cellWidth != rect.width;
 
         points.push_back(p);
         this->bitmaps.push_back(bitmap);
@@ -94,15 +116,150 @@ void Packer::Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsB
         hh = max(rect.y + rect.height - pad, hh);
     }
 
+    // Nothing fit, keep the size so the caller can report the bitmap
+    if (this->bitmaps.empty())
+        return;
+
+    double usedArea = packer.Occupancy() * (static_cast<double>(width + pad) * (height + pad));
     while (width / 2 >= ww)
         width /= 2;
     while (height / 2 >= hh)
         height /= 2;
+    occupancy = min(1.0, usedArea / (static_cast<double>(width) * height));
+}
+
+// The smallest page that holds count cells of a grid, trying every width the page can be halved to and
+// the rows that width needs. Returns the number of columns, or 0 if the cells don't fit
+static int GridLayout(int count, int cellWidth, int cellHeight, int pad, int &width, int &height)
+{
+    int bestColumns = 0, bestWidth = 0, bestHeight = 0;
+    for (int w = width; w > 0 && (w + pad) / cellWidth > 0; w /= 2)
+    {
+        int columns = min((w + pad) / cellWidth, count);
+        int rows = (count + columns - 1) / columns;
+        int ww = columns * cellWidth - pad, hh = rows * cellHeight - pad;
+        if (hh > height)
+            break;
+
+        int pageWidth = w, pageHeight = height;
+        while (pageWidth / 2 >= ww)
+            pageWidth /= 2;
+        while (pageHeight / 2 >= hh)
+            pageHeight /= 2;
+
+        // Of the pages with the least area, the squarest one is taken
+        int64_t area = static_cast<int64_t>(pageWidth) * pageHeight, bestArea = static_cast<int64_t>(bestWidth) * bestHeight;
+        if (bestColumns == 0 || area < bestArea || (area == bestArea && abs(pageWidth - pageHeight) < abs(bestWidth - bestHeight)))
+        {
+            bestColumns = columns;
+            bestWidth = pageWidth;
+            bestHeight = pageHeight;
+        }
+    }
+    if (bestColumns != 0)
+    {
+        width = bestWidth;
+        height = bestHeight;
+    }
+    return bestColumns;
 }
 
-void Packer::SavePng(const string &file)
+// Places the images row by row in cells that hold an image of the given size, the page is filled up to
+// its capacity and then shrunk to the rows and columns used. With rotation the cells are turned when that
+// puts more of them on a page or makes it smaller
+void Packer::PackGrid(vector<Bitmap *> &bitmaps, bool unique, bool rotate, int cellWidth, int cellHeight)
 {
-    Bitmap bitmap(width, height);
+    TraceSpan span("Packer::PackGrid");
+
+    int expandAmount = pad + stretch * 2;
+    cellWidth = (cellWidth + expandAmount + align - 1) / align * align;
+    cellHeight = (cellHeight + expandAmount + align - 1) / align * align;
+
+    auto capacity = [&](int cw, int ch)
+    {
+        return static_cast<int64_t>((width + pad) / cw) * ((height + pad) / ch);
+    };
+    int64_t straight = capacity(cellWidth, cellHeight);
+    int64_t turned = rotate && cellWidth != cellHeight ? capacity(cellHeight, cellWidth) : 0;
+
+    // Hand out the cells in the order the images come, duplicates share the cell of their original
+    vector<int> cells;
+    size_t expected = static_cast<size_t>(min<int64_t>(bitmaps.size(), max(straight, turned)));
+    cells.reserve(expected);
+    points.reserve(expected);
+    this->bitmaps.reserve(expected);
+    int count = 0;
+    while (!bitmaps.empty())
+    {
+        auto bitmap = bitmaps.back();
+
+        if (options.verbose)
+            Out() << '\t' << bitmaps.size() << ": " << bitmap->name << endl;
+
+        int dupID = -1;
+        if (unique)
+        {
+            auto di = dupLookup.find(bitmap->hashValue);
+            if (di != dupLookup.end() && bitmap->Equals(this->bitmaps[di->second]))
+                dupID = di->second;
+        }
+        if (dupID < 0)
+        {
+            if (count >= max(straight, turned))
+                break;
+            if (unique)
+                dupLookup[bitmap->hashValue] = static_cast<int>(points.size());
+        }
+
+        cells.push_back(dupID < 0 ? count++ : -1);
+        points.push_back({0, 0, dupID, false});
+        this->bitmaps.push_back(bitmap);
+        bitmaps.pop_back();
+    }
+
+    // Nothing fit, keep the size so the caller can report the bitmap
+    if (count == 0)
+        return;
+
+    int straightWidth = width, straightHeight = height, turnedWidth = width, turnedHeight = height;
+    int columns = straight >= count ? GridLayout(count, cellWidth, cellHeight, pad, straightWidth, straightHeight) : 0;
+    int turnedColumns = turned >= count ? GridLayout(count, cellHeight, cellWidth, pad, turnedWidth, turnedHeight) : 0;
+    bool rot = turnedColumns != 0 && (columns == 0 || static_cast<int64_t>(turnedWidth) * turnedHeight < static_cast<int64_t>(straightWidth) * straightHeight);
+    if (rot)
+    {
+        columns = turnedColumns;
+        swap(cellWidth, cellHeight);
+        width = turnedWidth;
+        height = turnedHeight;
+    }
+    else
+    {
+        width = straightWidth;
+        height = straightHeight;
+    }
+
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        auto &p = points[i];
+        if (p.dupID >= 0)
+        {
+            int dupID = p.dupID;
+            p = points[dupID];
+            p.dupID = dupID;
+            continue;
+        }
+        p.x = cells[i] % columns * cellWidth + stretch;
+        p.y = cells[i] / columns * cellHeight + stretch;
+        p.rot = rot && this->bitmaps[i]->width != this->bitmaps[i]->height;
+    }
+
+    occupancy = min(1.0, static_cast<double>(count) * cellWidth * cellHeight / (static_cast<double>(width) * height));
+}
+
+void Packer::Compose(Bitmap &bitmap)
+{
+    TraceSpan span("Packer::Compose");
+    PhaseTimer timer(Phase::Compose);
     for (int i = 0, j = bitmaps.size(); i < j; ++i)
     {
         if (points[i].dupID >= 0)
@@ -116,15 +273,222 @@ void Packer::SavePng(const string &file)
         else
             bitmap.CopyPixels(bmap, x, y);
 
+        // Rotated images take up their height across the page
         if (stretch != 0)
-            bitmap.StretchPixels(x, y, bmap->width, bmap->height, stretch);
+        {
+            bool rot = points[i].rot;
+            bitmap.StretchPixels(x, y, rot ? bmap->height : bmap->width, rot ? bmap->width : bmap->height, stretch);
+        }
+    }
+}
+
+vector<vector<int>> Packer::GetBands() const
+{
+    vector<vector<int>> bands((height + BandHeight - 1) / BandHeight);
+    for (int i = 0, j = bitmaps.size(); i < j; ++i)
+    {
+        if (points[i].dupID >= 0)
+            continue;
+        int h = points[i].rot ? bitmaps[i]->width : bitmaps[i]->height;
+        int first = (points[i].y - stretch) / BandHeight, last = (points[i].y + h + stretch - 1) / BandHeight;
+        for (int band = first; band <= last; ++band)
+            bands[band].push_back(i);
+    }
+    return bands;
+}
+
+void Packer::ComposeBand(Bitmap &band, int top, const vector<int> &images) const
+{
+    PhaseTimer timer(Phase::Compose);
+    memset(band.data, 0, sizeof(uint32_t) * band.width * band.height);
+    for (int i : images)
+    {
+        auto bmap = bitmaps[i];
+        bool rot = points[i].rot;
+        int x = points[i].x, y = points[i].y;
+        int w = rot ? bmap->height : bmap->width, h = rot ? bmap->width : bmap->height;
+
+        // Rows above and below the image repeat its edge rows, the same as StretchPixels
+        int first = max(top, y - stretch), last = min(top + band.height, y + h + stretch);
+        for (int py = first; py < last; ++py)
+        {
+            int sy = clamp(py - y, 0, h - 1);
+            uint32_t *row = band.data + static_cast<size_t>(py - top) * band.width + x;
+            if (rot)
+            {
+                for (int sx = 0; sx < w; ++sx)
+                    row[sx] = bmap->data[static_cast<size_t>(bmap->height - 1 - sx) * bmap->width + sy];
+            }
+            else
+                memcpy(row, bmap->data + static_cast<size_t>(sy) * bmap->width, sizeof(uint32_t) * w);
+            fill(row - stretch, row, row[0]);
+            fill(row + w, row + w + stretch, row[w - 1]);
+        }
+    }
+}
+
+// Writes each part of the png as soon as lodepng has encoded it
+static unsigned WritePngPart(void *context, const unsigned char *data, size_t size)
+{
+    PhaseTimer timer(Phase::Write);
+    AddBytesWritten(size);
+    auto stream = reinterpret_cast<ofstream *>(context);
+    return stream->write(reinterpret_cast<const char *>(data), size) ? 0 : 1;
+}
+
+bool Packer::SavePng(const string &file, PixelFormat format, Dither dither)
+{
+    TraceSpan span("Packer::SavePng", file);
+    if (format == PixelFormat::Palette)
+    {
+        // The palette is chosen from the whole page
+        Bitmap bitmap(width, height);
+        Compose(bitmap);
+        return bitmap.SaveAsPalette(file, dither);
+    }
+
+    // The page is never composed whole, only a band of rows at a time. lodepng picks the color type from
+    // all of the pixels, so the bands are composed once to scan them and again to filter and compress them
+    vector<vector<int>> bands = GetBands();
+    Bitmap band(width, BandHeight);
+    ofstream stream(file, ios::binary);
+    LodePNGStream *png = lodepng_stream_new(width, height, WritePngPart, &stream);
+    unsigned error = png ? 0 : 83;
+    for (int pass = 0; pass < 2 && !error; ++pass)
+    {
+        for (int i = 0; i < bands.size() && !error; ++i)
+        {
+            int top = i * BandHeight;
+            ComposeBand(band, top, bands[i]);
+
+            PhaseTimer timer(Phase::Encode);
+            auto pixels = reinterpret_cast<unsigned char *>(band.data);
+            auto rows = static_cast<unsigned>(min(BandHeight, height - top));
+            error = pass == 0 ? lodepng_stream_scan(png, pixels, rows) : lodepng_stream_write(png, pixels, rows);
+        }
+    }
+    if (!error)
+    {
+        PhaseTimer timer(Phase::Encode);
+        error = lodepng_stream_finish(png);
+    }
+    lodepng_stream_delete(png);
+    stream.close();
+    if (error || !stream)
+    {
+        cerr << "failed to save png: " << file << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Packer::SaveQoi(const string &file)
+{
+    TraceSpan span("Packer::SaveQoi", file);
+
+    // Each band is encoded and written before the next one is composed
+    vector<vector<int>> bands = GetBands();
+    Bitmap band(width, BandHeight);
+    ofstream stream(file, ios::binary);
+    vector<uint8_t> qoi;
+    QoiEncoder encoder(width, height, qoi);
+    for (int i = 0; i < bands.size() && stream; ++i)
+    {
+        int top = i * BandHeight;
+        ComposeBand(band, top, bands[i]);
+        {
+            PhaseTimer timer(Phase::Encode);
+            auto pixels = reinterpret_cast<const uint8_t *>(band.data);
+            encoder.Encode(pixels, static_cast<size_t>(min(BandHeight, height - top)) * width, qoi);
+        }
+        PhaseTimer timer(Phase::Write);
+        AddBytesWritten(qoi.size());
+        stream.write(reinterpret_cast<const char *>(qoi.data()), qoi.size());
+        qoi.clear();
     }
-    bitmap.SaveAs(file);
+    stream.close();
+    if (!stream)
+    {
+        cerr << "failed to save qoi: " << file << endl;
+        return false;
+    }
+    return true;
 }
 
-void Packer::SaveXml(const string &name, ofstream &xml, bool trim, bool rotate)
+bool Packer::SaveDds(const string &file, PixelFormat format, bool premultiplied, Dither dither, int mips,
+                      MipFilter mipFilter)
 {
-    xml << "\t<tex n=\"" << name << "\">" << endl;
+    TraceSpan span("Packer::SaveDds", file);
+    return GetPageTexture(format, premultiplied, dither, mips, mipFilter).SaveDds(file);
+}
+
+bool Packer::SaveKtx2(const string &file, PixelFormat format, bool premultiplied, Dither dither, int mips,
+                       MipFilter mipFilter)
+{
+    TraceSpan span("Packer::SaveKtx2", file);
+    return GetPageTexture(format, premultiplied, dither, mips, mipFilter).SaveKtx2(file);
+}
+
+Texture Packer::GetPageTexture(PixelFormat format, bool premultiplied, Dither dither, int mips,
+                               MipFilter mipFilter)
+{
+    if (ComposesWholePage(format, dither, mips))
+    {
+        Bitmap bitmap(width, height);
+        Compose(bitmap);
+        return GetTexture(bitmap, format, premultiplied, dither, mips, mipFilter);
+    }
+
+    // Bands are a multiple of the 4 rows of a block and of the ordered dither pattern
+    vector<vector<int>> bands = GetBands();
+    Bitmap band(width, BandHeight);
+    Texture texture(width, height, format, premultiplied, dither);
+    for (int i = 0; i < bands.size(); ++i)
+    {
+        int top = i * BandHeight;
+        ComposeBand(band, top, bands[i]);
+        texture.AddBand(band.data, min(BandHeight, height - top));
+    }
+    return texture;
+}
+
+bool Packer::ComposesWholePage(PixelFormat format, Dither dither, int mips)
+{
+    // Mip levels are made from the whole page, and error diffusion carries over from row to row
+    return mips != 0 || (dither == Dither::Diffusion && BlockBytes(format) == 2);
+}
+
+Texture Packer::GetTexture(const Bitmap &page, PixelFormat format, bool premultiplied, Dither dither, int mips,
+                           MipFilter mipFilter) const
+{
+    Texture texture(page, format, premultiplied, dither);
+    if (mips == 0)
+        return texture;
+
+    // The cells the images were packed in, the same rounding as when packing
+    vector<MipCell> cells;
+    int expandAmount = pad + stretch * 2;
+    for (int i = 0, j = bitmaps.size(); i < j; ++i)
+    {
+        if (points[i].dupID >= 0)
+            continue;
+        int w = points[i].rot ? bitmaps[i]->height : bitmaps[i]->width;
+        int h = points[i].rot ? bitmaps[i]->width : bitmaps[i]->height;
+        cells.push_back({points[i].x - stretch, points[i].y - stretch, (w + expandAmount + align - 1) / align * align,
+                         (h + expandAmount + align - 1) / align * align});
+    }
+
+    TraceSpan span("Packer::BuildMips");
+    PhaseTimer timer(Phase::Encode);
+    for (auto &level : BuildMips(page.data, width, height, premultiplied, mipFilter, cells, mips))
+        texture.AddLevel(level.pixels.data(), level.width, level.height);
+    return texture;
+}
+
+void Packer::SaveXml(const string &name, Buffer &xml, bool trim, bool rotate, bool mesh)
+{
+    TraceSpan span("Packer::SaveXml", name);
+    xml << "\t<tex n=\"" << name << "\">\n";
     for (int i = 0, j = bitmaps.size(); i < j; ++i)
     {
         xml << "\t\t<img n=\"" << bitmaps[i]->name << "\" ";
@@ -141,37 +505,63 @@ void Packer::SaveXml(const string &name, ofstream &xml, bool trim, bool rotate)
         }
         if (rotate)
             xml << "r=\"" << (points[i].rot ? 1 : 0) << "\" ";
-        xml << "/>" << endl;
+        if (mesh)
+        {
+            auto &m = bitmaps[i]->mesh;
+            xml << "v=\"";
+            for (size_t k = 0; k < m.vertices.size(); ++k)
+                xml << (k > 0 ? " " : "") << m.vertices[k].x << ' ' << m.vertices[k].y;
+            xml << "\" i=\"";
+            for (size_t k = 0; k < m.indices.size(); ++k)
+                xml << (k > 0 ? " " : "") << m.indices[k];
+            xml << "\" ";
+        }
+        xml << "/>\n";
     }
-    xml << "\t</tex>" << endl;
+    xml << "\t</tex>\n";
 }
 
-void Packer::SaveBin(const string &name, ofstream &bin, bool trim, bool rotate)
+void Packer::SaveBin(const string &name, Buffer &bin, bool trim, bool rotate, bool mesh)
 {
+    TraceSpan span("Packer::SaveBin", name);
     WriteString(bin, name);
-    WriteShort(bin, (int16_t)bitmaps.size());
+    WriteBinNumber(bin, static_cast<int>(bitmaps.size()));
     for (int i = 0, j = bitmaps.size(); i < j; ++i)
     {
         WriteString(bin, bitmaps[i]->name);
-        WriteShort(bin, (int16_t)points[i].x);
-        WriteShort(bin, (int16_t)points[i].y);
-        WriteShort(bin, (int16_t)bitmaps[i]->width);
-        WriteShort(bin, (int16_t)bitmaps[i]->height);
+        WriteBinNumber(bin, points[i].x);
+        WriteBinNumber(bin, points[i].y);
+        WriteBinNumber(bin, bitmaps[i]->width);
+        WriteBinNumber(bin, bitmaps[i]->height);
         if (trim)
         {
-            WriteShort(bin, (int16_t)bitmaps[i]->frameX);
-            WriteShort(bin, (int16_t)bitmaps[i]->frameY);
-            WriteShort(bin, (int16_t)bitmaps[i]->frameW);
-            WriteShort(bin, (int16_t)bitmaps[i]->frameH);
+            WriteBinNumber(bin, bitmaps[i]->frameX);
+            WriteBinNumber(bin, bitmaps[i]->frameY);
+            WriteBinNumber(bin, bitmaps[i]->frameW);
+            WriteBinNumber(bin, bitmaps[i]->frameH);
         }
         if (rotate)
             WriteByte(bin, points[i].rot ? 1 : 0);
+        if (mesh)
+        {
+            auto &m = bitmaps[i]->mesh;
+            WriteBinNumber(bin, static_cast<int>(m.vertices.size()));
+            for (auto &vertex : m.vertices)
+            {
+                WriteBinNumber(bin, vertex.x);
+                WriteBinNumber(bin, vertex.y);
+            }
+            WriteBinNumber(bin, static_cast<int>(m.indices.size()));
+            for (auto index : m.indices)
+                WriteBinNumber(bin, index);
+        }
     }
 }
 
-void Packer::SaveJson(const string &name, ofstream &json, bool trim, bool rotate)
+void Packer::SaveJson(const string &name, Buffer &json, bool trim, bool rotate, bool mesh)
 {
-    json << "\t\t\"" << name << "\": {" << endl;
+    TraceSpan span("Packer::SaveJson", name);
+    json << "\t\t\"" << name << "\": {\n";
     for (int i = 0, j = bitmaps.size(); i < j; ++i)
     {
         json << "\t\t\t\"" << bitmaps[i]->name << "\": { ";
@@ -188,10 +578,31 @@ void Packer::SaveJson(const string &name, ofstream &json, bool trim, bool rotate
         }
         if (rotate)
             json << ", \"r\": " << (points[i].rot ? "true" : "false");
+        if (mesh)
+        {
+            auto &m = bitmaps[i]->mesh;
+            json << ", \"v\": [";
+            for (size_t k = 0; k < m.vertices.size(); ++k)
+                json << (k > 0 ? ", " : "") << m.vertices[k].x << ", " << m.vertices[k].y;
+            json << "], \"i\": [";
+            for (size_t k = 0; k < m.indices.size(); ++k)
+                json << (k > 0 ? ", " : "") << m.indices[k];
+            json << "]";
+        }
         json << " }";
         if (i != bitmaps.size() - 1)
             json << ",";
-        json << endl;
+        json << '\n';
     }
     json << "\t\t}";
 }
+
+AtlasTexture Packer::GetAtlasTexture(const string &name) const
+{
+    AtlasTexture texture{name, {}};
+    for (int i = 0, j = bitmaps.size(); i < j; ++i)
+        texture.images.push_back({bitmaps[i]->name, points[i].x, points[i].y, bitmaps[i]->width, bitmaps[i]->height,
+                                  bitmaps[i]->frameX, bitmaps[i]->frameY, bitmaps[i]->frameW, bitmaps[i]->frameH, points[i].rot,
+                                  bitmaps[i]->mesh});
+    return texture;
+}
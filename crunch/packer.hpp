@@ -27,12 +27,15 @@
 #ifndef packer_hpp
 #define packer_hpp
 
-#include <fstream>
 #include <unordered_map>
 #include <vector>
 
 #include "third_party/MaxRectsBinPack.h"
+#include "atlas.hpp"
 #include "bitmap.hpp"
+#include "buffer.hpp"
+#include "options.hpp"
+#include "texture.hpp"
 
 using namespace std;
 using namespace rbp;
@@ -51,17 +54,43 @@ struct Packer
     int height;
     int pad;
     int stretch;
+    int align;
+
+    // Share of the page covered by the packed cells, padding included
+    double occupancy = 0;
 
     vector<Bitmap *> bitmaps;
     vector<Point> points;
     unordered_map<uint64_t, int> dupLookup;
 
-    Packer(int width, int height, int pad, int stretch);
-    void Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsBinPack::FreeRectChoiceHeuristic choiceHeuristic);
-    void SavePng(const string &file);
-    void SaveXml(const string &name, ofstream &xml, bool trim, bool rotate);
-    void SaveBin(const string &name, ofstream &bin, bool trim, bool rotate);
-    void SaveJson(const string &name, ofstream &json, bool trim, bool rotate);
+    Packer(int width, int height, int pad, int stretch, int align);
+    // Packs bitmaps from the back until the page is full. With rotation, upright[i] keeps bitmaps[i] from
+    // being rotated, an empty upright lets all of them rotate
+    void Pack(vector<Bitmap *> &bitmaps, bool unique, bool rotate, MaxRectsBinPack::FreeRectChoiceHeuristic choiceHeuristic,
+              const vector<bool> &upright = {});
+    void PackGrid(vector<Bitmap *> &bitmaps, bool unique, bool rotate, int cellWidth, int cellHeight);
+    void Compose(Bitmap &bitmap);
+    // The images reaching into each band of rows of the page, stretched edges included, in packing order
+    vector<vector<int>> GetBands() const;
+    // Composes the rows of the page starting at top into the band, from the images of that band
+    void ComposeBand(Bitmap &band, int top, const vector<int> &images) const;
+    // The saves print the error and return false if the file can't be written
+    bool SavePng(const string &file, PixelFormat format, Dither dither);
+    bool SaveQoi(const string &file);
+    bool SaveDds(const string &file, PixelFormat format, bool premultiplied, Dither dither, int mips, MipFilter mipFilter);
+    bool SaveKtx2(const string &file, PixelFormat format, bool premultiplied, Dither dither, int mips, MipFilter mipFilter);
+    void SaveXml(const string &name, Buffer &xml, bool trim, bool rotate, bool mesh);
+    void SaveBin(const string &name, Buffer &bin, bool trim, bool rotate, bool mesh);
+    void SaveJson(const string &name, Buffer &json, bool trim, bool rotate, bool mesh);
+    AtlasTexture GetAtlasTexture(const string &name) const;
+    // The composed page as a texture, with the whole mip chain if mips isn't 0. The images are kept apart
+    // down to that level, which the alignment of the packer has to allow
+    Texture GetTexture(const Bitmap &page, PixelFormat format, bool premultiplied, Dither dither, int mips,
+                       MipFilter mipFilter) const;
+    // The same without a composed page, the first level is encoded a band of rows at a time when it can be
+    Texture GetPageTexture(PixelFormat format, bool premultiplied, Dither dither, int mips, MipFilter mipFilter);
+    // Whether GetPageTexture has to compose the whole page instead of a band at a time
+    static bool ComposesWholePage(PixelFormat format, Dither dither, int mips);
 };
 
 #endif
@@ -0,0 +1,137 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+// A running ParallelFor, the iterations are claimed one at a time by its caller and by idle pool threads
+struct Loop
+{
+    const function<void(int)> *body;
+    int count;
+    atomic<int> next = 0;
+    int helpers = 0;
+    Options options;
+    bool captured;
+    string log;
+};
+
+// The pool threads are shared by every ParallelFor, including nested ones, so the number of
+// threads stays bounded and idle threads help with whatever loop still has iterations left
+struct Pool
+{
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    vector<Loop *> loops;
+    int threadCount = 0;
+};
+
+// Never destroyed, the pool threads may still be waiting when the program exits
+static Pool &pool = *new Pool();
+
+int WorkerCount()
+{
+    if (options.threads > 0)
+        return options.threads;
+    return max(1, static_cast<int>(thread::hardware_concurrency()));
+}
+
+static void RunIterations(Loop &loop)
+{
+    for (int i = loop.next++; i < loop.count; i = loop.next++)
+        (*loop.body)(i);
+}
+
+// Runs iterations of another thread's loop with that thread's options and log
+static void HelpLoop(Loop &loop)
+{
+    Options previous = options;
+    options = loop.options;
+    if (loop.captured)
+    {
+        LogCapture capture;
+        RunIterations(loop);
+        lock_guard<mutex> lock(pool.lock);
+        loop.log += capture.stream.str();
+    }
+    else
+        RunIterations(loop);
+    options = previous;
+}
+
+static void PoolThread()
+{
+    unique_lock<mutex> lock(pool.lock);
+    while (true)
+    {
+        pool.wake.wait(lock, []
+                       { return !pool.loops.empty(); });
+
+        // The newest loop is the most nested one, finishing it first unblocks its caller sooner
+        Loop *loop = pool.loops.back();
+        if (loop->next >= loop->count)
+        {
+            pool.loops.pop_back();
+            continue;
+        }
+
+        ++loop->helpers;
+        lock.unlock();
+        HelpLoop(*loop);
+        lock.lock();
+        if (--loop->helpers == 0)
+            pool.done.notify_all();
+    }
+}
+
+void ParallelFor(int count, const function<void(int)> &body)
+{
+    int threadCount = min(WorkerCount(), count);
+    if (threadCount <= 1)
+    {
+        for (int i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+
+    Loop loop;
+    loop.body = &body;
+    loop.count = count;
+    loop.options = options;
+    loop.captured = &Out() != &cout;
+
+    {
+        lock_guard<mutex> lock(pool.lock);
+        while (pool.threadCount < WorkerCount() - 1)
+        {
+            thread(PoolThread).detach();
+            ++pool.threadCount;
+        }
+        pool.loops.push_back(&loop);
+    }
+    pool.wake.notify_all();
+
+    RunIterations(loop);
+
+    // Wait for the iterations still running on the pool threads
+    unique_lock<mutex> lock(pool.lock);
+    auto position = find(pool.loops.begin(), pool.loops.end(), &loop);
+    if (position != pool.loops.end())
+        pool.loops.erase(position);
+    pool.done.wait(lock, [&]
+                   { return loop.helpers == 0; });
+
+    if (!loop.log.empty())
+        Out() << loop.log;
+}
@@ -0,0 +1,15 @@
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <functional>
+
+using namespace std;
+
+// Number of worker threads used by the parallel helpers, --threads or the hardware threads (at least 1)
+int WorkerCount();
+
+// Calls body(i) for every i in [0, count) on the calling thread and a shared pool of WorkerCount() - 1 threads.
+// Nested loops use the same pool, idle pool threads help them with the caller's options and log
+void ParallelFor(int count, const function<void(int)> &body);
+
+#endif
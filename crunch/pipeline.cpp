@@ -0,0 +1,513 @@
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#include "atlas.hpp"
+#include "binary.hpp"
+#include "hash.hpp"
+#include "log.hpp"
+#include "metadata.hpp"
+#include "optimize.hpp"
+#include "options.hpp"
+#include "parallel.hpp"
+#include "pixelcache.hpp"
+#include "readahead.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+string NormalizePath(const string &path)
+{
+    string str = path;
+    replace(str.begin(), str.end(), '\\', '/');
+    return str;
+}
+
+vector<string> SplitInputs(const string &list)
+{
+    vector<string> inputs;
+    stringstream ss(list);
+    while (ss.good())
+    {
+        string inputStr;
+        getline(ss, inputStr, ',');
+        inputs.push_back(NormalizePath(inputStr));
+    }
+    return inputs;
+}
+
+string TextureExtension()
+{
+    switch (options.textureFormat)
+    {
+    case TextureFormat::Dds:
+        return ".dds";
+    case TextureFormat::Ktx2:
+        return ".ktx2";
+    case TextureFormat::Qoi:
+        return ".qoi";
+    default:
+        return ".png";
+    }
+}
+
+static void FindImages(const string &root, const string &prefix, vector<ImageFile> &images)
+{
+    for (const auto &entry : fs::directory_iterator(root))
+    {
+        fs::path path = entry.path();
+        string pathName = path.string();
+
+        if (entry.is_directory())
+            FindImages(pathName, prefix + path.filename().string() + '/', images);
+        else if (path.extension().string() == ".png" || path.extension().string() == ".qoi")
+            images.push_back({pathName, NormalizePath(prefix + path.stem().string())});
+    }
+}
+
+void FindImages(const vector<string> &inputs, const string &prefix, vector<ImageFile> &images)
+{
+    for (auto &input : inputs)
+    {
+        if (fs::is_directory(input))
+            FindImages(input, prefix, images);
+        else
+            images.push_back({input, prefix + input});
+    }
+}
+
+void RemoveAtlasFiles(const string &outputName)
+{
+    fs::remove(outputName + ".bin");
+    fs::remove(outputName + ".xml");
+    fs::remove(outputName + ".json");
+    for (const string ext : {".png", ".qoi", ".dds", ".ktx2"})
+    {
+        fs::remove(outputName + ext);
+        for (int i = 0; i < 16; ++i)
+            fs::remove(outputName + to_string(i) + ext);
+    }
+}
+
+bool PackBitmaps(vector<Bitmap *> bitmaps, const string &name, vector<Packer *> &packers, string &error)
+{
+    PhaseTimer timer(Phase::Pack);
+
+    // Images that all have the same size fill a grid without gaps, so they skip the search for free space.
+    // With rotation that only holds for squares, other tiles can fill the edges of the page by turning
+    int cellWidth = 0, cellHeight = 0;
+    bool uniform = true;
+    for (auto bitmap : bitmaps)
+    {
+        cellWidth = max(cellWidth, bitmap->width);
+        cellHeight = max(cellHeight, bitmap->height);
+        uniform = uniform && bitmap->width == bitmaps[0]->width && bitmap->height == bitmaps[0]->height;
+    }
+    bool grid = options.grid || (uniform && (!options.rotate || cellWidth == cellHeight));
+
+    // Sort the bitmaps by area, images of the same size already are
+    if (!uniform)
+        stable_sort(bitmaps.begin(), bitmaps.end(), [](const Bitmap *a, const Bitmap *b)
+                    { return (a->width * a->height) < (b->width * b->height); });
+
+    // With --mips the cells are aligned to the pixels of the last level the images are kept apart on, and
+    // the edges are extruded far enough that the filter doesn't fade them into the padding before that
+    int align = (options.blockAlign ? 4 : 1) << options.mips;
+    int stretch = max(options.stretch, (1 << options.mips) - 1);
+
+    MaxRectsBinPack::FreeRectChoiceHeuristic heuristic = options.choiceHeuristic;
+    vector<bool> upright;
+    if (!grid && (options.optimize > 0 || options.rounds > 0))
+        OptimizePacking(bitmaps, heuristic, upright, stretch, align);
+
+    while (!bitmaps.empty())
+    {
+        if (options.verbose)
+            Out() << "packing " << bitmaps.size() << " images..." << endl;
+
+        auto packer = new Packer(options.width, options.height, options.padding, stretch, align);
+        if (grid)
+            packer->PackGrid(bitmaps, options.unique, options.rotate, cellWidth, cellHeight);
+        else
+            packer->Pack(bitmaps, options.unique, options.rotate, heuristic, upright);
+        packers.push_back(packer);
+
+        if (options.verbose)
+            Out() << "finished packing: " << name << (options.noZero && bitmaps.empty() ? "" : to_string(packers.size() - 1)) << " (" << packer->width << " x " << packer->height << ')' << endl;
+
+        if (packer->bitmaps.empty())
+        {
+            error = "packing failed, could not fit bitmap: " + bitmaps.back()->name;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether saving a page of the --texture format composes all of it in memory instead of a band at a time
+static bool ComposesWholePage()
+{
+    switch (options.textureFormat)
+    {
+    case TextureFormat::Png:
+        return options.pixelFormat == PixelFormat::Palette;
+    case TextureFormat::Qoi:
+        return false;
+    default:
+        return Packer::ComposesWholePage(options.pixelFormat, options.dither, options.mips);
+    }
+}
+
+bool SaveTexture(Packer &packer, const string &file)
+{
+    if (options.verbose)
+        Out() << "writing texture: " << file << endl;
+
+    switch (options.textureFormat)
+    {
+    case TextureFormat::Png:
+        return packer.SavePng(file, options.pixelFormat, options.dither);
+    case TextureFormat::Qoi:
+        return packer.SaveQoi(file);
+    case TextureFormat::Dds:
+        return packer.SaveDds(file, options.pixelFormat, options.premultiply, options.dither, options.mips,
+                              options.mipFilter);
+    case TextureFormat::Ktx2:
+        return packer.SaveKtx2(file, options.pixelFormat, options.premultiply, options.dither, options.mips,
+                               options.mipFilter);
+    }
+    return false;
+}
+
+// Formats the section of every texture on its own thread, the sections are joined in order by the caller
+static vector<Buffer> FormatTextures(const vector<Packer *> &packers, const string &name, bool noZero,
+                                     void (Packer::*save)(const string &, Buffer &, bool, bool, bool))
+{
+    vector<Buffer> textures(packers.size());
+    ParallelFor(static_cast<int>(packers.size()), [&](int i)
+                {
+        PhaseTimer timer(Phase::Write);
+        (packers[i]->*save)(name + (noZero ? "" : to_string(i)), textures[i], options.trim, options.rotate, options.mesh != MeshHull::None); });
+    return textures;
+}
+
+void FormatMetadata(const vector<Packer *> &packers, const string &name, bool noZero, AtlasMetadata &metadata,
+                    SplitSection *section)
+{
+    // Format the atlas binary
+    if (options.binary)
+    {
+        if (options.binaryVersion == 1)
+        {
+            vector<AtlasTexture> textures;
+            for (int i = 0; i < packers.size(); ++i)
+                textures.push_back(packers[i]->GetAtlasTexture(name + (noZero ? "" : to_string(i))));
+            WriteAtlasBin(metadata.bin, textures, options.trim, options.rotate, options.mesh != MeshHull::None);
+            if (section)
+                section->textures = move(textures);
+        }
+        else
+        {
+            Buffer textures;
+            for (auto &texture : FormatTextures(packers, name, noZero, &Packer::SaveBin))
+                textures.Append(texture);
+
+            if (!options.splitSubdirectories)
+                WriteBinHeader(metadata.bin);
+            WriteBinNumber(metadata.bin, static_cast<int>(packers.size()));
+            metadata.bin.Append(textures);
+            if (section)
+                section->bin = move(textures);
+        }
+    }
+
+    // Format the atlas xml
+    if (options.xml)
+    {
+        Buffer textures;
+        for (auto &texture : FormatTextures(packers, name, noZero, &Packer::SaveXml))
+            textures.Append(texture);
+
+        if (!options.splitSubdirectories)
+            WriteXmlHeader(metadata.xml);
+        metadata.xml.Append(textures);
+        if (!options.splitSubdirectories)
+            WriteXmlFooter(metadata.xml);
+        if (section)
+            section->xml = move(textures);
+    }
+
+    // Format the atlas json
+    if (options.json)
+    {
+        Buffer textures;
+        vector<Buffer> sections = FormatTextures(packers, name, noZero, &Packer::SaveJson);
+        for (int i = 0; i < sections.size(); ++i)
+        {
+            if (i > 0)
+                textures << ",\n";
+            textures.Append(sections[i]);
+        }
+
+        if (!options.splitSubdirectories)
+            WriteJsonHeader(metadata.json);
+        metadata.json.Append(textures);
+        if (!options.splitSubdirectories)
+            WriteJsonFooter(metadata.json);
+        if (section)
+            section->json = move(textures);
+    }
+
+    if (section)
+    {
+        section->packed = true;
+        section->textureCount = static_cast<int>(packers.size());
+    }
+}
+
+void SaveMetadata(const vector<Packer *> &packers, const string &outputName, const string &name, bool noZero,
+                  SplitSection *section)
+{
+    TraceSpan span("SaveMetadata", outputName);
+    PhaseTimer timer(Phase::Write);
+    AtlasMetadata metadata;
+    FormatMetadata(packers, name, noZero, metadata, section);
+
+    if (options.binary)
+    {
+        if (options.verbose)
+            Out() << "writing bin: " << outputName << ".bin" << endl;
+        SaveBuffer(metadata.bin, outputName + ".bin");
+    }
+
+    if (options.xml)
+    {
+        if (options.verbose)
+            Out() << "writing xml: " << outputName << ".xml" << endl;
+        SaveBuffer(metadata.xml, outputName + ".xml");
+    }
+
+    if (options.json)
+    {
+        if (options.verbose)
+            Out() << "writing json: " << outputName << ".json" << endl;
+        SaveBuffer(metadata.json, outputName + ".json");
+    }
+}
+
+int PackAtlas(uint64_t newHash, const string &outputDirectory, const string &name, const vector<string> &inputs,
+              const string &prefix, SplitSection *section, DecodeCache *cache)
+{
+    TraceSpan span("PackAtlas", name);
+    string outputName = name;
+
+    if (!outputDirectory.empty())
+        outputName = outputDirectory + '/' + outputName;
+
+    string error;
+    {
+        PhaseTimer timer(Phase::Hash);
+        if (!HashInputs(newHash, inputs, options.useTimeForHash, error))
+        {
+            cerr << error << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Load the old hash
+    uint64_t oldHash;
+    if (!options.force && LoadHash(oldHash, outputName + ".hash") && newHash == oldHash)
+    {
+        if (!options.splitSubdirectories)
+            Out() << "atlas is unchanged: " << name << endl;
+        return EXIT_SKIPPED;
+    }
+
+    // Remove old files
+    fs::remove(outputName + ".hash");
+    RemoveAtlasFiles(outputName);
+
+    // Load the bitmaps from all the input files and directories
+    if (options.verbose)
+        Out() << "loading images..." << endl;
+
+    vector<ImageFile> images;
+    {
+        PhaseTimer timer(Phase::Scan);
+        FindImages(inputs, prefix, images);
+    }
+    AddImages(images.size());
+
+    vector<string> files;
+    for (auto &image : images)
+    {
+        if (options.verbose)
+            Out() << '\t' << image.path << endl;
+        files.push_back(image.path);
+    }
+
+    // The files are read ahead in order while the images before them are decoded
+    vector<Bitmap *> bitmaps(images.size());
+    vector<string> errors(images.size());
+    ReadAhead reads(files);
+    ParallelFor(static_cast<int>(images.size()), [&](int i)
+                {
+        auto &image = images[i];
+        const uint8_t *data;
+        size_t size;
+        bool read;
+        {
+            PhaseTimer timer(Phase::Decode);
+            read = reads.Wait(i, data, size);
+        }
+        if (!read)
+            errors[i] = FailedToLoad(image.path);
+        else if (cache)
+            bitmaps[i] = cache->Load(image.path, image.name, data, size, errors[i]);
+        else
+            bitmaps[i] = DecodeBitmap(image.path, data, size, image.name, errors[i]);
+        reads.Release(i); });
+
+    // An image that can't be loaded fails the atlas, the other atlases of a batch still go on
+    for (auto &imageError : errors)
+        if (!imageError.empty())
+        {
+            cerr << imageError << endl;
+            for (auto bitmap : bitmaps)
+                delete bitmap;
+            return EXIT_FAILURE;
+        }
+
+    // Pack the bitmaps
+    vector<Packer *> packers;
+    if (!PackBitmaps(bitmaps, name, packers, error))
+    {
+        cerr << error << endl;
+        return EXIT_FAILURE;
+    }
+
+    bool noZero = options.noZero && packers.size() == 1;
+    AddPages(packers, name, noZero);
+
+    // Save the atlas images, pages encoded a band at a time are saved in parallel since several fit in memory
+    // at once. Pages composed whole can take a gigabyte each, so they're saved one at a time
+    vector<string> logs(packers.size());
+    // Not vector<bool>, its bits can't be set from several threads at once
+    vector<char> saved(packers.size());
+    auto save = [&](int i)
+    {
+        LogCapture capture;
+        saved[i] = SaveTexture(*packers[i], outputName + (noZero ? "" : to_string(i)) + TextureExtension());
+        logs[i] = capture.stream.str();
+    };
+    if (ComposesWholePage())
+        for (int i = 0; i < packers.size(); ++i)
+            save(i);
+    else
+        ParallelFor(static_cast<int>(packers.size()), save);
+    for (auto &log : logs)
+        Out() << log;
+
+    bool failed = find(saved.begin(), saved.end(), false) != saved.end();
+    if (!failed)
+        SaveMetadata(packers, outputName, name, noZero, section);
+
+    // Free the packed bitmaps, split mode may keep packing other subdirectories
+    for (auto packer : packers)
+    {
+        for (auto bitmap : packer->bitmaps)
+            delete bitmap;
+        delete packer;
+    }
+    if (failed)
+        return EXIT_FAILURE;
+
+    // Save the new hash
+    SaveHash(newHash, outputName + ".hash");
+
+    return EXIT_SUCCESS;
+}
+
+int CrunchAtlas(uint64_t newHash, const string &output, const vector<string> &inputs, DecodeCache *cache)
+{
+    fs::path outputPath = output;
+    string outputDir = outputPath.parent_path().string(), name = outputPath.filename().string();
+    string outputName = outputPath.string();
+
+    if (!options.splitSubdirectories)
+        return PackAtlas(newHash, outputDir, name, inputs, "", nullptr, cache);
+
+    string newInput, namePrefix;
+    for (const string &input : inputs)
+    {
+        if (!input.ends_with(".png") && !input.ends_with(".qoi"))
+        {
+            newInput = input;
+            break;
+        }
+    }
+
+    if (newInput.empty())
+    {
+        cerr << "could not find directories in input" << endl;
+        return EXIT_FAILURE;
+    }
+
+    namePrefix = name + "_";
+
+    // Sort the subdirectories, so the merged files always list them in the same order
+    vector<string> subdirs;
+    {
+        PhaseTimer timer(Phase::Scan);
+        for (auto &subdir : fs::directory_iterator(newInput))
+            if (subdir.is_directory())
+                subdirs.push_back(subdir.path().filename().string());
+        sort(subdirs.begin(), subdirs.end());
+    }
+
+    // Pack the subdirectories on the worker threads, each one logs into its own buffer
+    // and the logs are printed in subdirectory order as soon as the earlier ones are done
+    vector<int> results(subdirs.size());
+    vector<SplitSection> sections(subdirs.size());
+    vector<string> logs(subdirs.size());
+    vector<bool> done(subdirs.size());
+    ostream &out = Out();
+    mutex logMutex;
+    int nextLog = 0;
+
+    ParallelFor(static_cast<int>(subdirs.size()), [&](int i)
+                {
+        {
+            LogCapture capture;
+            string prefixedName = namePrefix + subdirs[i];
+            vector<string> input{(fs::path(newInput) / subdirs[i]).string()};
+            results[i] = PackAtlas(newHash, outputDir, prefixedName, input, subdirs[i] + '/', &sections[i], cache);
+            logs[i] = capture.stream.str();
+        }
+
+        lock_guard<mutex> lock(logMutex);
+        done[i] = true;
+        while (nextLog < subdirs.size() && done[nextLog])
+            out << logs[nextLog++];
+        out.flush(); });
+
+    for (int result : results)
+        if (result != EXIT_SUCCESS && result != EXIT_SKIPPED)
+            return result;
+
+    // Only the sections of the packed subdirectories are rewritten in the merged files
+    string subatlasName = (outputDir.empty() ? "" : outputDir + '/') + namePrefix;
+    if (!MergeSplit(newHash, outputName, subatlasName, subdirs, sections))
+    {
+        Out() << "atlas is unchanged: " << name << endl;
+        return EXIT_SKIPPED;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#ifndef pipeline_hpp
+#define pipeline_hpp
+
+#include <string>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "buffer.hpp"
+#include "cache.hpp"
+#include "packer.hpp"
+#include "split.hpp"
+
+#define EXIT_SKIPPED 2
+
+using namespace std;
+
+// An input image and the name it gets in the atlas
+struct ImageFile
+{
+    string path;
+    string name;
+};
+
+string NormalizePath(const string &path);
+
+// Splits a comma separated list of input files and directories
+vector<string> SplitInputs(const string &list);
+
+// Extension of the atlas textures for the current --texture option
+string TextureExtension();
+
+// Lists the .png and .qoi images of the inputs, images in directories are named by their relative path
+void FindImages(const vector<string> &inputs, const string &prefix, vector<ImageFile> &images);
+
+// Removes the metadata and textures of a previous packing
+void RemoveAtlasFiles(const string &outputName);
+
+// Packs the bitmaps into as many pages as needed, the packers don't own the bitmaps.
+// Returns false with the error if a bitmap doesn't fit into an empty page
+bool PackBitmaps(vector<Bitmap *> bitmaps, const string &name, vector<Packer *> &packers, string &error);
+
+// Returns false if the texture couldn't be saved, the error is already printed
+bool SaveTexture(Packer &packer, const string &file);
+
+// The formatted metadata files of a packed atlas, only the enabled formats are filled
+struct AtlasMetadata
+{
+    Buffer bin;
+    Buffer xml;
+    Buffer json;
+};
+
+// Formats the enabled .bin, .xml and .json files of a packed atlas, in split mode
+// the sub-atlas files are formatted without headers and the sections are kept for the merge
+void FormatMetadata(const vector<Packer *> &packers, const string &name, bool noZero, AtlasMetadata &metadata,
+                    SplitSection *section);
+
+// Writes the enabled .bin, .xml and .json files of a packed atlas, in split mode
+// the sub-atlas files are written without headers and the sections are kept for the merge
+void SaveMetadata(const vector<Packer *> &packers, const string &outputName, const string &name, bool noZero,
+                  SplitSection *section);
+
+// Packs one atlas (or one subdirectory of a split atlas, named with the prefix) unless its hash is unchanged.
+// Bitmaps are loaded through the cache if there is one, returns EXIT_SKIPPED if the atlas is unchanged
+int PackAtlas(uint64_t newHash, const string &outputDirectory, const string &name, const vector<string> &inputs,
+              const string &prefix, SplitSection *section, DecodeCache *cache);
+
+// Packs the atlas of one crunch command line with the current options, in split mode
+// every subdirectory is packed on its own and the results are merged. Returns EXIT_SKIPPED if nothing changed
+int CrunchAtlas(uint64_t newHash, const string &output, const vector<string> &inputs, DecodeCache *cache);
+
+#endif
@@ -0,0 +1,218 @@
+#include "pixelcache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.hpp"
+#include "mapped.hpp"
+#include "options.hpp"
+#include "qoi.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Bump when the header or the way the pixels are made changes, older files are then decoded again
+const uint32_t cacheVersion = 1;
+
+// Start of a cache file, the qoi bytes of the pixels follow it
+struct CacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key[2];
+    int32_t width;
+    int32_t height;
+    int32_t frameX;
+    int32_t frameY;
+    int32_t frameW;
+    int32_t frameH;
+    uint64_t hashValue;
+    uint64_t size;
+    // Hash of the qoi bytes, a damaged file could still decode
+    uint64_t check;
+};
+
+// Two independent hashes of the contents, seeded with everything else that changes the pixels
+static void CacheKey(const string &file, const uint8_t *bytes, size_t size, uint64_t key[2])
+{
+    uint64_t flags = (options.premultiply ? 1 : 0) | (options.trim ? 2 : 0) | (file.ends_with(".qoi") ? 4 : 0);
+    key[0] = HashBytes(bytes, size, flags);
+    key[1] = HashBytes(bytes, size, flags | 0x8000000000000000ull);
+}
+
+static string CachePath(const uint64_t key[2])
+{
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx%016llx.px", static_cast<unsigned long long>(key[0]),
+             static_cast<unsigned long long>(key[1]));
+    return (fs::path(options.cache) / name).string();
+}
+
+// Returns nullptr if there's no usable file for the key
+static Bitmap *LoadCached(const string &path, const uint64_t key[2], const string &name)
+{
+    MappedFile input(path);
+    if (!input.loaded || input.size < sizeof(CacheHeader))
+        return nullptr;
+
+    CacheHeader header;
+    memcpy(&header, input.data, sizeof(header));
+    if (memcmp(header.magic, "crpc", 4) != 0 || header.version != cacheVersion || header.key[0] != key[0] ||
+        header.key[1] != key[1] || header.size != input.size - sizeof(header) ||
+        header.check != HashBytes(input.data + sizeof(header), header.size, cacheVersion))
+        return nullptr;
+
+    uint8_t *pixels;
+    int width, height;
+    if (!QoiDecode(input.data + sizeof(header), header.size, &pixels, width, height))
+        return nullptr;
+    if (width != header.width || height != header.height)
+    {
+        free(pixels);
+        return nullptr;
+    }
+
+    // The modification time tells PruneCache when the file was last used
+    error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+
+    AddBytesRead(input.size);
+    return new Bitmap(reinterpret_cast<uint32_t *>(pixels), width, height, header.frameX, header.frameY,
+                      header.frameW, header.frameH, header.hashValue, name);
+}
+
+// Bytes added to every cache directory since it was last pruned, the jobs of a batch can each have their
+// own --cache and --cachesize
+static unordered_map<string, int64_t> addedBytes;
+static mutex pruneMutex;
+
+// Removes the least recently used files until the directory is within --cachesize. The directory is
+// listed on the first file a run adds to it and then whenever a tenth of the size was added
+static void PruneCache(size_t added)
+{
+    int64_t limit = static_cast<int64_t>(options.cacheSize) * 1024 * 1024;
+    string directory = fs::absolute(options.cache).lexically_normal().string();
+
+    lock_guard<mutex> lock(pruneMutex);
+    auto found = addedBytes.find(directory);
+    if (found != addedBytes.end() && (found->second += static_cast<int64_t>(added)) < limit / 10)
+        return;
+    addedBytes[directory] = 0;
+
+    struct CacheFile
+    {
+        fs::path path;
+        fs::file_time_type time;
+        int64_t size;
+    };
+    vector<CacheFile> files;
+    int64_t total = 0;
+    error_code error;
+    for (fs::directory_iterator it(options.cache, error), end; !error && it != end; it.increment(error))
+    {
+        if (it->path().extension() != ".px")
+            continue;
+        error_code fileError;
+        auto size = it->file_size(fileError);
+        auto time = it->last_write_time(fileError);
+        if (fileError)
+            continue;
+        files.push_back({it->path(), time, static_cast<int64_t>(size)});
+        total += static_cast<int64_t>(size);
+    }
+    if (total <= limit)
+        return;
+
+    sort(files.begin(), files.end(), [](const CacheFile &a, const CacheFile &b) { return a.time < b.time; });
+    for (auto &file : files)
+    {
+        if (total <= limit)
+            break;
+        if (fs::remove(file.path, error))
+            total -= file.size;
+    }
+}
+
+// The cache only saves time, so files that can't be written are skipped
+static void SaveCached(const string &path, const uint64_t key[2], const Bitmap &bitmap)
+{
+    PhaseTimer timer(Phase::Write);
+    CacheHeader header = {{'c', 'r', 'p', 'c'}, cacheVersion, {key[0], key[1]}, bitmap.width, bitmap.height,
+                          bitmap.frameX, bitmap.frameY, bitmap.frameW, bitmap.frameH, bitmap.hashValue, 0, 0};
+    vector<uint8_t> qoi;
+    QoiEncode(reinterpret_cast<const uint8_t *>(bitmap.data), bitmap.width, bitmap.height, qoi);
+    header.size = qoi.size();
+    header.check = HashBytes(qoi.data(), qoi.size(), cacheVersion);
+
+    // Written under a name of its own and then renamed, so no run ever sees a partial file
+    error_code error;
+    fs::create_directories(options.cache, error);
+    string temp = path + '.' + to_string(hash<thread::id>{}(this_thread::get_id()) ^
+                                         chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    {
+        ofstream stream(temp, ios::binary);
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char *>(qoi.data()), qoi.size());
+        stream.close();
+        if (!stream)
+        {
+            fs::remove(temp, error);
+            return;
+        }
+    }
+    fs::rename(temp, path, error);
+    if (error)
+    {
+        fs::remove(temp, error);
+        return;
+    }
+    AddBytesWritten(sizeof(header) + qoi.size());
+    PruneCache(sizeof(header) + qoi.size());
+}
+
+Bitmap *DecodeBitmap(const string &file, const uint8_t *bytes, size_t size, const string &name, string &error)
+{
+    if (options.cache.empty())
+        return Bitmap::Decode(file, bytes, size, name, options.premultiply, options.trim, error);
+
+    uint64_t key[2];
+    string path;
+    {
+        TraceSpan span("LoadCached", file);
+        PhaseTimer timer(Phase::Decode);
+        CacheKey(file, bytes, size, key);
+        path = CachePath(key);
+        if (Bitmap *bitmap = LoadCached(path, key, name))
+            return bitmap;
+    }
+
+    auto bitmap = Bitmap::Decode(file, bytes, size, name, options.premultiply, options.trim, error);
+    if (bitmap)
+        SaveCached(path, key, *bitmap);
+    return bitmap;
+}
+
+Bitmap *DecodeBitmap(const string &file, const string &name, string &error)
+{
+    if (options.cache.empty())
+        return Bitmap::Decode(file, name, options.premultiply, options.trim, error);
+
+    MappedFile input(file);
+    if (!input.loaded)
+    {
+        error = FailedToLoad(file);
+        return nullptr;
+    }
+    AddBytesRead(input.size);
+    return DecodeBitmap(file, input.data, input.size, name, error);
+}
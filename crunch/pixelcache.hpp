@@ -0,0 +1,23 @@
+#ifndef pixelcache_hpp
+#define pixelcache_hpp
+
+#include <cstdint>
+#include <string>
+
+#include "bitmap.hpp"
+
+using namespace std;
+
+// Decoded images are kept between runs in the --cache directory, one file per image named by a hash of the
+// file contents and the premultiply and trim options. The file holds the trimmed pixels compressed as qoi
+// with their frame, so images shared by runs and atlases are only inflated once
+
+// Returns a new bitmap of the image, loaded from the cache if it has the bytes of the file, otherwise
+// decoded and added to the cache. Without --cache the image is only decoded. Returns nullptr with the
+// error if the image can't be decoded
+Bitmap *DecodeBitmap(const string &file, const uint8_t *bytes, size_t size, const string &name, string &error);
+
+// The same for an image that wasn't read yet, or can't be read
+Bitmap *DecodeBitmap(const string &file, const string &name, string &error);
+
+#endif
@@ -0,0 +1,222 @@
+#include "qoi.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+// Implements the QOI format specification 1.0 (https://qoiformat.org)
+
+static const uint8_t QOI_OP_INDEX = 0x00, QOI_OP_DIFF = 0x40, QOI_OP_LUMA = 0x80, QOI_OP_RUN = 0xc0,
+                     QOI_OP_RGB = 0xfe, QOI_OP_RGBA = 0xff, QOI_MASK_2 = 0xc0;
+static const uint8_t qoiPadding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+static const int qoiHeaderSize = 14;
+static const uint64_t qoiPixelsMax = 400000000;
+
+static inline int QoiHash(const uint8_t *px)
+{
+    return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+static inline uint32_t ReadU32BE(const uint8_t *data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static inline void WriteU32BE(vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back((value >> 16) & 0xff);
+    out.push_back((value >> 8) & 0xff);
+    out.push_back(value & 0xff);
+}
+
+bool QoiDecode(const uint8_t *data, size_t size, uint8_t **pixels, int &width, int &height)
+{
+    if (size < qoiHeaderSize + sizeof(qoiPadding) || memcmp(data, "qoif", 4) != 0)
+        return false;
+
+    uint32_t w = ReadU32BE(data + 4), h = ReadU32BE(data + 8);
+    uint8_t channels = data[12];
+    if (w == 0 || h == 0 || static_cast<uint64_t>(w) * h > qoiPixelsMax || (channels != 3 && channels != 4))
+        return false;
+
+    size_t count = static_cast<size_t>(w) * h;
+    uint8_t *out = reinterpret_cast<uint8_t *>(malloc(count * 4));
+    if (!out)
+        return false;
+
+    uint8_t index[64 * 4] = {};
+    uint8_t px[4] = {0, 0, 0, 255};
+    size_t p = qoiHeaderSize, end = size - sizeof(qoiPadding);
+    int run = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (run > 0)
+            --run;
+        else if (p < end)
+        {
+            uint8_t b1 = data[p++];
+            if (b1 == QOI_OP_RGB)
+            {
+                if (p + 3 > end)
+                {
+                    free(out);
+                    return false;
+                }
+                memcpy(px, data + p, 3);
+                p += 3;
+            }
+            else if (b1 == QOI_OP_RGBA)
+            {
+                if (p + 4 > end)
+                {
+                    free(out);
+                    return false;
+                }
+                memcpy(px, data + p, 4);
+                p += 4;
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+                memcpy(px, index + b1 * 4, 4);
+            else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+            {
+                px[0] += ((b1 >> 4) & 0x03) - 2;
+                px[1] += ((b1 >> 2) & 0x03) - 2;
+                px[2] += (b1 & 0x03) - 2;
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+            {
+                if (p + 1 > end)
+                {
+                    free(out);
+                    return false;
+                }
+                uint8_t b2 = data[p++];
+                int vg = (b1 & 0x3f) - 32;
+                px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                px[1] += vg;
+                px[2] += vg - 8 + (b2 & 0x0f);
+            }
+            else
+                run = b1 & 0x3f;
+
+            memcpy(index + QoiHash(px) * 4, px, 4);
+        }
+        memcpy(out + i * 4, px, 4);
+    }
+
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+    *pixels = out;
+    return true;
+}
+
+bool QoiDecodeFile(const string &file, uint8_t **pixels, int &width, int &height)
+{
+    ifstream stream(file, ios::binary | ios::ate);
+    if (!stream)
+        return false;
+
+    streamsize size = stream.tellg();
+    stream.seekg(0, ios::beg);
+    vector<uint8_t> buffer(size);
+    if (!stream.read(reinterpret_cast<char *>(buffer.data()), size))
+        return false;
+
+    return QoiDecode(buffer.data(), buffer.size(), pixels, width, height);
+}
+
+QoiEncoder::QoiEncoder(int width, int height, vector<uint8_t> &out)
+    : remaining(static_cast<size_t>(width) * height)
+{
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    WriteU32BE(out, width);
+    WriteU32BE(out, height);
+    out.push_back(4);
+    out.push_back(0);
+}
+
+void QoiEncoder::Encode(const uint8_t *pixels, size_t count, vector<uint8_t> &out)
+{
+    for (size_t i = 0; i < count; ++i, --remaining)
+    {
+        const uint8_t *px = pixels + i * 4;
+
+        if (memcmp(px, prev, 4) == 0)
+        {
+            ++run;
+            if (run == 62 || remaining == 1)
+            {
+                out.push_back(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0)
+        {
+            out.push_back(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        int hash = QoiHash(px);
+        if (memcmp(index + hash * 4, px, 4) == 0)
+            out.push_back(QOI_OP_INDEX | hash);
+        else
+        {
+            memcpy(index + hash * 4, px, 4);
+
+            if (px[3] == prev[3])
+            {
+                int8_t vr = static_cast<int8_t>(px[0] - prev[0]);
+                int8_t vg = static_cast<int8_t>(px[1] - prev[1]);
+                int8_t vb = static_cast<int8_t>(px[2] - prev[2]);
+                int8_t vgr = vr - vg, vgb = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                    out.push_back(QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                {
+                    out.push_back(QOI_OP_LUMA | (vg + 32));
+                    out.push_back(((vgr + 8) << 4) | (vgb + 8));
+                }
+                else
+                {
+                    out.push_back(QOI_OP_RGB);
+                    out.insert(out.end(), px, px + 3);
+                }
+            }
+            else
+            {
+                out.push_back(QOI_OP_RGBA);
+                out.insert(out.end(), px, px + 4);
+            }
+        }
+        memcpy(prev, px, 4);
+    }
+
+    if (remaining == 0)
+        out.insert(out.end(), qoiPadding, qoiPadding + sizeof(qoiPadding));
+}
+
+void QoiEncode(const uint8_t *pixels, int width, int height, vector<uint8_t> &out)
+{
+    size_t count = static_cast<size_t>(width) * height;
+    out.clear();
+    out.reserve(qoiHeaderSize + count * 5 / 2 + sizeof(qoiPadding));
+
+    QoiEncoder encoder(width, height, out);
+    encoder.Encode(pixels, count, out);
+}
+
+bool QoiEncodeFile(const string &file, const uint8_t *pixels, int width, int height)
+{
+    vector<uint8_t> data;
+    QoiEncode(pixels, width, height, data);
+
+    ofstream stream(file, ios::binary);
+    return static_cast<bool>(stream.write(reinterpret_cast<const char *>(data.data()), data.size()));
+}
@@ -0,0 +1,34 @@
+#ifndef qoi_hpp
+#define qoi_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Decodes a 3 or 4 channel QOI image to RGBA8, the pixels are allocated with malloc
+bool QoiDecode(const uint8_t *data, size_t size, uint8_t **pixels, int &width, int &height);
+bool QoiDecodeFile(const string &file, uint8_t **pixels, int &width, int &height);
+
+// Encodes RGBA8 pixels as a 4 channel QOI image a few rows at a time. The header is added to out on
+// construction and each Encode call appends the bytes of the next pixels, the end of the file comes with
+// the last pixel
+struct QoiEncoder
+{
+    QoiEncoder(int width, int height, vector<uint8_t> &out);
+    void Encode(const uint8_t *pixels, size_t count, vector<uint8_t> &out);
+
+private:
+    uint8_t index[64 * 4] = {};
+    uint8_t prev[4] = {0, 0, 0, 255};
+    int run = 0;
+    size_t remaining;
+};
+
+// Encodes RGBA8 pixels as a 4 channel QOI image
+void QoiEncode(const uint8_t *pixels, int width, int height, vector<uint8_t> &out);
+bool QoiEncodeFile(const string &file, const uint8_t *pixels, int width, int height);
+
+#endif
@@ -0,0 +1,588 @@
+#include "quantize.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+
+#include "third_party/lodepng.h"
+#include "parallel.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CRUNCH_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Rows quantized as one piece of work
+const int quantizeBandRows = 64;
+
+// Colors are grouped by their 4 highest bits per channel for the median cut, and by their 5 highest bits for
+// looking up the nearest palette color
+const int cutBits = 4;
+const int lookupBits = 5;
+const int lookupCells = 1 << (lookupBits * 4);
+
+// Lookup cells whose nearest colors are found as one piece of work
+const int lookupChunk = 4096;
+
+// 4x4 Bayer matrix, 0 to 15
+static const int bayer[16] = {0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5};
+
+// Bits and position of the red, green, blue and alpha fields of a 16 bit format
+struct PixelLayout
+{
+    int bits[4];
+    int shift[4];
+};
+
+static PixelLayout GetLayout(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGBA4444:
+        return {{4, 4, 4, 4}, {8, 4, 0, 12}};
+    case PixelFormat::RGB565:
+        return {{5, 6, 5, 0}, {11, 5, 0, 0}};
+    default:
+        return {{5, 5, 5, 1}, {10, 5, 0, 15}};
+    }
+}
+
+// Threshold added before dividing by 255, the middle for rounding or a step of the Bayer matrix
+static int Threshold(Dither dither, int x, int y)
+{
+    return dither == Dither::Ordered ? bayer[(y & 3) * 4 + (x & 3)] * 16 + 8 : 127;
+}
+
+static uint16_t QuantizePixel(uint32_t pixel, const PixelLayout &layout, bool premultiplied, int threshold)
+{
+    int q[4];
+    for (int c = 0; c < 4; ++c)
+        q[c] = (((pixel >> (c * 8)) & 0xff) * ((1 << layout.bits[c]) - 1) + threshold) / 255;
+    if (premultiplied && layout.bits[3] != 0 && q[3] == 0)
+        return 0;
+    uint32_t out = 0;
+    for (int c = 0; c < 4; ++c)
+        out |= q[c] << layout.shift[c];
+    return static_cast<uint16_t>(out);
+}
+
+static void QuantizeRow(const uint32_t *row, int width, int y, const PixelLayout &layout, bool premultiplied,
+                        Dither dither, uint16_t *out)
+{
+    int x = 0;
+#ifdef CRUNCH_SSE2
+    // 2 pixels of 4 16 bit channels per register: v * max + threshold, divided by 255 as (t + 1 + (t >> 8)) >> 8
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    int m[4], s[4];
+    for (int c = 0; c < 4; ++c)
+    {
+        m[c] = (1 << layout.bits[c]) - 1;
+        s[c] = layout.bits[c] != 0 ? 1 << layout.shift[c] : 0;
+    }
+    const __m128i scale = _mm_setr_epi16(m[0], m[1], m[2], m[3], m[0], m[1], m[2], m[3]);
+    const __m128i place = _mm_setr_epi16(s[0], s[1], s[2], s[3], s[0], s[1], s[2], s[3]);
+    const __m128i low16 = _mm_set1_epi32(0xffff);
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    bool clearTransparent = premultiplied && layout.bits[3] != 0;
+    __m128i thresholds[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        short a = static_cast<short>(Threshold(dither, i * 2, y)), b = static_cast<short>(Threshold(dither, i * 2 + 1, y));
+        thresholds[i] = _mm_setr_epi16(a, a, a, a, b, b, b, b);
+    }
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        __m128i packed[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(i == 0 ? _mm_unpacklo_epi8(v, zero) : _mm_unpackhi_epi8(v, zero), scale),
+                                      thresholds[i]);
+            __m128i q = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, one), _mm_srli_epi16(t, 8)), 8);
+            if (clearTransparent)
+            {
+                __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(q, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+                q = _mm_andnot_si128(_mm_cmpeq_epi16(alpha, zero), q);
+            }
+
+            // The fields don't overlap, so adding the shifted channels of a pixel is the same as or-ing them,
+            // and the low 16 bits of the sums are right even where madd sees them as negative
+            __m128i sums = _mm_madd_epi16(_mm_mullo_epi16(q, place), one);
+            sums = _mm_add_epi32(sums, _mm_srli_epi64(sums, 32));
+            packed[i] = _mm_and_si128(_mm_shuffle_epi32(sums, _MM_SHUFFLE(3, 1, 2, 0)), low16);
+        }
+        __m128i pixels = _mm_unpacklo_epi64(packed[0], packed[1]);
+        pixels = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(pixels, bias32), zero), bias16);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x), pixels);
+    }
+#endif
+    for (; x < width; ++x)
+        out[x] = QuantizePixel(row[x], layout, premultiplied, Threshold(dither, x, y));
+}
+
+// Floyd-Steinberg error diffusion, one row after the other. Alpha that is exactly 0 or 255 stays that way,
+// so the edges of the images don't get noisy
+static void DiffuseQuantize(const uint32_t *pixels, int width, int height, const PixelLayout &layout,
+                            bool premultiplied, uint16_t *out)
+{
+    // Errors in 16ths, with a pixel on each side so the neighbours never need a check
+    vector<int> current((width + 2) * 4, 0), next((width + 2) * 4, 0);
+    for (int y = 0; y < height; ++y)
+    {
+        const uint32_t *row = pixels + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; ++x)
+        {
+            int source[4], value[4], q[4];
+            for (int c = 0; c < 4; ++c)
+                source[c] = (row[x] >> (c * 8)) & 0xff;
+            bool exactAlpha = source[3] == 0 || source[3] == 255;
+            for (int c = 0; c < 4; ++c)
+            {
+                int error = current[(x + 1) * 4 + c];
+                value[c] = c == 3 && exactAlpha ? source[c] : clamp(source[c] + (error + (error >= 0 ? 8 : -8)) / 16, 0, 255);
+                q[c] = (value[c] * ((1 << layout.bits[c]) - 1) + 127) / 255;
+            }
+            if (premultiplied && layout.bits[3] != 0 && q[3] == 0)
+                q[0] = q[1] = q[2] = 0;
+
+            uint32_t packed = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                int max = (1 << layout.bits[c]) - 1;
+                packed |= q[c] << layout.shift[c];
+                if (max == 0 || (c == 3 && exactAlpha))
+                    continue;
+                int error = value[c] - (q[c] * 255 + max / 2) / max;
+                current[(x + 2) * 4 + c] += error * 7;
+                next[x * 4 + c] += error * 3;
+                next[(x + 1) * 4 + c] += error * 5;
+                next[(x + 2) * 4 + c] += error;
+            }
+            out[static_cast<size_t>(y) * width + x] = static_cast<uint16_t>(packed);
+        }
+        swap(current, next);
+        fill(next.begin(), next.end(), 0);
+    }
+}
+
+void QuantizePixels(const uint32_t *pixels, int width, int height, PixelFormat format, bool premultiplied,
+                    Dither dither, vector<uint8_t> &out)
+{
+    out.resize(static_cast<size_t>(width) * height * 2);
+    auto dest = reinterpret_cast<uint16_t *>(out.data());
+    PixelLayout layout = GetLayout(format);
+    if (dither == Dither::Diffusion)
+    {
+        DiffuseQuantize(pixels, width, height, layout, premultiplied, dest);
+        return;
+    }
+
+    int bands = (height + quantizeBandRows - 1) / quantizeBandRows;
+    ParallelFor(bands, [&](int band)
+    {
+        for (int y = band * quantizeBandRows, end = min(height, y + quantizeBandRows); y < end; ++y)
+            QuantizeRow(pixels + static_cast<size_t>(y) * width, width, y, layout, premultiplied, dither,
+                        dest + static_cast<size_t>(y) * width);
+    });
+}
+
+// ================================================================
+// Palettes
+// ================================================================
+
+// Key of the cell a color is in, with the highest bits of each channel
+static int CellKey(uint32_t color, int bits)
+{
+    int key = 0;
+    for (int c = 0; c < 4; ++c)
+        key |= (((color >> (c * 8)) & 0xff) >> (8 - bits)) << (c * bits);
+    return key;
+}
+
+// Colors of the histogram that share a key
+struct ColorCell
+{
+    uint32_t count;
+    uint64_t sum[4];
+    int mean[4];
+};
+
+// A range of cells that becomes one color of the palette
+struct ColorBox
+{
+    int begin;
+    int end;
+    uint64_t count;
+    int axis;
+    int range;
+};
+
+static ColorBox MakeBox(const vector<ColorCell> &cells, int begin, int end)
+{
+    ColorBox box{begin, end, 0, 0, 0};
+    int low[4] = {255, 255, 255, 255}, high[4] = {0, 0, 0, 0};
+    for (int i = begin; i < end; ++i)
+    {
+        box.count += cells[i].count;
+        for (int c = 0; c < 4; ++c)
+        {
+            low[c] = min(low[c], cells[i].mean[c]);
+            high[c] = max(high[c], cells[i].mean[c]);
+        }
+    }
+    for (int c = 0; c < 4; ++c)
+    {
+        if (high[c] - low[c] > box.range)
+        {
+            box.range = high[c] - low[c];
+            box.axis = c;
+        }
+    }
+    return box;
+}
+
+// Splits the box that covers the most pixels over the widest range at the median of its widest channel
+// until there are enough colors or every box is a single cell
+static vector<uint32_t> MedianCut(vector<ColorCell> &cells, int maxColors)
+{
+    vector<ColorBox> boxes = {MakeBox(cells, 0, static_cast<int>(cells.size()))};
+    while (static_cast<int>(boxes.size()) < maxColors)
+    {
+        int best = -1;
+        uint64_t bestScore = 0;
+        for (int i = 0, j = static_cast<int>(boxes.size()); i < j; ++i)
+        {
+            uint64_t score = boxes[i].count * boxes[i].range;
+            if (boxes[i].end - boxes[i].begin > 1 && score > bestScore)
+            {
+                best = i;
+                bestScore = score;
+            }
+        }
+        if (best < 0)
+            break;
+
+        ColorBox box = boxes[best];
+        int axis = box.axis;
+        sort(cells.begin() + box.begin, cells.begin() + box.end, [axis](const ColorCell &a, const ColorCell &b)
+        {
+            return a.mean[axis] < b.mean[axis];
+        });
+        int split = box.begin + 1;
+        for (uint64_t count = cells[box.begin].count; split < box.end - 1 && count * 2 < box.count; ++split)
+            count += cells[split].count;
+        boxes[best] = MakeBox(cells, box.begin, split);
+        boxes.push_back(MakeBox(cells, split, box.end));
+    }
+
+    vector<uint32_t> palette;
+    for (auto &box : boxes)
+    {
+        uint64_t sum[4] = {0, 0, 0, 0};
+        for (int i = box.begin; i < box.end; ++i)
+            for (int c = 0; c < 4; ++c)
+                sum[c] += cells[i].sum[c];
+        uint32_t color = 0;
+        for (int c = 0; c < 4; ++c)
+            color |= static_cast<uint32_t>((sum[c] + box.count / 2) / box.count) << (c * 8);
+        palette.push_back(color);
+    }
+    return palette;
+}
+
+// Nearest palette colors by squared distance over all four channels, the lowest index on ties
+class PaletteSearch
+{
+public:
+    explicit PaletteSearch(const vector<uint32_t> &palette) : size(static_cast<int>(palette.size()))
+    {
+        // Padding entries are too far away to ever be picked
+        int padded = (size + 7) / 8 * 8;
+        for (int c = 0; c < 4; ++c)
+        {
+            channels[c].assign(padded, 1000);
+            for (int i = 0; i < size; ++i)
+                channels[c][i] = static_cast<int16_t>((palette[i] >> (c * 8)) & 0xff);
+        }
+    }
+
+    int Nearest(const int *color) const
+    {
+        int best = 0, bestDistance = INT_MAX;
+        int i = 0;
+#ifdef CRUNCH_SSE2
+        __m128i target[4];
+        for (int c = 0; c < 4; ++c)
+            target[c] = _mm_set1_epi16(static_cast<short>(color[c]));
+        __m128i bestDistances[2] = {_mm_set1_epi32(INT_MAX), _mm_set1_epi32(INT_MAX)};
+        __m128i bestIndices[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+        __m128i indices[2] = {_mm_setr_epi32(0, 1, 2, 3), _mm_setr_epi32(4, 5, 6, 7)};
+        const __m128i step = _mm_set1_epi32(8);
+        for (int j = static_cast<int>(channels[0].size()); i < j; i += 8)
+        {
+            __m128i d[4];
+            for (int c = 0; c < 4; ++c)
+                d[c] = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(channels[c].data() + i)), target[c]);
+            __m128i rg[2] = {_mm_unpacklo_epi16(d[0], d[1]), _mm_unpackhi_epi16(d[0], d[1])};
+            __m128i ba[2] = {_mm_unpacklo_epi16(d[2], d[3]), _mm_unpackhi_epi16(d[2], d[3])};
+            for (int k = 0; k < 2; ++k)
+            {
+                __m128i distance = _mm_add_epi32(_mm_madd_epi16(rg[k], rg[k]), _mm_madd_epi16(ba[k], ba[k]));
+                __m128i closer = _mm_cmplt_epi32(distance, bestDistances[k]);
+                bestDistances[k] = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, bestDistances[k]));
+                bestIndices[k] = _mm_or_si128(_mm_and_si128(closer, indices[k]), _mm_andnot_si128(closer, bestIndices[k]));
+                indices[k] = _mm_add_epi32(indices[k], step);
+            }
+        }
+
+        alignas(16) int32_t distances[8], found[8];
+        for (int k = 0; k < 2; ++k)
+        {
+            _mm_store_si128(reinterpret_cast<__m128i *>(distances + k * 4), bestDistances[k]);
+            _mm_store_si128(reinterpret_cast<__m128i *>(found + k * 4), bestIndices[k]);
+        }
+        for (int k = 0; k < 8; ++k)
+        {
+            if (distances[k] < bestDistance || (distances[k] == bestDistance && found[k] < best))
+            {
+                best = found[k];
+                bestDistance = distances[k];
+            }
+        }
+#endif
+        for (; i < size; ++i)
+        {
+            int distance = 0;
+            for (int c = 0; c < 4; ++c)
+                distance += (channels[c][i] - color[c]) * (channels[c][i] - color[c]);
+            if (distance < bestDistance)
+            {
+                best = i;
+                bestDistance = distance;
+            }
+        }
+        return best;
+    }
+
+private:
+    int size;
+    vector<int16_t> channels[4];
+};
+
+// Palettes of pages with at most 256 colors, in the order they're first seen with all the fully transparent
+// pixels as one color. False if there are more
+static bool ExactPalette(const uint32_t *pixels, size_t count, vector<uint32_t> &palette,
+                         unordered_map<uint32_t, uint8_t> &lookup)
+{
+    uint32_t last = 0;
+    bool any = false;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t color = (pixels[i] >> 24) == 0 ? 0 : pixels[i];
+        if (any && color == last)
+            continue;
+        any = true;
+        last = color;
+        if (lookup.find(color) != lookup.end())
+            continue;
+        if (palette.size() == 256)
+            return false;
+        lookup.emplace(color, static_cast<uint8_t>(palette.size()));
+        palette.push_back(color);
+    }
+    return true;
+}
+
+// The color a pixel is looked up as with ordered dithering, only the color channels are dithered
+static uint32_t OrderedColor(uint32_t pixel, int x, int y)
+{
+    int offset = bayer[(y & 3) * 4 + (x & 3)] - 8;
+    uint32_t color = pixel & 0xff000000;
+    for (int c = 0; c < 3; ++c)
+        color |= clamp(static_cast<int>((pixel >> (c * 8)) & 0xff) + offset, 0, 255) << (c * 8);
+    return color;
+}
+
+void PalettizePixels(const uint32_t *pixels, int width, int height, Dither dither, vector<uint32_t> &palette,
+                     vector<uint8_t> &indices)
+{
+    size_t count = static_cast<size_t>(width) * height;
+    int bands = (height + quantizeBandRows - 1) / quantizeBandRows;
+    indices.resize(count);
+    palette.clear();
+
+    unordered_map<uint32_t, uint8_t> lookup;
+    if (ExactPalette(pixels, count, palette, lookup))
+    {
+        ParallelFor(bands, [&](int band)
+        {
+            size_t begin = static_cast<size_t>(band) * quantizeBandRows * width;
+            size_t end = min(count, begin + static_cast<size_t>(quantizeBandRows) * width);
+            for (size_t i = begin; i < end; ++i)
+                indices[i] = lookup.find((pixels[i] >> 24) == 0 ? 0 : pixels[i])->second;
+        });
+        return;
+    }
+    palette.clear();
+
+    // Histogram for the median cut, and the lookup cells the pixels fall in when they aren't dithered
+    vector<ColorCell> histogram(1 << (cutBits * 4));
+    vector<uint8_t> used(lookupCells, 0);
+    bool transparent = false;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t p = pixels[i];
+        if ((p >> 24) == 0)
+        {
+            transparent = true;
+            continue;
+        }
+        auto &cell = histogram[CellKey(p, cutBits)];
+        ++cell.count;
+        for (int c = 0; c < 4; ++c)
+            cell.sum[c] += (p >> (c * 8)) & 0xff;
+        used[CellKey(p, lookupBits)] = 1;
+    }
+    vector<ColorCell> cells;
+    for (auto &cell : histogram)
+    {
+        if (cell.count == 0)
+            continue;
+        for (int c = 0; c < 4; ++c)
+            cell.mean[c] = static_cast<int>((cell.sum[c] + cell.count / 2) / cell.count);
+        cells.push_back(cell);
+    }
+    if (transparent)
+        palette.push_back(0);
+    for (uint32_t color : MedianCut(cells, transparent ? 255 : 256))
+        palette.push_back(color);
+
+    // Nearest color to the middle of a lookup cell, or to full alpha in the most opaque cells so opaque pixels
+    // don't pick up a bit of transparency
+    PaletteSearch search(palette);
+    vector<int16_t> nearest(lookupCells, -1);
+    auto findNearest = [&](int key)
+    {
+        const int mask = (1 << lookupBits) - 1;
+        int middle[4];
+        for (int c = 0; c < 4; ++c)
+            middle[c] = ((key >> (c * lookupBits)) & mask) << (8 - lookupBits) | (1 << (7 - lookupBits));
+        if (((key >> (3 * lookupBits)) & mask) == mask)
+            middle[3] = 255;
+        return static_cast<int16_t>(search.Nearest(middle));
+    };
+
+    if (dither != Dither::Diffusion)
+    {
+        // Dithered pixels move to other cells, which are only known after dithering them
+        if (dither == Dither::Ordered)
+        {
+            fill(used.begin(), used.end(), 0);
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < width; ++x)
+                {
+                    uint32_t p = pixels[static_cast<size_t>(y) * width + x];
+                    if ((p >> 24) != 0)
+                        used[CellKey(OrderedColor(p, x, y), lookupBits)] = 1;
+                }
+        }
+        ParallelFor(lookupCells / lookupChunk, [&](int chunk)
+        {
+            for (int key = chunk * lookupChunk, end = key + lookupChunk; key < end; ++key)
+                if (used[key])
+                    nearest[key] = findNearest(key);
+        });
+
+        ParallelFor(bands, [&](int band)
+        {
+            for (int y = band * quantizeBandRows, end = min(height, y + quantizeBandRows); y < end; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    size_t i = static_cast<size_t>(y) * width + x;
+                    uint32_t p = pixels[i];
+                    if ((p >> 24) == 0)
+                        indices[i] = 0;
+                    else
+                        indices[i] = static_cast<uint8_t>(nearest[CellKey(dither == Dither::Ordered ? OrderedColor(p, x, y) : p, lookupBits)]);
+                }
+            }
+        });
+        return;
+    }
+
+    // Floyd-Steinberg like the 16 bit formats, transparent pixels stay transparent and don't pass errors on.
+    // Errors can move colors anywhere, so the nearest colors are found as they're needed
+    vector<int> current((width + 2) * 4, 0), next((width + 2) * 4, 0);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            size_t i = static_cast<size_t>(y) * width + x;
+            uint32_t p = pixels[i];
+            if ((p >> 24) == 0)
+            {
+                indices[i] = 0;
+                continue;
+            }
+            int color[4];
+            uint32_t dithered = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                int source = (p >> (c * 8)) & 0xff, error = current[(x + 1) * 4 + c];
+                color[c] = c == 3 && source == 255 ? source : clamp(source + (error + (error >= 0 ? 8 : -8)) / 16, 0, 255);
+                dithered |= static_cast<uint32_t>(color[c]) << (c * 8);
+            }
+            int key = CellKey(dithered, lookupBits);
+            if (nearest[key] < 0)
+                nearest[key] = findNearest(key);
+            int index = nearest[key];
+            indices[i] = static_cast<uint8_t>(index);
+            for (int c = 0; c < 4; ++c)
+            {
+                int error = color[c] - static_cast<int>((palette[index] >> (c * 8)) & 0xff);
+                current[(x + 2) * 4 + c] += error * 7;
+                next[x * 4 + c] += error * 3;
+                next[(x + 1) * 4 + c] += error * 5;
+                next[(x + 2) * 4 + c] += error;
+            }
+        }
+        swap(current, next);
+        fill(next.begin(), next.end(), 0);
+    }
+}
+
+bool EncodePalettePng(const uint32_t *pixels, int width, int height, Dither dither, vector<uint8_t> &png)
+{
+    vector<uint32_t> palette;
+    vector<uint8_t> indices;
+    PalettizePixels(pixels, width, height, dither, palette, indices);
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_PALETTE;
+    state.info_raw.bitdepth = 8;
+    state.info_png.color.colortype = LCT_PALETTE;
+    state.info_png.color.bitdepth = 8;
+    state.encoder.auto_convert = 0;
+    for (uint32_t color : palette)
+    {
+        uint8_t r = color & 0xff, g = (color >> 8) & 0xff, b = (color >> 16) & 0xff, a = color >> 24;
+        lodepng_palette_add(&state.info_raw, r, g, b, a);
+        lodepng_palette_add(&state.info_png.color, r, g, b, a);
+    }
+
+    unsigned char *data = nullptr;
+    size_t size = 0;
+    unsigned error = lodepng_encode(&data, &size, indices.data(), width, height, &state);
+    lodepng_state_cleanup(&state);
+    if (!error)
+        png.assign(data, data + size);
+    free(data);
+    return !error;
+}
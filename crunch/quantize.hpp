@@ -0,0 +1,25 @@
+#ifndef quantize_hpp
+#define quantize_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "options.hpp"
+
+using namespace std;
+
+// Packs RGBA8 pixels into one of the 16 bit formats, 2 little endian bytes per pixel: rgba4444 as A4R4G4B4,
+// rgb565 as R5G6B5 and rgba5551 as A1R5G5B5 (the highest bits first). Premultiplied pixels whose alpha
+// rounds to zero lose their color too
+void QuantizePixels(const uint32_t *pixels, int width, int height, PixelFormat format, bool premultiplied,
+                    Dither dither, vector<uint8_t> &out);
+
+// Reduces RGBA8 pixels to at most 256 colors, one index into the palette per pixel. Pages with few enough
+// colors keep them exactly, others get a median cut palette with index 0 for the fully transparent pixels
+void PalettizePixels(const uint32_t *pixels, int width, int height, Dither dither, vector<uint32_t> &palette,
+                     vector<uint8_t> &indices);
+
+// The bytes of an 8 bit palette .png file holding the pixels, false if lodepng fails
+bool EncodePalettePng(const uint32_t *pixels, int width, int height, Dither dither, vector<uint8_t> &png);
+
+#endif
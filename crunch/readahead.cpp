@@ -0,0 +1,401 @@
+#include "readahead.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CRUNCH_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "stats.hpp"
+#include "trace.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Reader threads without io_uring, enough to keep a few requests queued on the disk
+const int readerThreads = 4;
+
+#ifdef CRUNCH_IO_URING
+
+// Reads that io_uring keeps in flight at once
+const unsigned ringDepth = 16;
+
+// The submission and completion queues shared with the kernel, set up with the raw system calls
+struct ReadAhead::Ring
+{
+    int fd = -1;
+    void *queues = MAP_FAILED;
+    size_t queuesSize = 0;
+    void *completions = MAP_FAILED;
+    size_t completionsSize = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (completions != MAP_FAILED && completions != queues)
+            munmap(completions, completionsSize);
+        if (queues != MAP_FAILED)
+            munmap(queues, queuesSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Fails where the kernel is too old or io_uring is blocked, as it is in many containers
+    bool Setup()
+    {
+        io_uring_params params = {};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, ringDepth, &params));
+        if (fd < 0)
+            return false;
+
+        queuesSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        completionsSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            queuesSize = completionsSize = max(queuesSize, completionsSize);
+
+        queues = mmap(nullptr, queuesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (queues == MAP_FAILED)
+            return false;
+        completions = single ? queues : mmap(nullptr, completionsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (completions == MAP_FAILED)
+            return false;
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+
+        auto sq = static_cast<char *>(queues), cq = static_cast<char *>(completions);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void Read(int file, iovec *buffer, size_t offset, uint64_t slot)
+    {
+        unsigned tail = *sqTail;
+        unsigned position = tail & *sqMask;
+        io_uring_sqe &sqe = sqes[position];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = slot;
+        sqArray[position] = position;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Submits the queued reads and waits until at least one has finished
+    int Enter(unsigned submit)
+    {
+        int result;
+        do
+            result = static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        while (result < 0 && errno == EINTR);
+        return result;
+    }
+};
+
+#else
+
+struct ReadAhead::Ring
+{
+};
+
+#endif
+
+ReadAhead::ReadAhead(const vector<string> &files, size_t budget)
+    : files(files), budget(budget), callerOptions(options), entries(files.size())
+{
+    if (files.empty())
+        return;
+
+#ifdef CRUNCH_IO_URING
+    ring = make_unique<Ring>();
+    if (ring->Setup())
+    {
+        threads.emplace_back([this]()
+                             {
+            options = callerOptions;
+            RunRing(); });
+        return;
+    }
+    ring.reset();
+#endif
+
+    for (int i = 0; i < min(readerThreads, static_cast<int>(files.size())); ++i)
+        threads.emplace_back([this]()
+                             {
+            options = callerOptions;
+            ReadFiles(); });
+}
+
+ReadAhead::~ReadAhead()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+    }
+    changed.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+bool ReadAhead::Wait(int index, const uint8_t *&data, size_t &size)
+{
+    unique_lock<mutex> guard(lock);
+    auto &entry = entries[index];
+    changed.wait(guard, [&]()
+                 { return entry.state != State::Pending; });
+    data = entry.data;
+    size = entry.size;
+    bool success = entry.state == State::Read;
+    guard.unlock();
+
+    if (success)
+        AddBytesRead(size);
+    return success;
+}
+
+void ReadAhead::Release(int index)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        auto &entry = entries[index];
+        if (entry.state == State::Read)
+            reserved -= entry.size;
+        entry.bytes.reset();
+        entry.mapped.reset();
+        entry.data = nullptr;
+        entry.state = State::Released;
+    }
+    changed.notify_all();
+}
+
+// Takes the bytes of file i from the budget once every file before it has taken its own, so the files
+// the consumer needs first are never held up by later ones. Without waiting it gives up when the budget
+// is used up. Returns false if it gave up or the reads are stopping
+bool ReadAhead::Reserve(int index, size_t size, bool wait)
+{
+    unique_lock<mutex> guard(lock);
+    auto ready = [&]()
+    {
+        return granted == index && (reserved == 0 || reserved + size <= budget);
+    };
+    if (wait)
+        changed.wait(guard, [&]()
+                     { return stop || ready(); });
+    if (stop || !ready())
+        return false;
+
+    ++granted;
+    reserved += size;
+    entries[index].size = size;
+    return true;
+}
+
+void ReadAhead::Finish(int index, bool success)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        auto &entry = entries[index];
+        entry.state = success ? State::Read : State::Failed;
+        if (!success)
+        {
+            reserved -= entry.size;
+            entry.bytes.reset();
+            entry.mapped.reset();
+            entry.data = nullptr;
+            entry.size = 0;
+        }
+    }
+    changed.notify_all();
+}
+
+// Maps a large file instead of reading it, the pages are read in the background until they're used
+bool ReadAhead::Map(int index)
+{
+    auto &entry = entries[index];
+    entry.mapped = make_unique<MappedFile>(files[index], true);
+    entry.data = entry.mapped->data;
+    return entry.mapped->loaded && entry.mapped->size == entry.size;
+}
+
+// Blocking reads on a reader thread, the threads claim the files in order
+void ReadAhead::ReadFiles()
+{
+    while (true)
+    {
+        int index;
+        {
+            lock_guard<mutex> guard(lock);
+            if (stop || next >= static_cast<int>(files.size()))
+                return;
+            index = next++;
+        }
+
+        auto &file = files[index];
+        error_code error;
+        size_t size = static_cast<size_t>(fs::file_size(file, error));
+        if (error)
+            size = 0;
+        if (!Reserve(index, size, true))
+            return;
+
+        TraceSpan span("ReadAhead::Read", file);
+        bool success = false;
+        if (!error && size >= mapThreshold)
+            success = Map(index);
+        else if (FILE *stream = error ? nullptr : fopen(file.data(), "rb"))
+        {
+            auto &entry = entries[index];
+            entry.bytes.reset(new uint8_t[size]);
+            entry.data = entry.bytes.get();
+            success = fread(entry.bytes.get(), 1, size, stream) == size;
+            fclose(stream);
+        }
+        Finish(index, success);
+    }
+}
+
+#ifdef CRUNCH_IO_URING
+
+// Keeps up to ringDepth reads in flight on the ring, the large files are mapped instead. A read that
+// returns fewer bytes than asked is submitted again for the rest
+void ReadAhead::RunRing()
+{
+    TraceSpan span("ReadAhead::RunRing");
+
+    struct Read
+    {
+        int index = -1;
+        int file = -1;
+        size_t done = 0;
+        iovec buffer;
+    };
+    vector<Read> reads(ringDepth);
+    vector<int> freeSlots;
+    for (int i = ringDepth - 1; i >= 0; --i)
+        freeSlots.push_back(i);
+
+    int index = 0, count = static_cast<int>(files.size());
+    unsigned queued = 0;
+    while (true)
+    {
+        // Open files and queue their reads while there are free slots and the budget allows it. With
+        // nothing in flight this waits for the consumer to release something
+        while (index < count && !freeSlots.empty())
+        {
+            auto &file = files[index];
+            struct stat info;
+            bool regular = stat(file.data(), &info) == 0 && S_ISREG(info.st_mode);
+            size_t size = regular ? static_cast<size_t>(info.st_size) : 0;
+            if (!Reserve(index, size, freeSlots.size() == ringDepth))
+                break;
+
+            if (regular && size >= mapThreshold)
+            {
+                Finish(index, Map(index));
+                ++index;
+                continue;
+            }
+
+            int handle = regular ? open(file.data(), O_RDONLY | O_CLOEXEC) : -1;
+            if (handle < 0 || size == 0)
+            {
+                if (handle >= 0)
+                    close(handle);
+                Finish(index++, handle >= 0);
+                continue;
+            }
+
+            int slot = freeSlots.back();
+            freeSlots.pop_back();
+            auto &read = reads[slot];
+            auto &entry = entries[index];
+            entry.bytes.reset(new uint8_t[size]);
+            entry.data = entry.bytes.get();
+            read = {index, handle, 0, {entry.bytes.get(), size}};
+            ring->Read(handle, &read.buffer, 0, slot);
+            ++index;
+            ++queued;
+        }
+
+        if (freeSlots.size() == ringDepth)
+        {
+            // Nothing in flight, so either everything is read or the reads are stopping
+            lock_guard<mutex> guard(lock);
+            if (index >= count || stop)
+                return;
+            continue;
+        }
+
+        int submitted = ring->Enter(queued);
+        if (submitted < 0)
+        {
+            cerr << "failed to read files: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        queued -= submitted;
+
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            auto &completion = ring->cqes[head & *ring->cqMask];
+            int slot = static_cast<int>(completion.user_data);
+            auto &read = reads[slot];
+            size_t size = entries[read.index].size;
+            if (completion.res > 0 && read.done + completion.res < size)
+            {
+                read.done += completion.res;
+                read.buffer = {entries[read.index].bytes.get() + read.done, size - read.done};
+                ring->Read(read.file, &read.buffer, read.done, slot);
+                ++queued;
+                continue;
+            }
+
+            close(read.file);
+            Finish(read.index, completion.res >= 0 && read.done + completion.res == size);
+            freeSlots.push_back(slot);
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+#else
+
+void ReadAhead::RunRing()
+{
+}
+
+#endif
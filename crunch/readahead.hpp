@@ -0,0 +1,79 @@
+#ifndef readahead_hpp
+#define readahead_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapped.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+// Bytes of read files that a ReadAhead holds at most before they're released
+const size_t readAheadBudget = 64 << 20;
+
+// Reads files in order ahead of the code that uses them, so decoding and hashing don't wait for the disk.
+// Linux submits the reads to io_uring from a background thread, elsewhere (or where io_uring isn't allowed)
+// a few reader threads read with blocking calls. Files from mapThreshold on are mapped instead, and the
+// kernel is asked to read their pages in the background. At most the budget of bytes is held at once, a
+// file larger than the budget is still read when nothing else is held
+struct ReadAhead
+{
+    explicit ReadAhead(const vector<string> &files, size_t budget = readAheadBudget);
+    ~ReadAhead();
+    ReadAhead(const ReadAhead &) = delete;
+    ReadAhead &operator=(const ReadAhead &) = delete;
+
+    // Waits until file i is read, returns false if it couldn't be read
+    bool Wait(int index, const uint8_t *&data, size_t &size);
+
+    // Frees the bytes of file i, so the reads behind it can go on
+    void Release(int index);
+
+private:
+    enum class State : char
+    {
+        Pending,
+        Read,
+        Failed,
+        Released
+    };
+
+    struct Entry
+    {
+        unique_ptr<uint8_t[]> bytes;
+        unique_ptr<MappedFile> mapped;
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        State state = State::Pending;
+    };
+
+    struct Ring;
+
+    bool Reserve(int index, size_t size, bool wait);
+    void Finish(int index, bool success);
+    bool Map(int index);
+    void ReadFiles();
+    void RunRing();
+
+    vector<string> files;
+    size_t budget;
+    Options callerOptions;
+    unique_ptr<Ring> ring;
+    vector<Entry> entries;
+    mutex lock;
+    condition_variable changed;
+    size_t reserved = 0;
+    int granted = 0;
+    int next = 0;
+    bool stop = false;
+    vector<thread> threads;
+};
+
+#endif
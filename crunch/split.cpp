@@ -0,0 +1,417 @@
+#include "split.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#include "metadata.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+const int splitVersion = 1;
+
+enum SplitFormat
+{
+    SplitBin,
+    SplitXml,
+    SplitJson,
+    SplitFormatCount
+};
+
+static const char *splitFormatNames[SplitFormatCount] = {"bin", "xml", "json"};
+
+struct SplitEntry
+{
+    string name;
+    int textureCount = 0;
+    size_t offset[SplitFormatCount] = {};
+    size_t size[SplitFormatCount] = {};
+};
+
+// Text file: a "crunch-split" line, the argument hash, the merged file sizes and the entry count,
+// then one line per subdirectory with its texture count and byte ranges, the name last as it may contain spaces
+struct SplitManifest
+{
+    uint64_t hash = 0;
+    size_t fileSize[SplitFormatCount] = {};
+    vector<SplitEntry> entries;
+};
+
+static bool LoadManifest(const string &file, SplitManifest &manifest)
+{
+    ifstream stream(file);
+    string magic;
+    int version;
+    size_t count;
+    if (!(stream >> magic >> version) || magic != "crunch-split" || version != splitVersion)
+        return false;
+
+    stream >> manifest.hash;
+    for (size_t &size : manifest.fileSize)
+        stream >> size;
+    if (!(stream >> count))
+        return false;
+
+    manifest.entries.resize(count);
+    for (auto &entry : manifest.entries)
+    {
+        stream >> entry.textureCount;
+        for (int f = 0; f < SplitFormatCount; ++f)
+            stream >> entry.offset[f] >> entry.size[f];
+        stream.ignore(1);
+        getline(stream, entry.name);
+    }
+    return !stream.fail();
+}
+
+static void SaveManifest(const string &file, const SplitManifest &manifest)
+{
+    Buffer buffer;
+    buffer.data.reserve(64 + manifest.entries.size() * 96);
+    buffer << "crunch-split " << splitVersion << '\n';
+    buffer << manifest.hash;
+    for (size_t size : manifest.fileSize)
+        buffer << ' ' << size;
+    buffer << ' ' << manifest.entries.size() << '\n';
+    for (auto &entry : manifest.entries)
+    {
+        buffer << entry.textureCount;
+        for (int f = 0; f < SplitFormatCount; ++f)
+            buffer << ' ' << entry.offset[f] << ' ' << entry.size[f];
+        buffer << ' ' << entry.name << '\n';
+    }
+    SaveBuffer(buffer, file);
+}
+
+static bool ReadRange(const string &file, size_t offset, size_t size, Buffer &buffer)
+{
+    ifstream stream(file, ios::binary);
+    stream.seekg(offset);
+    size_t start = buffer.data.size();
+    buffer.data.resize(start + size);
+    AddBytesRead(size);
+    return static_cast<bool>(stream.read(buffer.data.data() + start, size));
+}
+
+static void PatchFile(const string &file, size_t offset, const Buffer &buffer)
+{
+    PhaseTimer timer(Phase::Write);
+    AddBytesWritten(buffer.data.size());
+    fstream stream(file, ios::in | ios::out | ios::binary);
+    stream.seekp(offset);
+    if (!stream.write(buffer.data.data(), buffer.data.size()))
+    {
+        cerr << "failed to save file: " << file << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void FailedToLoad(SplitFormat format, const string &file)
+{
+    cerr << "failed to load " << splitFormatNames[format] << ": " << file << endl;
+    exit(EXIT_FAILURE);
+}
+
+struct SplitMerge
+{
+    const string &outputName;
+    const string &subatlasName;
+    const vector<string> &subdirs;
+    const vector<SplitSection> &sections;
+    SplitManifest old;
+    SplitManifest manifest;
+    unordered_map<string, size_t> oldIndex;
+    size_t first = 0;
+    bool sameLayout = false;
+
+    SplitMerge(const string &outputName, const string &subatlasName, const vector<string> &subdirs, const vector<SplitSection> &sections)
+        : outputName(outputName), subatlasName(subatlasName), subdirs(subdirs), sections(sections)
+    {
+    }
+
+    string File(SplitFormat format) const
+    {
+        return outputName + '.' + splitFormatNames[format];
+    }
+
+    string SubatlasFile(size_t i, SplitFormat format) const
+    {
+        return subatlasName + subdirs[i] + '.' + splitFormatNames[format];
+    }
+
+    const SplitEntry *OldEntry(size_t i) const
+    {
+        auto it = oldIndex.find(subdirs[i]);
+        return it != oldIndex.end() ? &old.entries[it->second] : nullptr;
+    }
+
+    static const Buffer &Section(const SplitSection &section, SplitFormat format)
+    {
+        if (format == SplitBin)
+            return section.bin;
+        return format == SplitXml ? section.xml : section.json;
+    }
+
+    int TextureCount() const
+    {
+        int textureCount = 0;
+        for (auto &entry : manifest.entries)
+            textureCount += entry.textureCount;
+        return textureCount;
+    }
+
+    // Version 0 bin, xml and json: the sections are byte ranges that can be patched
+    void MergeText(SplitFormat format, bool current)
+    {
+        string file = File(format);
+
+        // Same subdirectories and every packed section kept its size: overwrite them in place
+        if (current && sameLayout)
+        {
+            bool fits = true;
+            for (size_t i = 0; i < subdirs.size(); ++i)
+                if (sections[i].packed && Section(sections[i], format).data.size() != old.entries[i].size[format])
+                    fits = false;
+
+            if (fits)
+            {
+                for (size_t i = 0; i < subdirs.size(); ++i)
+                {
+                    manifest.entries[i].offset[format] = old.entries[i].offset[format];
+                    manifest.entries[i].size[format] = old.entries[i].size[format];
+                    if (sections[i].packed)
+                        PatchFile(file, old.entries[i].offset[format], Section(sections[i], format));
+                }
+                if (format == SplitBin)
+                {
+                    Buffer count;
+                    WriteBinNumber(count, TextureCount());
+                    PatchFile(file, binTextureCountOffset, count);
+                }
+                manifest.fileSize[format] = old.fileSize[format];
+                return;
+            }
+        }
+
+        // Keep everything up to the end of the last section before the first changed one,
+        // the unchanged sections after it are moved with a single read of the rest of the file
+        size_t start = current ? first : 0;
+        size_t keep = start > 0 ? old.entries[start - 1].offset[format] + old.entries[start - 1].size[format] : 0;
+        Buffer tail;
+        if (current)
+        {
+            bool reuse = false;
+            for (size_t i = start; i < subdirs.size(); ++i)
+                if (!sections[i].packed && OldEntry(i))
+                    reuse = true;
+            if (reuse && !ReadRange(file, keep, old.fileSize[format] - keep, tail))
+                FailedToLoad(format, file);
+        }
+
+        Buffer out;
+        if (keep == 0)
+        {
+            if (format == SplitBin)
+            {
+                WriteBinHeader(out);
+                WriteBinNumber(out, 0);
+            }
+            else if (format == SplitXml)
+                WriteXmlHeader(out);
+            else
+                WriteJsonHeader(out);
+        }
+
+        for (size_t i = start; i < subdirs.size(); ++i)
+        {
+            if (format == SplitJson && i > 0)
+                out << ",\n";
+
+            SplitEntry &entry = manifest.entries[i];
+            entry.offset[format] = keep + out.data.size();
+
+            const SplitEntry *oldEntry = current ? OldEntry(i) : nullptr;
+            if (sections[i].packed)
+                out.Append(Section(sections[i], format));
+            else if (oldEntry && oldEntry->offset[format] >= keep && oldEntry->offset[format] + oldEntry->size[format] <= keep + tail.data.size())
+                out.Write(tail.data.data() + (oldEntry->offset[format] - keep), oldEntry->size[format]);
+            else
+            {
+                // Not in the manifest, fall back to the sub-atlas file
+                string subatlasFile = SubatlasFile(i, format);
+                Buffer subatlas;
+                if (!subatlas.AppendFile(subatlasFile))
+                    FailedToLoad(format, subatlasFile);
+
+                if (format == SplitBin)
+                {
+                    // Sub-atlas bins start with their texture count, followed by the textures
+                    size_t countSize = BinNumberSize();
+                    if (subatlas.data.size() < countSize)
+                        FailedToLoad(format, subatlasFile);
+                    entry.textureCount = ReadBinNumber(subatlas.data.data());
+                    out.Write(subatlas.data.data() + countSize, subatlas.data.size() - countSize);
+                }
+                else
+                    out.Append(subatlas);
+            }
+
+            entry.size[format] = keep + out.data.size() - entry.offset[format];
+        }
+
+        if (format == SplitXml)
+            WriteXmlFooter(out);
+        else if (format == SplitJson)
+            WriteJsonFooter(out);
+
+        if (keep == 0)
+        {
+            if (format == SplitBin)
+            {
+                Buffer count;
+                WriteBinNumber(count, TextureCount());
+                copy(count.data.begin(), count.data.end(), out.data.begin() + binTextureCountOffset);
+            }
+            SaveBuffer(out, file);
+        }
+        else
+        {
+            PatchFile(file, keep, out);
+            fs::resize_file(file, keep + out.data.size());
+            if (format == SplitBin)
+            {
+                Buffer count;
+                WriteBinNumber(count, TextureCount());
+                PatchFile(file, binTextureCountOffset, count);
+            }
+        }
+        manifest.fileSize[format] = keep + out.data.size();
+    }
+
+    // Version 1 bin has a hash index over all the images, so it's always rebuilt, but
+    // the unchanged textures are taken from the old merged file instead of the sub-atlases
+    void MergeAtlasBin(bool current)
+    {
+        string file = File(SplitBin);
+
+        vector<size_t> oldFirst;
+        size_t oldTextureCount = 0;
+        for (auto &entry : old.entries)
+        {
+            oldFirst.push_back(oldTextureCount);
+            oldTextureCount += entry.textureCount;
+        }
+
+        vector<AtlasTexture> textures, oldTextures;
+        bool oldLoaded = false;
+        for (size_t i = 0; i < subdirs.size(); ++i)
+        {
+            SplitEntry &entry = manifest.entries[i];
+            const SplitEntry *oldEntry = current ? OldEntry(i) : nullptr;
+            if (sections[i].packed)
+            {
+                textures.insert(textures.end(), sections[i].textures.begin(), sections[i].textures.end());
+                continue;
+            }
+
+            if (oldEntry && !oldLoaded)
+            {
+                if (!LoadAtlasBin(file, oldTextures) || oldTextures.size() != oldTextureCount)
+                    FailedToLoad(SplitBin, file);
+                oldLoaded = true;
+            }
+
+            if (oldEntry)
+            {
+                auto begin = oldTextures.begin() + oldFirst[oldEntry - old.entries.data()];
+                textures.insert(textures.end(), begin, begin + oldEntry->textureCount);
+            }
+            else
+            {
+                string subatlasFile = SubatlasFile(i, SplitBin);
+                size_t count = textures.size();
+                if (!LoadAtlasBin(subatlasFile, textures))
+                    FailedToLoad(SplitBin, subatlasFile);
+                entry.textureCount = static_cast<int>(textures.size() - count);
+            }
+        }
+
+        SaveAtlasBin(file, textures, options.trim, options.rotate, options.mesh != MeshHull::None);
+        manifest.fileSize[SplitBin] = fs::file_size(file);
+    }
+};
+
+bool MergeSplit(uint64_t hash, const string &outputName, const string &subatlasName,
+                const vector<string> &subdirs, const vector<SplitSection> &sections)
+{
+    TraceSpan span("MergeSplit", outputName);
+    SplitMerge merge(outputName, subatlasName, subdirs, sections);
+    string manifestFile = outputName + ".split";
+    bool valid = LoadManifest(manifestFile, merge.old) && merge.old.hash == hash;
+
+    // A merged file can only be patched while it's still the file the manifest describes
+    bool enabled[SplitFormatCount] = {options.binary, options.xml, options.json};
+    bool current[SplitFormatCount];
+    bool upToDate = valid;
+    for (int f = 0; f < SplitFormatCount; ++f)
+    {
+        error_code error;
+        current[f] = valid && (!enabled[f] || fs::file_size(merge.File(static_cast<SplitFormat>(f)), error) == merge.old.fileSize[f]);
+        upToDate = upToDate && current[f];
+    }
+
+    if (valid)
+    {
+        for (size_t i = 0; i < merge.old.entries.size(); ++i)
+            merge.oldIndex[merge.old.entries[i].name] = i;
+
+        // Sections before the first packed, added or removed subdirectory stay where they are
+        while (merge.first < subdirs.size() && merge.first < merge.old.entries.size() &&
+               !sections[merge.first].packed && merge.old.entries[merge.first].name == subdirs[merge.first])
+            ++merge.first;
+        merge.sameLayout = subdirs.size() == merge.old.entries.size();
+        for (size_t i = 0; i < subdirs.size() && merge.sameLayout; ++i)
+            merge.sameLayout = merge.old.entries[i].name == subdirs[i];
+    }
+
+    for (auto &section : sections)
+        upToDate = upToDate && !section.packed;
+    if (upToDate && merge.sameLayout)
+        return false;
+
+    merge.manifest.hash = hash;
+    merge.manifest.entries.resize(subdirs.size());
+    for (size_t i = 0; i < subdirs.size(); ++i)
+    {
+        SplitEntry &entry = merge.manifest.entries[i];
+        if (const SplitEntry *oldEntry = merge.OldEntry(i))
+            entry = *oldEntry;
+        entry.name = subdirs[i];
+        if (sections[i].packed)
+            entry.textureCount = sections[i].textureCount;
+    }
+
+    for (int f = 0; f < SplitFormatCount; ++f)
+    {
+        if (!enabled[f])
+            continue;
+
+        auto format = static_cast<SplitFormat>(f);
+        if (options.verbose)
+            cout << "writing " << splitFormatNames[f] << ": " << merge.File(format) << endl;
+
+        if (format == SplitBin && options.binaryVersion == 1)
+            merge.MergeAtlasBin(current[f]);
+        else
+            merge.MergeText(format, current[f]);
+    }
+
+    SaveManifest(manifestFile, merge.manifest);
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef split_hpp
+#define split_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "atlas.hpp"
+#include "buffer.hpp"
+
+using namespace std;
+
+// The metadata Pack() formatted for one subdirectory in split mode, kept in memory for the merge
+struct SplitSection
+{
+    bool packed = false;
+    int textureCount = 0;
+    Buffer bin; // version 0 texture records, without the texture count
+    Buffer xml;
+    Buffer json;
+    vector<AtlasTexture> textures; // version 1
+};
+
+// Updates the merged .bin, .xml and .json of a split atlas. The manifest (outputName.split) records the
+// texture count and byte range of every subdirectory's section in the merged files, so only the sections
+// from the first packed subdirectory onwards are rewritten, in place if their sizes didn't change.
+// Sub-atlas files are only read when the manifest is missing or doesn't match the merged files.
+// Returns false if the merged files were already up to date.
+bool MergeSplit(uint64_t hash, const string &outputName, const string &subatlasName,
+                const vector<string> &subdirs, const vector<SplitSection> &sections);
+
+#endif
@@ -0,0 +1,254 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#include "buffer.hpp"
+#include "metadata.hpp"
+#include "options.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+
+using namespace std;
+
+static const char *phaseNames[] = {"scan", "hash", "decode", "trim", "pack", "compose", "encode", "write"};
+const int phaseCount = static_cast<int>(Phase::Count);
+
+struct PageStats
+{
+    string name;
+    int width;
+    int height;
+    int images;
+    int duplicates;
+    double occupancy;
+};
+
+struct Stats
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    atomic<int64_t> wall[phaseCount] = {};
+    atomic<int64_t> cpu[phaseCount] = {};
+    atomic<uint64_t> bytesRead = 0;
+    atomic<uint64_t> bytesWritten = 0;
+    atomic<uint64_t> images = 0;
+    mutex lock;
+    vector<PageStats> pages;
+};
+
+// Shared by every thread of the run, only touched while --stats is on
+static Stats stats;
+
+static thread_local PhaseTimer *activeTimer = nullptr;
+
+static bool Enabled()
+{
+    return !options.stats.empty();
+}
+
+static int64_t WallTime()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef _WIN32
+static int64_t FileTimeNanoseconds(const FILETIME &time)
+{
+    return ((static_cast<int64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 100;
+}
+#endif
+
+static int64_t ThreadCpuTime()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    return FileTimeNanoseconds(kernel) + FileTimeNanoseconds(user);
+#else
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1000000000ll + time.tv_nsec;
+#endif
+}
+
+static int64_t ProcessCpuTime()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    return FileTimeNanoseconds(kernel) + FileTimeNanoseconds(user);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ll +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ll;
+#endif
+}
+
+static uint64_t PeakMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+PhaseTimer::PhaseTimer(Phase phase)
+    : phase(phase), enabled(Enabled()), outer(nullptr)
+{
+    if (!enabled)
+        return;
+    outer = activeTimer;
+    if (outer)
+        outer->Stop();
+    activeTimer = this;
+    Start();
+}
+
+PhaseTimer::~PhaseTimer()
+{
+    if (!enabled)
+        return;
+    Stop();
+    activeTimer = outer;
+    if (outer)
+        outer->Start();
+}
+
+void PhaseTimer::Start()
+{
+    wallStart = WallTime();
+    cpuStart = ThreadCpuTime();
+}
+
+void PhaseTimer::Stop()
+{
+    int index = static_cast<int>(phase);
+    stats.wall[index] += WallTime() - wallStart;
+    stats.cpu[index] += ThreadCpuTime() - cpuStart;
+}
+
+void AddBytesRead(uint64_t bytes)
+{
+    if (Enabled())
+        stats.bytesRead += bytes;
+}
+
+void AddBytesWritten(uint64_t bytes)
+{
+    if (Enabled())
+        stats.bytesWritten += bytes;
+}
+
+void AddImages(size_t count)
+{
+    if (Enabled())
+        stats.images += count;
+}
+
+void AddPages(const vector<Packer *> &packers, const string &name, bool noZero)
+{
+    if (!Enabled())
+        return;
+
+    lock_guard<mutex> guard(stats.lock);
+    for (int i = 0; i < packers.size(); ++i)
+    {
+        auto &packer = *packers[i];
+        PageStats page{name + (noZero ? "" : to_string(i)), packer.width, packer.height, 0, 0, packer.occupancy};
+        for (auto &point : packer.points)
+            if (point.dupID >= 0)
+                ++page.duplicates;
+            else
+                ++page.images;
+        stats.pages.push_back(page);
+    }
+}
+
+// Fixed-point numbers, so the report doesn't depend on the locale or on float printing
+static void WriteFixed(Buffer &json, int64_t value, int64_t scale, int digits)
+{
+    json << value / scale << '.';
+    string fraction = to_string(value % scale);
+    json << string(digits - fraction.size(), '0') << fraction;
+}
+
+static void WriteMilliseconds(Buffer &json, int64_t nanoseconds)
+{
+    WriteFixed(json, nanoseconds / 1000, 1000, 3);
+}
+
+void SaveStats(const string &file, const string &atlas, int result)
+{
+    int64_t wall = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - stats.start).count();
+    const char *status = result == EXIT_SUCCESS ? "packed" : (result == EXIT_SKIPPED ? "unchanged" : "failed");
+
+    sort(stats.pages.begin(), stats.pages.end(), [](const PageStats &a, const PageStats &b)
+         { return a.name < b.name; });
+    int duplicates = 0;
+    for (auto &page : stats.pages)
+        duplicates += page.duplicates;
+
+    Buffer json;
+    json << "{\n";
+    json << "\t\"atlas\": \"" << atlas << "\",\n";
+    json << "\t\"result\": \"" << status << "\",\n";
+    json << "\t\"threads\": " << WorkerCount() << ",\n";
+    json << "\t\"wall_ms\": ";
+    WriteMilliseconds(json, wall);
+    json << ",\n\t\"cpu_ms\": ";
+    WriteMilliseconds(json, ProcessCpuTime());
+    json << ",\n\t\"peak_rss_bytes\": " << PeakMemory() << ",\n";
+    json << "\t\"bytes_read\": " << stats.bytesRead.load() << ",\n";
+    json << "\t\"bytes_written\": " << stats.bytesWritten.load() << ",\n";
+    json << "\t\"images\": " << stats.images.load() << ",\n";
+    json << "\t\"duplicates\": " << duplicates << ",\n";
+
+    json << "\t\"phases\": {\n";
+    for (int i = 0; i < phaseCount; ++i)
+    {
+        json << "\t\t\"" << phaseNames[i] << "\": {\"wall_ms\": ";
+        WriteMilliseconds(json, stats.wall[i]);
+        json << ", \"cpu_ms\": ";
+        WriteMilliseconds(json, stats.cpu[i]);
+        json << (i + 1 < phaseCount ? "},\n" : "}\n");
+    }
+    json << "\t},\n";
+
+    json << "\t\"pages\": [";
+    for (int i = 0; i < stats.pages.size(); ++i)
+    {
+        auto &page = stats.pages[i];
+        json << (i > 0 ? ",\n" : "\n") << "\t\t{\"name\": \"" << page.name << "\", \"width\": " << page.width
+             << ", \"height\": " << page.height << ", \"images\": " << page.images << ", \"duplicates\": " << page.duplicates
+             << ", \"occupancy\": ";
+        WriteFixed(json, llround(page.occupancy * 10000), 10000, 4);
+        json << '}';
+    }
+    json << (stats.pages.empty() ? "]\n" : "\n\t]\n");
+    json << "}\n";
+
+    SaveBuffer(json, file);
+}
@@ -0,0 +1,55 @@
+#ifndef stats_hpp
+#define stats_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "packer.hpp"
+
+using namespace std;
+
+// Phases of a packing measured for --stats
+enum class Phase : char
+{
+    Scan,
+    Hash,
+    Decode,
+    Trim,
+    Pack,
+    Compose,
+    Encode,
+    Write,
+    Count
+};
+
+// Adds the wall and CPU time of its lifetime to a phase when --stats is on. A nested timer pauses
+// the outer one, so every moment of a thread counts for one phase only
+struct PhaseTimer
+{
+    explicit PhaseTimer(Phase phase);
+    ~PhaseTimer();
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    void Start();
+    void Stop();
+
+    Phase phase;
+    bool enabled;
+    PhaseTimer *outer;
+    int64_t wallStart;
+    int64_t cpuStart;
+};
+
+// Counters of the --stats report, they do nothing unless --stats is on
+void AddBytesRead(uint64_t bytes);
+void AddBytesWritten(uint64_t bytes);
+void AddImages(size_t count);
+void AddPages(const vector<Packer *> &packers, const string &name, bool noZero);
+
+// Writes the JSON report of everything counted since the program started
+void SaveStats(const string &file, const string &atlas, int result);
+
+#endif
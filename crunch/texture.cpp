@@ -0,0 +1,370 @@
+#include "texture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "bcn.hpp"
+#include "quantize.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+static void WriteU32(vector<uint8_t> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back((value >> (i * 8)) & 0xff);
+}
+
+static void WriteU64(vector<uint8_t> &out, uint64_t value)
+{
+    WriteU32(out, static_cast<uint32_t>(value));
+    WriteU32(out, static_cast<uint32_t>(value >> 32));
+}
+
+static void SetU64(vector<uint8_t> &out, size_t offset, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out[offset + i] = (value >> (i * 8)) & 0xff;
+}
+
+Texture::Texture(const Bitmap &bitmap, PixelFormat format, bool premultiplied, Dither dither)
+    : width(bitmap.width), height(bitmap.height), format(format), premultiplied(premultiplied), dither(dither)
+{
+    AddLevel(bitmap.data, width, height);
+}
+
+Texture::Texture(int width, int height, PixelFormat format, bool premultiplied, Dither dither)
+    : width(width), height(height), format(format), premultiplied(premultiplied), dither(dither)
+{
+    size_t size = IsBlockCompressed(format)
+                      ? static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format)
+                      : static_cast<size_t>(width) * height * BlockBytes(format);
+    levels.emplace_back().reserve(size);
+}
+
+void Texture::Encode(const uint32_t *pixels, int levelWidth, int levelHeight, vector<uint8_t> &out) const
+{
+    if (IsBlockCompressed(format))
+        CompressBlocks(pixels, levelWidth, levelHeight, format, out);
+    else if (BlockBytes(format) == 2)
+        QuantizePixels(pixels, levelWidth, levelHeight, format, premultiplied, dither, out);
+    else
+    {
+        auto bytes = reinterpret_cast<const uint8_t *>(pixels);
+        out.assign(bytes, bytes + static_cast<size_t>(levelWidth) * levelHeight * sizeof(uint32_t));
+    }
+}
+
+void Texture::AddLevel(const uint32_t *pixels, int levelWidth, int levelHeight)
+{
+    PhaseTimer timer(Phase::Encode);
+    Encode(pixels, levelWidth, levelHeight, levels.emplace_back());
+}
+
+void Texture::AddBand(const uint32_t *pixels, int rows)
+{
+    PhaseTimer timer(Phase::Encode);
+    vector<uint8_t> band;
+    Encode(pixels, width, rows, band);
+    levels[0].insert(levels[0].end(), band.begin(), band.end());
+}
+
+// The levels in the order they're stored in the file
+static vector<size_t> FileOrder(const vector<size_t> &offsets)
+{
+    vector<size_t> order(offsets.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return offsets[a] < offsets[b]; });
+    return order;
+}
+
+// Puts the header and the levels together into the bytes of the file
+static vector<uint8_t> Assemble(vector<uint8_t> out, const vector<vector<uint8_t>> &levels,
+                                const vector<size_t> &offsets)
+{
+    for (size_t i : FileOrder(offsets))
+    {
+        out.resize(offsets[i], 0);
+        out.insert(out.end(), levels[i].begin(), levels[i].end());
+    }
+    return out;
+}
+
+// Writes the header and then each level at its offset
+static bool SaveTexture(const string &file, const vector<uint8_t> &header, const vector<vector<uint8_t>> &levels,
+                        const vector<size_t> &offsets)
+{
+    PhaseTimer timer(Phase::Write);
+    static const char zeros[16] = {};
+    ofstream stream(file, ios::binary);
+    stream.write(reinterpret_cast<const char *>(header.data()), header.size());
+    size_t size = header.size();
+    for (size_t i : FileOrder(offsets))
+    {
+        stream.write(zeros, offsets[i] - size);
+        stream.write(reinterpret_cast<const char *>(levels[i].data()), levels[i].size());
+        size = offsets[i] + levels[i].size();
+    }
+    stream.close();
+    if (!stream)
+    {
+        cerr << "failed to save texture: " << file << endl;
+        return false;
+    }
+    AddBytesWritten(size);
+    return true;
+}
+
+// ================================================================
+// DDS
+// ================================================================
+
+vector<uint8_t> Texture::DdsHeader(vector<size_t> &offsets) const
+{
+    const uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PITCH = 0x8,
+                   DDSD_PIXELFORMAT = 0x1000, DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+    const uint32_t DDPF_ALPHAPIXELS = 0x1, DDPF_FOURCC = 0x4, DDPF_RGB = 0x40;
+    const uint32_t DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+    const uint32_t DXGI_FORMAT_BC7_UNORM = 98, D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+    const uint32_t DDS_ALPHA_MODE_STRAIGHT = 1, DDS_ALPHA_MODE_PREMULTIPLIED = 2;
+
+    bool compressed = IsBlockCompressed(format);
+    bool mipmapped = levels.size() > 1;
+
+    vector<uint8_t> out = {'D', 'D', 'S', ' '};
+
+    WriteU32(out, 124);
+    WriteU32(out, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT |
+                      (compressed ? DDSD_LINEARSIZE : DDSD_PITCH) | (mipmapped ? DDSD_MIPMAPCOUNT : 0));
+    WriteU32(out, height);
+    WriteU32(out, width);
+    WriteU32(out, compressed ? static_cast<uint32_t>(levels[0].size()) : width * BlockBytes(format));
+    WriteU32(out, 0);
+    WriteU32(out, static_cast<uint32_t>(levels.size()));
+    for (int i = 0; i < 11; ++i)
+        WriteU32(out, 0);
+
+    // Pixel format
+    WriteU32(out, 32);
+    if (compressed)
+    {
+        WriteU32(out, DDPF_FOURCC);
+        if (format == PixelFormat::BC1)
+            out.insert(out.end(), {'D', 'X', 'T', '1'});
+        else if (format == PixelFormat::BC3)
+            out.insert(out.end(), {'D', 'X', 'T', '5'});
+        else
+            out.insert(out.end(), {'D', 'X', '1', '0'});
+        for (int i = 0; i < 5; ++i)
+            WriteU32(out, 0);
+    }
+    else
+    {
+        // Red, green, blue and alpha masks
+        uint32_t masks[4];
+        switch (format)
+        {
+        case PixelFormat::RGBA4444:
+            masks[0] = 0x0f00, masks[1] = 0x00f0, masks[2] = 0x000f, masks[3] = 0xf000;
+            break;
+        case PixelFormat::RGB565:
+            masks[0] = 0xf800, masks[1] = 0x07e0, masks[2] = 0x001f, masks[3] = 0;
+            break;
+        case PixelFormat::RGBA5551:
+            masks[0] = 0x7c00, masks[1] = 0x03e0, masks[2] = 0x001f, masks[3] = 0x8000;
+            break;
+        default:
+            masks[0] = 0x000000ff, masks[1] = 0x0000ff00, masks[2] = 0x00ff0000, masks[3] = 0xff000000;
+            break;
+        }
+        WriteU32(out, DDPF_RGB | (masks[3] != 0 ? DDPF_ALPHAPIXELS : 0));
+        WriteU32(out, 0);
+        WriteU32(out, BlockBytes(format) * 8);
+        for (uint32_t mask : masks)
+            WriteU32(out, mask);
+    }
+
+    WriteU32(out, DDSCAPS_TEXTURE | (mipmapped ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0));
+    for (int i = 0; i < 4; ++i)
+        WriteU32(out, 0);
+
+    // BC7 has no legacy four character code, so it needs the DX10 header
+    if (format == PixelFormat::BC7)
+    {
+        WriteU32(out, DXGI_FORMAT_BC7_UNORM);
+        WriteU32(out, D3D10_RESOURCE_DIMENSION_TEXTURE2D);
+        WriteU32(out, 0);
+        WriteU32(out, 1);
+        WriteU32(out, premultiplied ? DDS_ALPHA_MODE_PREMULTIPLIED : DDS_ALPHA_MODE_STRAIGHT);
+    }
+
+    // The levels follow the header largest first
+    offsets.clear();
+    size_t offset = out.size();
+    for (auto &level : levels)
+    {
+        offsets.push_back(offset);
+        offset += level.size();
+    }
+
+    return out;
+}
+
+vector<uint8_t> Texture::EncodeDds() const
+{
+    PhaseTimer timer(Phase::Encode);
+    vector<size_t> offsets;
+    vector<uint8_t> header = DdsHeader(offsets);
+    return Assemble(move(header), levels, offsets);
+}
+
+// ================================================================
+// KTX2
+// ================================================================
+
+vector<uint8_t> Texture::Ktx2Header(vector<size_t> &offsets) const
+{
+    const uint32_t VK_FORMAT_R8G8B8A8_UNORM = 37, VK_FORMAT_BC1_RGBA_UNORM_BLOCK = 133,
+                   VK_FORMAT_BC3_UNORM_BLOCK = 137, VK_FORMAT_BC7_UNORM_BLOCK = 145,
+                   VK_FORMAT_R5G6B5_UNORM_PACK16 = 4, VK_FORMAT_A1R5G5B5_UNORM_PACK16 = 8,
+                   VK_FORMAT_A4R4G4B4_UNORM_PACK16 = 1000340000;
+    const uint32_t KHR_DF_MODEL_RGBSDA = 1, KHR_DF_MODEL_BC1A = 128, KHR_DF_MODEL_BC3 = 130, KHR_DF_MODEL_BC7 = 133;
+    const uint32_t KHR_DF_PRIMARIES_BT709 = 1, KHR_DF_TRANSFER_LINEAR = 1, KHR_DF_FLAG_ALPHA_PREMULTIPLIED = 1;
+    const uint32_t KHR_DF_CHANNEL_BC1A_ALPHAPRESENT = 1, KHR_DF_CHANNEL_BC3_COLOR = 0, KHR_DF_CHANNEL_BC3_ALPHA = 15,
+                   KHR_DF_CHANNEL_BC7_COLOR = 0, KHR_DF_CHANNEL_RGBSDA_ALPHA = 15;
+
+    struct Sample
+    {
+        uint32_t bitOffset;
+        uint32_t bitLength;
+        uint32_t channel;
+        uint32_t upper;
+    };
+
+    uint32_t vkFormat, colorModel;
+    vector<Sample> samples;
+    switch (format)
+    {
+    case PixelFormat::BC1:
+        vkFormat = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        colorModel = KHR_DF_MODEL_BC1A;
+        samples = {{0, 64, KHR_DF_CHANNEL_BC1A_ALPHAPRESENT, 0xffffffff}};
+        break;
+    case PixelFormat::BC3:
+        vkFormat = VK_FORMAT_BC3_UNORM_BLOCK;
+        colorModel = KHR_DF_MODEL_BC3;
+        samples = {{0, 64, KHR_DF_CHANNEL_BC3_ALPHA, 0xffffffff}, {64, 64, KHR_DF_CHANNEL_BC3_COLOR, 0xffffffff}};
+        break;
+    case PixelFormat::BC7:
+        vkFormat = VK_FORMAT_BC7_UNORM_BLOCK;
+        colorModel = KHR_DF_MODEL_BC7;
+        samples = {{0, 128, KHR_DF_CHANNEL_BC7_COLOR, 0xffffffff}};
+        break;
+    case PixelFormat::RGBA4444:
+        vkFormat = VK_FORMAT_A4R4G4B4_UNORM_PACK16;
+        colorModel = KHR_DF_MODEL_RGBSDA;
+        samples = {{0, 4, 2, 15}, {4, 4, 1, 15}, {8, 4, 0, 15}, {12, 4, KHR_DF_CHANNEL_RGBSDA_ALPHA, 15}};
+        break;
+    case PixelFormat::RGB565:
+        vkFormat = VK_FORMAT_R5G6B5_UNORM_PACK16;
+        colorModel = KHR_DF_MODEL_RGBSDA;
+        samples = {{0, 5, 2, 31}, {5, 6, 1, 63}, {11, 5, 0, 31}};
+        break;
+    case PixelFormat::RGBA5551:
+        vkFormat = VK_FORMAT_A1R5G5B5_UNORM_PACK16;
+        colorModel = KHR_DF_MODEL_RGBSDA;
+        samples = {{0, 5, 2, 31}, {5, 5, 1, 31}, {10, 5, 0, 31}, {15, 1, KHR_DF_CHANNEL_RGBSDA_ALPHA, 1}};
+        break;
+    default:
+        vkFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        colorModel = KHR_DF_MODEL_RGBSDA;
+        samples = {{0, 8, 0, 255}, {8, 8, 1, 255}, {16, 8, 2, 255}, {24, 8, KHR_DF_CHANNEL_RGBSDA_ALPHA, 255}};
+        break;
+    }
+
+    bool compressed = IsBlockCompressed(format);
+    uint32_t blockBytes = BlockBytes(format);
+    uint32_t levelAlignment = compressed ? blockBytes : 4;
+
+    // Data format descriptor (a single basic descriptor block)
+    vector<uint8_t> dfd;
+    uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+    WriteU32(dfd, 4 + blockSize);
+    WriteU32(dfd, 0);
+    WriteU32(dfd, 2 | (blockSize << 16));
+    WriteU32(dfd, colorModel | (KHR_DF_PRIMARIES_BT709 << 8) | (KHR_DF_TRANSFER_LINEAR << 16) |
+                      ((premultiplied ? KHR_DF_FLAG_ALPHA_PREMULTIPLIED : 0) << 24));
+    WriteU32(dfd, compressed ? 0x00000303 : 0);
+    WriteU32(dfd, blockBytes);
+    WriteU32(dfd, 0);
+    for (auto &sample : samples)
+    {
+        WriteU32(dfd, sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+        WriteU32(dfd, 0);
+        WriteU32(dfd, 0);
+        WriteU32(dfd, sample.upper);
+    }
+
+    vector<uint8_t> out = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+    WriteU32(out, vkFormat);
+    WriteU32(out, blockBytes == 2 ? 2 : 1); // the packed 16 bit formats are swapped as words
+    WriteU32(out, width);
+    WriteU32(out, height);
+    WriteU32(out, 0);
+    WriteU32(out, 0);
+    WriteU32(out, 1);
+    WriteU32(out, static_cast<uint32_t>(levels.size()));
+    WriteU32(out, 0);
+
+    uint32_t dfdOffset = 80 + 24 * static_cast<uint32_t>(levels.size());
+    WriteU32(out, dfdOffset);
+    WriteU32(out, static_cast<uint32_t>(dfd.size()));
+    WriteU32(out, 0);
+    WriteU32(out, 0);
+    WriteU64(out, 0);
+    WriteU64(out, 0);
+
+    size_t levelIndex = out.size();
+    out.resize(out.size() + 24 * levels.size());
+    out.insert(out.end(), dfd.begin(), dfd.end());
+
+    // Mip levels are stored smallest first
+    offsets.assign(levels.size(), 0);
+    size_t offset = out.size();
+    for (size_t i = levels.size(); i-- > 0;)
+    {
+        offset = (offset + levelAlignment - 1) / levelAlignment * levelAlignment;
+        offsets[i] = offset;
+        SetU64(out, levelIndex + i * 24, offset);
+        SetU64(out, levelIndex + i * 24 + 8, levels[i].size());
+        SetU64(out, levelIndex + i * 24 + 16, levels[i].size());
+        offset += levels[i].size();
+    }
+
+    return out;
+}
+
+vector<uint8_t> Texture::EncodeKtx2() const
+{
+    PhaseTimer timer(Phase::Encode);
+    vector<size_t> offsets;
+    vector<uint8_t> header = Ktx2Header(offsets);
+    return Assemble(move(header), levels, offsets);
+}
+
+bool Texture::SaveDds(const string &file) const
+{
+    vector<size_t> offsets;
+    vector<uint8_t> header = DdsHeader(offsets);
+    return SaveTexture(file, header, levels, offsets);
+}
+
+bool Texture::SaveKtx2(const string &file) const
+{
+    vector<size_t> offsets;
+    vector<uint8_t> header = Ktx2Header(offsets);
+    return SaveTexture(file, header, levels, offsets);
+}
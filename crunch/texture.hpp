@@ -0,0 +1,46 @@
+#ifndef texture_hpp
+#define texture_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+struct Texture
+{
+    int width;
+    int height;
+    PixelFormat format;
+    bool premultiplied;
+    Dither dither;
+    vector<vector<uint8_t>> levels;
+
+    Texture(const Bitmap &bitmap, PixelFormat format, bool premultiplied, Dither dither);
+    // A texture whose first level is added with AddBand
+    Texture(int width, int height, PixelFormat format, bool premultiplied, Dither dither);
+    // Adds the next mip level, half the size of the one before
+    void AddLevel(const uint32_t *pixels, int levelWidth, int levelHeight);
+    // Adds the next rows of the first level. Bands above the last one must be a multiple of 4 rows high, and
+    // error diffusion can't be used as it carries over from row to row
+    void AddBand(const uint32_t *pixels, int rows);
+    // The bytes of a .dds or .ktx2 file holding the texture
+    vector<uint8_t> EncodeDds() const;
+    vector<uint8_t> EncodeKtx2() const;
+    // Writes the files without putting them together in memory first, prints the error and returns false
+    // if they can't be written
+    bool SaveDds(const string &file) const;
+    bool SaveKtx2(const string &file) const;
+
+private:
+    void Encode(const uint32_t *pixels, int levelWidth, int levelHeight, vector<uint8_t> &out) const;
+    // Everything in front of the levels, with where each level starts in the file. The bytes between the
+    // levels are zero
+    vector<uint8_t> DdsHeader(vector<size_t> &offsets) const;
+    vector<uint8_t> Ktx2Header(vector<size_t> &offsets) const;
+};
+
+#endif
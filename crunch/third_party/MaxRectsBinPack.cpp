@@ -16,6 +16,7 @@
 #include <cmath>
 
 #include "MaxRectsBinPack.h"
+#include "../trace.hpp"
 
 namespace rbp {
 
@@ -50,8 +51,14 @@ void MaxRectsBinPack::Init(int width, int height, bool allowFlip)
 	freeRectangles.push_back(n);
 }
 
+void MaxRectsBinPack::SetAllowFlip(bool allowFlip)
+{
+	binAllowFlip = allowFlip;
+}
+
 Rect MaxRectsBinPack::Insert(int width, int height, FreeRectChoiceHeuristic method)
 {
+	TraceSpan span("MaxRectsBinPack::Insert");
 	Rect newNode;
 	// Unused in this function. We don't need to know the score after finding the position.
 	int score1 = std::numeric_limits<int>::max();
@@ -75,6 +82,7 @@ Rect MaxRectsBinPack::Insert(int width, int height, FreeRectChoiceHeuristic meth
 
 void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst, FreeRectChoiceHeuristic method)
 {
+	TraceSpan span("MaxRectsBinPack::Insert");
 	dst.clear();
 
 	while(rects.size() > 0)
@@ -111,6 +119,7 @@ void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &ds
 
 void MaxRectsBinPack::PlaceRect(const Rect &node)
 {
+	TraceSpan span("MaxRectsBinPack::PlaceRect");
 	for(size_t i = 0; i < freeRectangles.size();)
 	{
 		if (SplitFreeNode(freeRectangles[i], node))
@@ -29,6 +29,9 @@ public:
 	/// you need to restart with a new bin.
 	void Init(int width, int height, bool allowFlip = true);
 
+	/// Allows or forbids rotating the rectangles inserted from now on.
+	void SetAllowFlip(bool allowFlip);
+
 	/// Specifies the different heuristic rules that can be used when deciding where to place a new rectangle.
 	enum FreeRectChoiceHeuristic
 	{
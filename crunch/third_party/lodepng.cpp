@@ -39,6 +39,16 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+/*x86-64 SIMD kernels for unfiltering and color conversion, picked at runtime from what the CPU supports*/
+#if !defined(LODEPNG_NO_COMPILE_SIMD) && (defined(__x86_64__) || defined(_M_X64)) && \
+    (defined(__GNUC__) || defined(_MSC_VER))
+#define LODEPNG_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__GNUC__)
+#include <intrin.h>
+#endif
+#endif /*LODEPNG_NO_COMPILE_SIMD*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -129,6 +139,14 @@ static void lodepng_memset(void* LODEPNG_RESTRICT dst,
   for(i = 0; i < num; i++) ((char*)dst)[i] = (char)value;
 }
 
+#ifdef LODEPNG_COMPILE_ENCODER
+/* the regions may overlap, only used to move data towards the start of a buffer */
+static void lodepng_memmove(void* dst, const void* src, size_t size) {
+  size_t i;
+  for(i = 0; i < size; i++) ((char*)dst)[i] = ((const char*)src)[i];
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 /* does not check memory out of bounds, do not use on untrusted data */
 static size_t lodepng_strlen(const char* a) {
   const char* orig = a;
@@ -1234,6 +1252,228 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*
+Fast path of inflateHuffmanBlock, used while enough input is left. It keeps up to 63 bits in a 64-bit buffer that
+is refilled with a single 8-byte load, decodes literal/length and distance codes of up to FIRSTBITS bits with one
+lookup in a table whose entries also give the base value and extra bits of the symbol, and copies matches 8 or 16
+bytes at a time. It only needs a 64-bit integer type, without one the bit reader path below does all the work.
+*/
+#if defined(__cplusplus) || (defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L))
+#define LODEPNG_FAST_INFLATE
+
+typedef unsigned long long LodePNGBitBuffer;
+
+/*kinds of fast table entries*/
+#define FAST_LITERAL 0u
+#define FAST_MATCH 1u /*a length or distance with base value and extra bits*/
+#define FAST_END 2u
+#define FAST_LONG 3u /*the code is longer than the table bits*/
+#define FAST_INVALID 4u
+
+/*output space the fast path keeps free: a match of 258 bytes, the overshoot of a wide copy and a few literals*/
+#define FAST_RESERVE 280u
+
+/*input bytes left from which the fast path is used*/
+#define FAST_MIN_INPUT 128u
+
+/*an entry holds the code length in bits 0-3, the extra bits in bits 4-7, the kind in bits 8-10 and the value
+(literal, base length or base distance) in bits 16-31*/
+static unsigned fastEntry(unsigned symbol, int distance) {
+  if(distance) {
+    if(symbol < 30) return (DISTANCEEXTRA[symbol] << 4u) | (FAST_MATCH << 8u) | (DISTANCEBASE[symbol] << 16u);
+  } else {
+    if(symbol <= 255) return (FAST_LITERAL << 8u) | (symbol << 16u);
+    if(symbol == 256) return FAST_END << 8u;
+    if(symbol <= LAST_LENGTH_CODE_INDEX) {
+      return (LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX] << 4u) | (FAST_MATCH << 8u) |
+             (LENGTHBASE[symbol - FIRST_LENGTH_CODE_INDEX] << 16u);
+    }
+  }
+  return (FAST_INVALID << 8u) | ((symbol & 65535u) << 16u);
+}
+
+/*fill a fast table from the first table of HuffmanTree_makeTable, its long symbols take the second lookup*/
+static void makeFastTable(unsigned* table, const HuffmanTree* tree, int distance) {
+  unsigned i;
+  for(i = 0; i != (1u << FIRSTBITS); ++i) {
+    unsigned l = tree->table_len[i];
+    table[i] = l > FIRSTBITS ? (FAST_LONG << 8u) : (fastEntry(tree->table_value[i], distance) | l);
+  }
+}
+
+/*huffmanDecodeSymbol on the 64-bit buffer, for the codes that don't fit in the fast table*/
+static LODEPNG_INLINE unsigned decodeSymbolBuffered(LodePNGBitBuffer* buffer, unsigned* count,
+                                                    const HuffmanTree* codetree) {
+  unsigned code = (unsigned)(*buffer & ((1u << FIRSTBITS) - 1u));
+  unsigned l = codetree->table_len[code];
+  unsigned value = codetree->table_value[code];
+  if(l <= FIRSTBITS) {
+    *buffer >>= l;
+    *count -= l;
+    return value;
+  }
+  *buffer >>= FIRSTBITS;
+  value += (unsigned)(*buffer & ((1u << (l - FIRSTBITS)) - 1u));
+  l = codetree->table_len[value] - FIRSTBITS;
+  *buffer >>= l;
+  *count -= FIRSTBITS + l;
+  return codetree->table_value[value];
+}
+
+/*little endian load of 8 bytes, compilers turn this into a single load*/
+static LODEPNG_INLINE LodePNGBitBuffer lodepng_read64bitInt(const unsigned char* buffer) {
+  return (LodePNGBitBuffer)buffer[0] | ((LodePNGBitBuffer)buffer[1] << 8u) |
+         ((LodePNGBitBuffer)buffer[2] << 16u) | ((LodePNGBitBuffer)buffer[3] << 24u) |
+         ((LodePNGBitBuffer)buffer[4] << 32u) | ((LodePNGBitBuffer)buffer[5] << 40u) |
+         ((LodePNGBitBuffer)buffer[6] << 48u) | ((LodePNGBitBuffer)buffer[7] << 56u);
+}
+
+static LODEPNG_INLINE void copy8(unsigned char* LODEPNG_RESTRICT dst, const unsigned char* LODEPNG_RESTRICT src) {
+  unsigned i;
+  for(i = 0; i != 8; ++i) dst[i] = src[i];
+}
+
+/*Decodes symbols until the end code, an error, or until fewer than 8 input bytes are left after the buffered bits.
+Then reader->bp points after the last decoded symbol, so the bit reader path can go on from there. Errors are the
+same as the ones of that path.*/
+static unsigned inflateHuffmanFast(ucvector* out, LodePNGBitReader* reader, const HuffmanTree* tree_ll,
+                                   const HuffmanTree* tree_d, size_t max_output_size, int* done) {
+  unsigned fast_ll[1u << FIRSTBITS];
+  unsigned fast_d[1u << FIRSTBITS];
+  const unsigned char* in = reader->data + (reader->bp >> 3u);
+  const unsigned char* end = reader->data + reader->size;
+  LodePNGBitBuffer buffer = 0;
+  unsigned count = 0;
+  unsigned error = 0;
+
+  /*building the tables costs more than it saves on the last few symbols*/
+  if(reader->bp >= reader->bitsize || (size_t)(end - in) < FAST_MIN_INPUT) return 0;
+
+  makeFastTable(fast_ll, tree_ll, 0);
+  makeFastTable(fast_d, tree_d, 1);
+
+  /*start with the bits of the first byte that are left after bp*/
+  buffer = in[0] >> (reader->bp & 7u);
+  count = 8u - (unsigned)(reader->bp & 7u);
+  in += 1;
+
+  while((size_t)(end - in) >= 8) {
+    unsigned entry, kind;
+    size_t length, distance;
+    unsigned char* dst;
+    const unsigned char* src;
+
+    if(out->allocsize - out->size < FAST_RESERVE) {
+      if(!ucvector_reserve(out, out->size + FAST_RESERVE)) ERROR_BREAK(83); /*alloc fail*/
+    }
+
+    /*refill: add the whole bytes that fit, afterwards 56 <= count <= 63. The partial byte loaded above count
+    is loaded again at the same position by the next refill*/
+    buffer |= lodepng_read64bitInt(in) << count;
+    in += (63u - count) >> 3u;
+    count |= 56u;
+
+    /*up to 3 literals of at most 15 bits fit in one refill*/
+    entry = fast_ll[buffer & ((1u << FIRSTBITS) - 1u)];
+    kind = (entry >> 8u) & 7u;
+    if(kind == FAST_LITERAL) {
+      buffer >>= entry & 15u;
+      count -= entry & 15u;
+      out->data[out->size++] = (unsigned char)(entry >> 16u);
+      entry = fast_ll[buffer & ((1u << FIRSTBITS) - 1u)];
+      kind = (entry >> 8u) & 7u;
+      if(kind == FAST_LITERAL) {
+        buffer >>= entry & 15u;
+        count -= entry & 15u;
+        out->data[out->size++] = (unsigned char)(entry >> 16u);
+        entry = fast_ll[buffer & ((1u << FIRSTBITS) - 1u)];
+        kind = (entry >> 8u) & 7u;
+        if(kind == FAST_LITERAL) {
+          buffer >>= entry & 15u;
+          count -= entry & 15u;
+          out->data[out->size++] = (unsigned char)(entry >> 16u);
+        }
+      }
+      if(max_output_size && out->size > max_output_size) ERROR_BREAK(109); /*error, larger than max size*/
+      /*a length and distance may need up to 48 bits, so refill before decoding them*/
+      continue;
+    }
+
+    if(kind == FAST_LONG) {
+      entry = fastEntry(decodeSymbolBuffered(&buffer, &count, tree_ll), 0);
+      kind = (entry >> 8u) & 7u;
+      if(kind == FAST_LITERAL) {
+        out->data[out->size++] = (unsigned char)(entry >> 16u);
+        if(max_output_size && out->size > max_output_size) ERROR_BREAK(109); /*error, larger than max size*/
+        continue;
+      }
+    }
+    if(kind == FAST_END) {
+      buffer >>= entry & 15u;
+      count -= entry & 15u;
+      *done = 1;
+      break;
+    }
+    if(kind == FAST_INVALID) ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+
+    /*length: code, then extra bits, at most 20 bits*/
+    buffer >>= entry & 15u;
+    count -= entry & 15u;
+    length = (entry >> 16u) + (size_t)(buffer & ((1u << ((entry >> 4u) & 15u)) - 1u));
+    buffer >>= (entry >> 4u) & 15u;
+    count -= (entry >> 4u) & 15u;
+
+    /*distance: code, then extra bits, at most 28 bits*/
+    entry = fast_d[buffer & ((1u << FIRSTBITS) - 1u)];
+    kind = (entry >> 8u) & 7u;
+    if(kind == FAST_LONG) {
+      entry = fastEntry(decodeSymbolBuffered(&buffer, &count, tree_d), 1);
+      kind = (entry >> 8u) & 7u;
+    }
+    if(kind == FAST_INVALID) {
+      /*30-31 are never used, anything else is a disallowed huffman symbol*/
+      ERROR_BREAK((entry >> 16u) <= 31 ? 18 : 16);
+    }
+    buffer >>= entry & 15u;
+    count -= entry & 15u;
+    distance = (entry >> 16u) + (size_t)(buffer & ((1u << ((entry >> 4u) & 15u)) - 1u));
+    buffer >>= (entry >> 4u) & 15u;
+    count -= (entry >> 4u) & 15u;
+
+    if(distance > out->size) ERROR_BREAK(52); /*too long backward distance*/
+    dst = out->data + out->size;
+    src = dst - distance;
+    out->size += length;
+    if(distance >= 16) {
+      /*may write up to 15 bytes past the match, FAST_RESERVE leaves room for them*/
+      unsigned char* stop = dst + length;
+      do {
+        copy8(dst, src);
+        copy8(dst + 8, src + 8);
+        dst += 16;
+        src += 16;
+      } while(dst < stop);
+    } else if(distance >= 8) {
+      unsigned char* stop = dst + length;
+      do {
+        copy8(dst, src);
+        dst += 8;
+        src += 8;
+      } while(dst < stop);
+    } else if(distance == 1) {
+      lodepng_memset(dst, src[0], length);
+    } else {
+      size_t i;
+      for(i = 0; i != length; ++i) dst[i] = src[i];
+    }
+    if(max_output_size && out->size > max_output_size) ERROR_BREAK(109); /*error, larger than max size*/
+  }
+
+  reader->bp = (size_t)(in - reader->data) * 8u - count;
+  return error;
+}
+#endif /*LODEPNG_FAST_INFLATE*/
+
 /*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
 static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
                                     unsigned btype, size_t max_output_size) {
@@ -1251,6 +1491,13 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
   if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
   else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
+#ifdef LODEPNG_FAST_INFLATE
+  /*the fast path stops near the end of the input, the loop below decodes the rest*/
+  if(!error) error = inflateHuffmanFast(out, reader, &tree_ll, &tree_d, max_output_size, &done);
+  if(!error && !done && out->allocsize - out->size < reserved_size) {
+    if(!ucvector_reserve(out, out->size + reserved_size)) error = 83; /*alloc fail*/
+  }
+#endif /*LODEPNG_FAST_INFLATE*/
 
   while(!error && !done) /*decode all symbols until end reached, breaks at end code*/ {
     /*code_ll is literal, length or end code*/
@@ -2729,6 +2976,325 @@ static void setBitOfReversedStream(size_t* bitpointer, unsigned char* bitstream,
   ++(*bitpointer);
 }
 
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / SIMD unfiltering and color conversion                                  / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*
+Versions of the scanline unfilters for 3 and 4 byte pixels, and of the conversions to RGBA8 that decode32
+needs most, with SSE2 (always there on x86-64), SSSE3 and AVX2. The CPU is checked at runtime, so one build
+runs everywhere. They give exactly the same bytes as the scalar code, which does every case they don't cover.
+*/
+#if defined(LODEPNG_SIMD_X86) && defined(LODEPNG_COMPILE_PNG)
+
+#define LODEPNG_SIMD_SSE2 1
+#define LODEPNG_SIMD_SSSE3 2
+#define LODEPNG_SIMD_AVX2 3
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LODEPNG_TARGET(features) __attribute__((target(features)))
+#else
+#define LODEPNG_TARGET(features) /*MSVC allows all intrinsics without flags*/
+#endif
+
+#if defined(__GNUC__)
+static int lodepng_simd_level(void) {
+  if(__builtin_cpu_supports("avx2")) return LODEPNG_SIMD_AVX2;
+  if(__builtin_cpu_supports("ssse3")) return LODEPNG_SIMD_SSSE3;
+  return LODEPNG_SIMD_SSE2;
+}
+#else
+LODEPNG_TARGET("xsave")
+static int lodepng_simd_level(void) {
+  int info[4];
+  __cpuid(info, 1);
+  /*AVX2 also needs the OS to save the ymm registers (OSXSAVE and the XCR0 bits)*/
+  if((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+    int extended[4];
+    __cpuidex(extended, 7, 0);
+    if(extended[1] & (1 << 5)) return LODEPNG_SIMD_AVX2;
+  }
+  if(info[2] & (1 << 9)) return LODEPNG_SIMD_SSSE3;
+  return LODEPNG_SIMD_SSE2;
+}
+#endif
+
+/*loads and stores of a single 3 or 4 byte pixel, in the low bytes of the register*/
+static LODEPNG_INLINE __m128i loadPixel(const unsigned char* p, size_t bytewidth) {
+  unsigned value;
+  if(bytewidth == 4) lodepng_memcpy(&value, p, 4); /*a constant size, so a single move*/
+  else value = p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u);
+  return _mm_cvtsi32_si128((int)value);
+}
+
+static LODEPNG_INLINE void storePixel(unsigned char* p, __m128i pixel, size_t bytewidth) {
+  unsigned value = (unsigned)_mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) {
+    lodepng_memcpy(p, &value, 4);
+  } else {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8u);
+    p[2] = (unsigned char)(value >> 16u);
+  }
+}
+
+static LODEPNG_INLINE __m128i selectBytes(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+#ifdef LODEPNG_COMPILE_DECODER
+
+/*The unfilters below have the same contract as unfilterScanline, the scanlines of Average and Paeth hold whole
+pixels. recon may also be before scanline in the same buffer, so they load every byte of scanline before they
+store over it.*/
+
+/*the remaining bytes of a Sub scanline*/
+static void unfilterSubTail(unsigned char* recon, const unsigned char* scanline, size_t bytewidth,
+                            size_t i, size_t length) {
+  for(; i < bytewidth && i != length; ++i) recon[i] = scanline[i];
+  for(; i != length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
+}
+
+/*Sub adds the pixel on the left, which is a prefix sum: 4 pixels at a time with two shifted adds, plus the last
+pixel of the previous block*/
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length) {
+  __m128i left = _mm_setzero_si128();
+  size_t i = 0;
+  if(bytewidth == 4) {
+    for(; i + 16 <= length; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, left);
+      _mm_storeu_si128((__m128i*)(recon + i), x);
+      left = _mm_shuffle_epi32(x, 0xff);
+    }
+  } else /*bytewidth == 3, 12 bytes per block*/ {
+    const __m128i low = _mm_setr_epi32(0xffffff, 0, 0, 0);
+    for(; i + 16 <= length; i += 12) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+      x = _mm_add_epi8(x, left);
+      _mm_storel_epi64((__m128i*)(recon + i), x);
+      storePixel(recon + i + 8, _mm_srli_si128(x, 8), 4);
+      left = _mm_and_si128(_mm_srli_si128(x, 9), low);
+      left = _mm_add_epi8(left, _mm_slli_si128(left, 3));
+      left = _mm_add_epi8(left, _mm_slli_si128(left, 6));
+    }
+  }
+  unfilterSubTail(recon, scanline, bytewidth, i, length);
+}
+
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t i, size_t length) {
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+    _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+LODEPNG_TARGET("avx2")
+static void unfilterUpAVX2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length) {
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(scanline + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(precon + i));
+    _mm256_storeu_si256((__m256i*)(recon + i), _mm256_add_epi8(x, b));
+  }
+  unfilterUpSSE2(recon, scanline, precon, i, length);
+}
+
+/*Average depends on the pixel on the left, so this goes one pixel at a time. _mm_avg_epu8 rounds up, the scalar
+code rounds down*/
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length) {
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i + bytewidth <= length; i += bytewidth) {
+    __m128i b = loadPixel(precon + i, bytewidth);
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(loadPixel(scanline + i, bytewidth), average);
+    storePixel(recon + i, a, bytewidth);
+  }
+}
+
+/*paethPredictor on the channels of a pixel in 16-bit lanes: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, and
+the first of a, b, c whose distance is the smallest*/
+static LODEPNG_INLINE __m128i paethNearest(__m128i a, __m128i b, __m128i c, __m128i pa, __m128i pb, __m128i pc) {
+  __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  __m128i nearest = selectBytes(_mm_cmpeq_epi16(smallest, pb), b, c);
+  return selectBytes(_mm_cmpeq_epi16(smallest, pa), a, nearest);
+}
+
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i + bytewidth <= length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(loadPixel(precon + i, bytewidth), zero);
+    __m128i x = _mm_unpacklo_epi8(loadPixel(scanline + i, bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    a = _mm_and_si128(_mm_add_epi16(x, paethNearest(a, b, c, pa, pb, pc)), _mm_set1_epi16(255));
+    storePixel(recon + i, _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*the same with the absolute values of SSSE3*/
+LODEPNG_TARGET("ssse3")
+static void unfilterPaethSSSE3(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                               size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i + bytewidth <= length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(loadPixel(precon + i, bytewidth), zero);
+    __m128i x = _mm_unpacklo_epi8(loadPixel(scanline + i, bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+    pa = _mm_abs_epi16(pa);
+    pb = _mm_abs_epi16(pb);
+    a = _mm_and_si128(_mm_add_epi16(x, paethNearest(a, b, c, pa, pb, pc)), _mm_set1_epi16(255));
+    storePixel(recon + i, _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*unfilters a scanline like unfilterScanline if there is a kernel for it, returns 0 if not. Up works for any
+pixel size, the others for 3 and 4 byte pixels, and only Sub for the first scanline*/
+static int unfilterScanlineSimd(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, unsigned char filterType, size_t length, int level) {
+  if(filterType == 2) {
+    if(!precon) return 0;
+    if(level >= LODEPNG_SIMD_AVX2) unfilterUpAVX2(recon, scanline, precon, length);
+    else unfilterUpSSE2(recon, scanline, precon, 0, length);
+    return 1;
+  }
+  if((bytewidth != 3 && bytewidth != 4) || length % bytewidth != 0) return 0;
+  if(filterType == 1) {
+    unfilterSubSSE2(recon, scanline, bytewidth, length);
+    return 1;
+  }
+  if(!precon) return 0;
+  if(filterType == 3) {
+    unfilterAverageSSE2(recon, scanline, precon, bytewidth, length);
+    return 1;
+  }
+  if(filterType == 4) {
+    if(level >= LODEPNG_SIMD_SSSE3) unfilterPaethSSSE3(recon, scanline, precon, bytewidth, length);
+    else unfilterPaethSSE2(recon, scanline, precon, bytewidth, length);
+    return 1;
+  }
+  return 0;
+}
+
+#endif /*LODEPNG_COMPILE_DECODER*/
+
+/*The conversions write whole blocks of pixels and return how many they did, the scalar loops do the rest*/
+
+static size_t convertGreyToRGBA8SSE2(unsigned char* buffer, const unsigned char* in, size_t numpixels) {
+  const __m128i opaque = _mm_set1_epi8((char)255);
+  size_t i;
+  for(i = 0; i + 16 <= numpixels; i += 16, buffer += 64) {
+    __m128i grey = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i gg0 = _mm_unpacklo_epi8(grey, grey), gg1 = _mm_unpackhi_epi8(grey, grey);
+    __m128i ga0 = _mm_unpacklo_epi8(grey, opaque), ga1 = _mm_unpackhi_epi8(grey, opaque);
+    _mm_storeu_si128((__m128i*)(buffer + 0), _mm_unpacklo_epi16(gg0, ga0));
+    _mm_storeu_si128((__m128i*)(buffer + 16), _mm_unpackhi_epi16(gg0, ga0));
+    _mm_storeu_si128((__m128i*)(buffer + 32), _mm_unpacklo_epi16(gg1, ga1));
+    _mm_storeu_si128((__m128i*)(buffer + 48), _mm_unpackhi_epi16(gg1, ga1));
+  }
+  return i;
+}
+
+/*each grey and alpha pair x becomes x & 255 | (x & 255) << 8 | x << 16*/
+static size_t convertGreyAlphaToRGBA8SSE2(unsigned char* buffer, const unsigned char* in, size_t numpixels) {
+  const __m128i zero = _mm_setzero_si128(), low = _mm_set1_epi32(255);
+  size_t i;
+  for(i = 0; i + 8 <= numpixels; i += 8, buffer += 32) {
+    __m128i pairs = _mm_loadu_si128((const __m128i*)(in + i * 2));
+    __m128i x0 = _mm_unpacklo_epi16(pairs, zero), x1 = _mm_unpackhi_epi16(pairs, zero);
+    __m128i g0 = _mm_and_si128(x0, low), g1 = _mm_and_si128(x1, low);
+    x0 = _mm_or_si128(_mm_or_si128(g0, _mm_slli_epi32(g0, 8)), _mm_slli_epi32(x0, 16));
+    x1 = _mm_or_si128(_mm_or_si128(g1, _mm_slli_epi32(g1, 8)), _mm_slli_epi32(x1, 16));
+    _mm_storeu_si128((__m128i*)(buffer + 0), x0);
+    _mm_storeu_si128((__m128i*)(buffer + 16), x1);
+  }
+  return i;
+}
+
+/*4 pixels from the first 12 of 16 loaded bytes, so the loop stops while 16 bytes are still left to load*/
+LODEPNG_TARGET("ssse3")
+static size_t convertRGBToRGBA8SSSE3(unsigned char* buffer, const unsigned char* in, size_t numpixels) {
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i opaque = _mm_set1_epi32((int)0xff000000u);
+  size_t i;
+  for(i = 0; i + 6 <= numpixels; i += 4, buffer += 16) {
+    __m128i rgb = _mm_loadu_si128((const __m128i*)(in + i * 3));
+    _mm_storeu_si128((__m128i*)buffer, _mm_or_si128(_mm_shuffle_epi8(rgb, spread), opaque));
+  }
+  return i;
+}
+
+LODEPNG_TARGET("avx2")
+static size_t convertRGBToRGBA8AVX2(unsigned char* buffer, const unsigned char* in, size_t numpixels) {
+  const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                          0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i opaque = _mm256_set1_epi32((int)0xff000000u);
+  size_t i;
+  for(i = 0; i + 10 <= numpixels; i += 8, buffer += 32) {
+    __m128i low = _mm_loadu_si128((const __m128i*)(in + i * 3));
+    __m128i high = _mm_loadu_si128((const __m128i*)(in + i * 3 + 12));
+    __m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+    _mm256_storeu_si256((__m256i*)buffer, _mm256_or_si256(_mm256_shuffle_epi8(rgb, spread), opaque));
+  }
+  return i;
+}
+
+/*the palette always has room for 256 colors, see lodepng_color_mode_alloc_palette*/
+LODEPNG_TARGET("avx2")
+static size_t convertPaletteToRGBA8AVX2(unsigned char* buffer, const unsigned char* in, size_t numpixels,
+                                        const unsigned char* palette) {
+  size_t i;
+  for(i = 0; i + 8 <= numpixels; i += 8, buffer += 32) {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+    _mm256_storeu_si256((__m256i*)buffer, _mm256_i32gather_epi32((const int*)palette, index, 4));
+  }
+  return i;
+}
+
+/*converts the first pixels of an 8-bit image to RGBA8 for getPixelColorsRGBA8, returns how many it converted*/
+static size_t convertRGBA8Simd(unsigned char* buffer, size_t numpixels, const unsigned char* in,
+                               const LodePNGColorMode* mode) {
+  int level;
+  if(mode->bitdepth != 8) return 0;
+  level = lodepng_simd_level();
+  switch(mode->colortype) {
+    case LCT_GREY: return convertGreyToRGBA8SSE2(buffer, in, numpixels);
+    case LCT_GREY_ALPHA: return convertGreyAlphaToRGBA8SSE2(buffer, in, numpixels);
+    case LCT_RGB:
+      if(level >= LODEPNG_SIMD_AVX2) return convertRGBToRGBA8AVX2(buffer, in, numpixels);
+      if(level >= LODEPNG_SIMD_SSSE3) return convertRGBToRGBA8SSSE3(buffer, in, numpixels);
+      return 0;
+    case LCT_PALETTE:
+      if(level >= LODEPNG_SIMD_AVX2) return convertPaletteToRGBA8AVX2(buffer, in, numpixels, mode->palette);
+      return 0;
+    default: return 0;
+  }
+}
+
+#endif /*LODEPNG_SIMD_X86 && LODEPNG_COMPILE_PNG*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / PNG chunks                                                             / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -3600,10 +4166,15 @@ static void getPixelColorsRGBA8(unsigned char* LODEPNG_RESTRICT buffer, size_t n
                                 const unsigned char* LODEPNG_RESTRICT in,
                                 const LodePNGColorMode* mode) {
   unsigned num_channels = 4;
-  size_t i;
+  size_t i = 0;
+#ifdef LODEPNG_SIMD_X86
+  /*the loops of the 8-bit cases go on from the pixels this converted*/
+  i = convertRGBA8Simd(buffer, numpixels, in, mode);
+  buffer += i * num_channels;
+#endif /*LODEPNG_SIMD_X86*/
   if(mode->colortype == LCT_GREY) {
     if(mode->bitdepth == 8) {
-      for(i = 0; i != numpixels; ++i, buffer += num_channels) {
+      for(; i != numpixels; ++i, buffer += num_channels) {
         buffer[0] = buffer[1] = buffer[2] = in[i];
         buffer[3] = 255;
       }
@@ -3629,7 +4200,7 @@ static void getPixelColorsRGBA8(unsigned char* LODEPNG_RESTRICT buffer, size_t n
     }
   } else if(mode->colortype == LCT_RGB) {
     if(mode->bitdepth == 8) {
-      for(i = 0; i != numpixels; ++i, buffer += num_channels) {
+      for(; i != numpixels; ++i, buffer += num_channels) {
         lodepng_memcpy(buffer, &in[i * 3], 3);
         buffer[3] = 255;
       }
@@ -3652,7 +4223,7 @@ static void getPixelColorsRGBA8(unsigned char* LODEPNG_RESTRICT buffer, size_t n
     }
   } else if(mode->colortype == LCT_PALETTE) {
     if(mode->bitdepth == 8) {
-      for(i = 0; i != numpixels; ++i, buffer += num_channels) {
+      for(; i != numpixels; ++i, buffer += num_channels) {
         unsigned index = in[i];
         /*out of bounds of palette not checked: see lodepng_color_mode_alloc_palette.*/
         lodepng_memcpy(buffer, &mode->palette[index * 4], 4);
@@ -3667,7 +4238,7 @@ static void getPixelColorsRGBA8(unsigned char* LODEPNG_RESTRICT buffer, size_t n
     }
   } else if(mode->colortype == LCT_GREY_ALPHA) {
     if(mode->bitdepth == 8) {
-      for(i = 0; i != numpixels; ++i, buffer += num_channels) {
+      for(; i != numpixels; ++i, buffer += num_channels) {
         buffer[0] = buffer[1] = buffer[2] = in[i * 2 + 0];
         buffer[3] = in[i * 2 + 1];
       }
@@ -4570,6 +5141,9 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
   unsigned y;
   unsigned char* prevline = 0;
+#ifdef LODEPNG_SIMD_X86
+  int level = lodepng_simd_level();
+#endif /*LODEPNG_SIMD_X86*/
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7u) / 8u;
@@ -4581,6 +5155,12 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
+#ifdef LODEPNG_SIMD_X86
+    if(unfilterScanlineSimd(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes, level)) {
+      prevline = &out[outindex];
+      continue;
+    }
+#endif /*LODEPNG_SIMD_X86*/
     CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
 
     prevline = &out[outindex];
@@ -6597,6 +7177,320 @@ cleanup:
   return state->error;
 }
 
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Streaming Encoder                                                      / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*Deflate matches reach at most this far back. The window keeps at least that much before the next block and
+moves in steps of it, so positions in it are the same modulo the hash window as in one buffer*/
+#define STREAM_HISTORY 32768u
+
+struct LodePNGStream {
+  unsigned w, h;
+  LodePNGStreamOutput output;
+  void* context;
+  unsigned error;
+
+  /*scanning*/
+  unsigned scanned; /*rows given to lodepng_stream_scan*/
+  LodePNGColorStats stats;
+  ColorTree tree;
+  /*a bit per RGB of the opaque pixels before the first transparent one, they rule out that color as key*/
+  unsigned char* opaque;
+
+  /*writing*/
+  unsigned written; /*rows given to lodepng_stream_write*/
+  LodePNGColorMode raw;
+  LodePNGColorMode color;
+  size_t linebytes, bytewidth;
+  unsigned minsum; /*adaptive filtering, or always filter None for palette and less than 8 bits*/
+  unsigned char* line; /*the row in the chosen color type*/
+  unsigned char* prevline;
+  unsigned char* attempt[5];
+  unsigned char* window; /*filtered bytes from windowpos to windowend*/
+  size_t windowpos, windowend;
+  size_t insize, blocksize, numblocks, block;
+  Hash hash;
+  ucvector zlib; /*compressed bytes not passed on yet, the last one may still get more bits*/
+  LodePNGBitWriter writer;
+  unsigned adler;
+};
+
+LodePNGStream* lodepng_stream_new(unsigned w, unsigned h, LodePNGStreamOutput output, void* context) {
+  LodePNGStream* stream = (LodePNGStream*)lodepng_malloc(sizeof(LodePNGStream));
+  if(!stream) return 0;
+  lodepng_memset(stream, 0, sizeof(LodePNGStream));
+  stream->w = w;
+  stream->h = h;
+  stream->output = output;
+  stream->context = context;
+  lodepng_color_stats_init(&stream->stats);
+  color_tree_init(&stream->tree);
+  lodepng_color_mode_init(&stream->raw);
+  lodepng_color_mode_init(&stream->color);
+  stream->zlib = ucvector_init(NULL, 0);
+  stream->adler = 1u;
+  return stream;
+}
+
+void lodepng_stream_delete(LodePNGStream* stream) {
+  unsigned i;
+  if(!stream) return;
+  color_tree_cleanup(&stream->tree);
+  lodepng_free(stream->opaque);
+  lodepng_color_mode_cleanup(&stream->raw);
+  lodepng_color_mode_cleanup(&stream->color);
+  lodepng_free(stream->line);
+  lodepng_free(stream->prevline);
+  for(i = 0; i != 5; ++i) lodepng_free(stream->attempt[i]);
+  lodepng_free(stream->window);
+  hash_cleanup(&stream->hash);
+  lodepng_free(stream->zlib.data);
+  lodepng_free(stream);
+}
+
+static void stream_set_alpha(LodePNGColorStats* stats) {
+  stats->alpha = 1;
+  stats->key = 0;
+  if(stats->bits < 8) stats->bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
+}
+
+/*The same stats as lodepng_compute_color_stats gives for the whole image, a band at a time*/
+unsigned lodepng_stream_scan(LodePNGStream* stream, const unsigned char* rows, unsigned numrows) {
+  LodePNGColorStats* stats = &stream->stats;
+  size_t i, numpixels = (size_t)stream->w * numrows;
+  if(stream->error) return stream->error;
+  if(stream->written || stream->scanned + numrows > stream->h) return stream->error = 116;
+
+  for(i = 0; i != numpixels; ++i) {
+    unsigned char r = rows[i * 4 + 0], g = rows[i * 4 + 1], b = rows[i * 4 + 2], a = rows[i * 4 + 3];
+
+    if(stats->bits < 8) {
+      /*only r is checked, < 8 bits is only relevant for grayscale*/
+      unsigned bits = getValueRequiredBits(r);
+      if(bits > stats->bits) stats->bits = bits;
+    }
+
+    if(!stats->colored && (r != g || r != b)) {
+      stats->colored = 1;
+      if(stats->bits < 8) stats->bits = 8; /*PNG has no colored modes with less than 8-bit per channel*/
+    }
+
+    if(!stats->alpha) {
+      unsigned matchkey = (r == stats->key_r && g == stats->key_g && b == stats->key_b);
+      unsigned rgb = r | ((unsigned)g << 8u) | ((unsigned)b << 16u);
+      if(a != 255 && (a != 0 || (stats->key && !matchkey))) {
+        stream_set_alpha(stats);
+      } else if(a == 0 && !stats->key) {
+        stats->key = 1;
+        stats->key_r = r;
+        stats->key_g = g;
+        stats->key_b = b;
+        if(stream->opaque && (stream->opaque[rgb >> 3u] >> (rgb & 7u)) & 1u) stream_set_alpha(stats);
+        lodepng_free(stream->opaque);
+        stream->opaque = 0;
+      } else if(a == 255 && stats->key && matchkey) {
+        /* Color key cannot be used if an opaque pixel also has that RGB color. */
+        stream_set_alpha(stats);
+      } else if(a == 255 && !stats->key) {
+        if(!stream->opaque) {
+          stream->opaque = (unsigned char*)lodepng_malloc(1u << 21u);
+          if(!stream->opaque) return stream->error = 83; /*alloc fail*/
+          lodepng_memset(stream->opaque, 0, 1u << 21u);
+        }
+        stream->opaque[rgb >> 3u] |= (unsigned char)(1u << (rgb & 7u));
+      }
+    }
+
+    if(stats->numcolors < 257 && !color_tree_has(&stream->tree, r, g, b, a)) {
+      stream->error = color_tree_add(&stream->tree, r, g, b, a, stats->numcolors);
+      if(stream->error) return stream->error;
+      if(stats->numcolors < 256) {
+        unsigned char* p = stats->palette;
+        unsigned n = stats->numcolors;
+        p[n * 4 + 0] = r;
+        p[n * 4 + 1] = g;
+        p[n * 4 + 2] = b;
+        p[n * 4 + 3] = a;
+      }
+      ++stats->numcolors;
+    }
+  }
+
+  stream->scanned += numrows;
+  return 0;
+}
+
+static unsigned stream_output(LodePNGStream* stream, ucvector* v) {
+  if(!stream->error && stream->output(stream->context, v->data, v->size)) stream->error = 79;
+  lodepng_free(v->data);
+  *v = ucvector_init(NULL, 0);
+  return stream->error;
+}
+
+/*Chooses the color type and writes everything up to the image data*/
+static unsigned stream_begin(LodePNGStream* stream) {
+  LodePNGColorStats* stats = &stream->stats;
+  ucvector header = ucvector_init(NULL, 0);
+  unsigned i, bpp, CMFFLG;
+  if(stream->scanned != stream->h) return stream->error = 116;
+
+  stats->numpixels = (size_t)stream->w * stream->h;
+  /*make the stats's key always 16-bit for consistency - repeat each byte twice*/
+  stats->key_r += (stats->key_r << 8);
+  stats->key_g += (stats->key_g << 8);
+  stats->key_b += (stats->key_b << 8);
+  stream->error = auto_choose_color(&stream->color, &stream->raw, stats);
+  if(stream->error) return stream->error;
+
+  bpp = lodepng_get_bpp(&stream->color);
+  stream->linebytes = lodepng_get_raw_size_idat(stream->w, 1, bpp) - 1u;
+  stream->bytewidth = (bpp + 7u) / 8u;
+  stream->minsum = !(stream->color.colortype == LCT_PALETTE || stream->color.bitdepth < 8);
+
+  /*the same deflate blocks as lodepng_deflatev*/
+  stream->insize = (stream->linebytes + 1u) * stream->h;
+  stream->blocksize = stream->insize / 8u + 8u;
+  if(stream->blocksize < 65536) stream->blocksize = 65536;
+  if(stream->blocksize > 262144) stream->blocksize = 262144;
+  stream->numblocks = (stream->insize + stream->blocksize - 1u) / stream->blocksize;
+  if(stream->numblocks == 0) stream->numblocks = 1;
+
+  stream->line = (unsigned char*)lodepng_malloc(stream->linebytes + 1u);
+  stream->prevline = (unsigned char*)lodepng_malloc(stream->linebytes + 1u);
+  stream->window = (unsigned char*)lodepng_malloc(2u * STREAM_HISTORY + stream->blocksize + stream->linebytes + 1u);
+  if(!stream->line || !stream->prevline || !stream->window) return stream->error = 83; /*alloc fail*/
+  for(i = 0; stream->minsum && i != 5; ++i) {
+    stream->attempt[i] = (unsigned char*)lodepng_malloc(stream->linebytes + 1u);
+    if(!stream->attempt[i]) return stream->error = 83; /*alloc fail*/
+  }
+  stream->error = hash_init(&stream->hash, lodepng_default_compress_settings.windowsize);
+  if(stream->error) return stream->error;
+
+  /*zlib header, like lodepng_zlib_compress*/
+  CMFFLG = 256 * 120;
+  CMFFLG += 31 - CMFFLG % 31;
+  if(!ucvector_resize(&stream->zlib, 2)) return stream->error = 83; /*alloc fail*/
+  stream->zlib.data[0] = (unsigned char)(CMFFLG >> 8);
+  stream->zlib.data[1] = (unsigned char)(CMFFLG & 255);
+  LodePNGBitWriter_init(&stream->writer, &stream->zlib);
+
+  stream->error = writeSignature(&header);
+  if(!stream->error) {
+    stream->error = addChunk_IHDR(&header, stream->w, stream->h, stream->color.colortype, stream->color.bitdepth, 0);
+  }
+  if(!stream->error && stream->color.colortype == LCT_PALETTE) stream->error = addChunk_PLTE(&header, &stream->color);
+  if(!stream->error) stream->error = addChunk_tRNS(&header, &stream->color);
+  if(stream->error) {
+    lodepng_free(header.data);
+    return stream->error;
+  }
+  return stream_output(stream, &header);
+}
+
+/*Compresses the next deflate block and passes the finished bytes on as an IDAT chunk*/
+static unsigned stream_deflate(LodePNGStream* stream) {
+  size_t start = stream->block * stream->blocksize;
+  size_t end = LODEPNG_MIN(start + stream->blocksize, stream->insize);
+  size_t done, windowpos;
+  unsigned final = stream->block == stream->numblocks - 1;
+  ucvector chunk = ucvector_init(NULL, 0);
+
+  stream->error = deflateDynamic(&stream->writer, &stream->hash, stream->window, start - stream->windowpos,
+                                 end - stream->windowpos, &lodepng_default_compress_settings, final);
+  if(stream->error) return stream->error;
+  ++stream->block;
+
+  if(final) {
+    if(!ucvector_resize(&stream->zlib, stream->zlib.size + 4)) return stream->error = 83; /*alloc fail*/
+    lodepng_set32bitInt(&stream->zlib.data[stream->zlib.size - 4], stream->adler);
+  }
+  done = final || (stream->writer.bp & 7u) == 0 ? stream->zlib.size : stream->zlib.size - 1u;
+  stream->error = lodepng_chunk_createv(&chunk, done, "IDAT", stream->zlib.data);
+  if(stream->error) {
+    lodepng_free(chunk.data);
+    return stream->error;
+  }
+  lodepng_memmove(stream->zlib.data, stream->zlib.data + done, stream->zlib.size - done);
+  stream->zlib.size -= done;
+
+  windowpos = end > STREAM_HISTORY ? (end - STREAM_HISTORY) / STREAM_HISTORY * STREAM_HISTORY : 0;
+  lodepng_memmove(stream->window, stream->window + (windowpos - stream->windowpos), stream->windowend - windowpos);
+  stream->windowpos = windowpos;
+  return stream_output(stream, &chunk);
+}
+
+unsigned lodepng_stream_write(LodePNGStream* stream, const unsigned char* rows, unsigned numrows) {
+  unsigned y, type;
+  if(stream->error) return stream->error;
+  if(stream->written + numrows > stream->h) return stream->error = 116;
+  if(stream->written == 0 && stream_begin(stream)) return stream->error;
+
+  for(y = 0; y != numrows; ++y) {
+    const unsigned char* in = &rows[(size_t)y * stream->w * 4u];
+    const unsigned char* prevline = stream->written ? stream->prevline : 0;
+    unsigned char* out = &stream->window[stream->windowend - stream->windowpos];
+
+    if(lodepng_color_mode_equal(&stream->raw, &stream->color)) {
+      lodepng_memcpy(stream->line, in, stream->linebytes);
+    } else {
+      stream->error = lodepng_convert(stream->line, in, &stream->color, &stream->raw, stream->w, 1);
+      if(stream->error) return stream->error;
+    }
+
+    /*the same filter types as the filter function*/
+    if(!stream->minsum) {
+      out[0] = 0;
+      filterScanline(&out[1], stream->line, prevline, stream->linebytes, stream->bytewidth, 0);
+    } else {
+      size_t x, sum, smallest = 0;
+      unsigned char bestType = 0;
+      for(type = 0; type != 5; ++type) {
+        sum = 0;
+        filterScanline(stream->attempt[type], stream->line, prevline, stream->linebytes, stream->bytewidth,
+                       (unsigned char)type);
+        if(type == 0) {
+          for(x = 0; x != stream->linebytes; ++x) sum += (unsigned char)(stream->attempt[type][x]);
+        } else {
+          for(x = 0; x != stream->linebytes; ++x) {
+            unsigned char s = stream->attempt[type][x];
+            sum += s < 128 ? s : (255U - s);
+          }
+        }
+        if(type == 0 || sum < smallest) {
+          bestType = (unsigned char)type;
+          smallest = sum;
+        }
+      }
+      out[0] = bestType;
+      lodepng_memcpy(&out[1], stream->attempt[bestType], stream->linebytes);
+    }
+
+    stream->adler = update_adler32(stream->adler, out, (unsigned)(stream->linebytes + 1u));
+    stream->windowend += stream->linebytes + 1u;
+    lodepng_memcpy(stream->prevline, stream->line, stream->linebytes);
+    ++stream->written;
+
+    while(stream->block != stream->numblocks &&
+          stream->windowend >= LODEPNG_MIN((stream->block + 1u) * stream->blocksize, stream->insize)) {
+      if(stream_deflate(stream)) return stream->error;
+    }
+  }
+  return 0;
+}
+
+unsigned lodepng_stream_finish(LodePNGStream* stream) {
+  ucvector end = ucvector_init(NULL, 0);
+  if(stream->error) return stream->error;
+  if(stream->written != stream->h || stream->block != stream->numblocks) return stream->error = 116;
+  stream->error = addChunk_IEND(&end);
+  if(stream->error) {
+    lodepng_free(end.data);
+    return stream->error;
+  }
+  return stream_output(stream, &end);
+}
+
 unsigned lodepng_encode_memory(unsigned char** out, size_t* outsize, const unsigned char* image,
                                unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth) {
   unsigned error;
@@ -6785,6 +7679,7 @@ const char* lodepng_error_text(unsigned code) {
     case 113: return "ICC profile unreasonably large";
     case 114: return "sBIT chunk has wrong size for the color type of the image";
     case 115: return "sBIT value out of range";
+    case 116: return "rows given to the streaming encoder out of order or not all of them";
   }
   return "unknown error code";
 }
@@ -912,6 +912,23 @@ unsigned lodepng_inspect_chunk(LodePNGState* state, size_t pos,
 unsigned lodepng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         LodePNGState* state);
+
+/*
+Streaming encoder for RGBA 8-bit images that are made a band of rows at a time. It chooses the same color
+type as lodepng_encode32 with auto_convert and writes the same compressed image data, split into one IDAT
+chunk per deflate block, with the default encoder settings. The rows are given twice, from top to bottom:
+first to lodepng_stream_scan to choose the color type, then to lodepng_stream_write, which hands every finished
+part of the file to the output callback. Only a row, the deflate block and its window are kept in memory.
+*/
+typedef unsigned (*LodePNGStreamOutput)(void* context, const unsigned char* data, size_t size);
+typedef struct LodePNGStream LodePNGStream;
+/*Returns NULL if out of memory. The output callback returns nonzero to stop with error 79*/
+LodePNGStream* lodepng_stream_new(unsigned w, unsigned h, LodePNGStreamOutput output, void* context);
+unsigned lodepng_stream_scan(LodePNGStream* stream, const unsigned char* rows, unsigned numrows);
+unsigned lodepng_stream_write(LodePNGStream* stream, const unsigned char* rows, unsigned numrows);
+/*Writes the end of the file after the last row*/
+unsigned lodepng_stream_finish(LodePNGStream* stream);
+void lodepng_stream_delete(LodePNGStream* stream);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 /*
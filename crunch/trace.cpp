@@ -0,0 +1,116 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "buffer.hpp"
+#include "metadata.hpp"
+
+using namespace std;
+
+struct TraceEvent
+{
+    const char *name;
+    double start;
+    double duration;
+    string detail;
+};
+
+// Every thread records into its own buffer, so spans never wait for each other
+struct TraceThread
+{
+    int id;
+    vector<TraceEvent> events;
+};
+
+static const chrono::steady_clock::time_point traceStart = chrono::steady_clock::now();
+
+// Never destroyed, the pool threads may still hold their buffers when the program exits
+static mutex &threadsLock = *new mutex();
+static vector<unique_ptr<TraceThread>> &threads = *new vector<unique_ptr<TraceThread>>();
+
+static thread_local TraceThread *currentThread = nullptr;
+
+double TraceTime()
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - traceStart).count();
+}
+
+void AddTraceSpan(const char *name, double start, const string *detail)
+{
+    double end = TraceTime();
+    if (!currentThread)
+    {
+        lock_guard<mutex> guard(threadsLock);
+        threads.push_back(make_unique<TraceThread>());
+        currentThread = threads.back().get();
+        currentThread->id = static_cast<int>(threads.size());
+    }
+    currentThread->events.push_back({name, start, end - start, detail ? *detail : string()});
+}
+
+static void WriteJsonString(Buffer &json, const string &value)
+{
+    json << '"';
+    for (char c : value)
+    {
+        // Control characters such as tabs in file names have to be escaped as well
+        if (static_cast<unsigned char>(c) < 0x20)
+        {
+            const char *digits = "0123456789abcdef";
+            json << "\\u00" << digits[c >> 4] << digits[c & 0xf];
+            continue;
+        }
+        if (c == '"' || c == '\\')
+            json << '\\';
+        json << c;
+    }
+    json << '"';
+}
+
+// Microseconds with a fixed precision of a nanosecond
+static void WriteTime(Buffer &json, double time)
+{
+    int64_t nanoseconds = static_cast<int64_t>(time * 1000.0 + 0.5);
+    string fraction = to_string(nanoseconds % 1000);
+    json << nanoseconds / 1000 << '.' << string(3 - fraction.size(), '0') << fraction;
+}
+
+void SaveTrace(const string &file)
+{
+    lock_guard<mutex> guard(threadsLock);
+
+    size_t eventCount = 0;
+    for (auto &thread : threads)
+        eventCount += thread->events.size() + 1;
+
+    Buffer json;
+    json.data.reserve(128 + eventCount * 128);
+    json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    json << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"crunch\"}}";
+    for (auto &thread : threads)
+    {
+        json << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->id << ", \"args\": {\"name\": \"";
+        json << (thread.get() == currentThread ? string("main") : "worker " + to_string(thread->id)) << "\"}}";
+        for (auto &event : thread->events)
+        {
+            json << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"crunch\", \"ph\": \"X\", \"ts\": ";
+            WriteTime(json, event.start);
+            json << ", \"dur\": ";
+            WriteTime(json, event.duration);
+            json << ", \"pid\": 1, \"tid\": " << thread->id;
+            if (!event.detail.empty())
+            {
+                json << ", \"args\": {\"detail\": ";
+                WriteJsonString(json, event.detail);
+                json << '}';
+            }
+            json << '}';
+        }
+    }
+    json << "\n]}\n";
+
+    SaveBuffer(json, file);
+}
@@ -0,0 +1,49 @@
+#ifndef trace_hpp
+#define trace_hpp
+
+#include <cstdint>
+#include <string>
+
+#include "options.hpp"
+
+using namespace std;
+
+// Microseconds since the program started
+double TraceTime();
+
+// Adds a finished span to the trace buffer of the calling thread
+void AddTraceSpan(const char *name, double start, const string *detail);
+
+// Times its lifetime as a span of the --trace file. While tracing is off it only checks the
+// options, so it can stay in hot code like the rectangle placement of the packer
+struct TraceSpan
+{
+    explicit TraceSpan(const char *name, const string *detail = nullptr)
+        : name(name), detail(detail), start(options.trace.empty() ? -1.0 : TraceTime())
+    {
+    }
+
+    TraceSpan(const char *name, const string &detail)
+        : TraceSpan(name, &detail)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (start >= 0.0)
+            AddTraceSpan(name, start, detail);
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    const string *detail;
+    double start;
+};
+
+// Writes every span recorded so far as Chrome trace-event JSON, which chrome://tracing and Perfetto can open
+void SaveTrace(const string &file);
+
+#endif
@@ -0,0 +1,352 @@
+#include "watch.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "bitmap.hpp"
+#include "hash.hpp"
+#include "log.hpp"
+#include "options.hpp"
+#include "packer.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "pixelcache.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// How long the inputs have to be quiet before an update, editors often save in several steps
+const int settleMilliseconds = 100;
+const int pollMilliseconds = 250;
+
+FileWatcher::FileWatcher()
+{
+#ifdef __linux__
+    descriptor = inotify_init1(IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (descriptor >= 0)
+        close(descriptor);
+#endif
+}
+
+void FileWatcher::Watch(const string &directory)
+{
+#ifdef __linux__
+    if (descriptor < 0)
+        return;
+
+    const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    inotify_add_watch(descriptor, directory.c_str(), mask);
+    error_code error;
+    for (auto &entry : fs::recursive_directory_iterator(directory, error))
+        if (entry.is_directory())
+            inotify_add_watch(descriptor, entry.path().c_str(), mask);
+#endif
+}
+
+void FileWatcher::Wait()
+{
+#ifdef __linux__
+    if (descriptor >= 0)
+    {
+        // The events themselves aren't needed, the inputs are compared to the cache afterwards
+        char events[4096];
+        pollfd fd = {descriptor, POLLIN, 0};
+        if (poll(&fd, 1, -1) > 0)
+        {
+            while (read(descriptor, events, sizeof(events)) > 0 && poll(&fd, 1, settleMilliseconds) > 0)
+                ;
+            return;
+        }
+    }
+#endif
+    this_thread::sleep_for(chrono::milliseconds(pollMilliseconds));
+}
+
+struct CachedImage
+{
+    string name;
+    fs::file_time_type time;
+    uintmax_t size = 0;
+    Bitmap *bitmap = nullptr;
+};
+
+// Everything kept in memory between updates
+struct WarmAtlas
+{
+    string outputName;
+    string name;
+    vector<string> inputs;
+    unordered_map<string, CachedImage> images;
+    vector<Packer *> packers;
+    vector<uint64_t> pageHashes;
+    bool noZero = false;
+};
+
+// Identifies the pixels of a page, pages with the same hash don't need to be encoded again
+static uint64_t PageHash(const Packer &packer)
+{
+    uint64_t hash = 0;
+    HashCombine(hash, packer.width);
+    HashCombine(hash, packer.height);
+    for (size_t i = 0; i < packer.bitmaps.size(); ++i)
+    {
+        const Point &point = packer.points[i];
+        if (point.dupID >= 0)
+            continue;
+        HashCombine(hash, packer.bitmaps[i]->hashValue);
+        HashCombine(hash, point.x);
+        HashCombine(hash, point.y);
+        HashCombine(hash, point.rot);
+    }
+    return hash;
+}
+
+// The changed bitmaps can replace the old ones in the existing packing if they have the same size
+// and, with --unique, no duplicates are found or lost by the change
+static bool CanSwap(const WarmAtlas &atlas, const unordered_map<const Bitmap *, Bitmap *> &swaps)
+{
+    for (auto &[oldBitmap, newBitmap] : swaps)
+        if (oldBitmap->width != newBitmap->width || oldBitmap->height != newBitmap->height)
+            return false;
+
+    if (!options.unique)
+        return true;
+
+    for (auto packer : atlas.packers)
+    {
+        unordered_set<uint64_t> hashes;
+        for (size_t i = 0; i < packer->bitmaps.size(); ++i)
+        {
+            auto swap = swaps.find(packer->bitmaps[i]);
+            const Point &point = packer->points[i];
+            if (swap != swaps.end() && point.dupID >= 0)
+                return false;
+            if (point.dupID >= 0)
+            {
+                if (swaps.count(packer->bitmaps[point.dupID]))
+                    return false;
+                continue;
+            }
+            const Bitmap *bitmap = swap != swaps.end() ? swap->second : packer->bitmaps[i];
+            if (!hashes.insert(bitmap->hashValue).second)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void Update(WarmAtlas &atlas)
+{
+    auto start = chrono::steady_clock::now();
+
+    vector<ImageFile> files;
+    FindImages(atlas.inputs, "", files);
+
+    // Find the new and changed images by their write time and size
+    vector<int> changed;
+    vector<fs::file_time_type> times(files.size());
+    vector<uintmax_t> sizes(files.size());
+    unordered_set<string> listed;
+    for (int i = 0; i < files.size(); ++i)
+    {
+        error_code error;
+        times[i] = fs::last_write_time(files[i].path, error);
+        sizes[i] = fs::file_size(files[i].path, error);
+        listed.insert(files[i].path);
+
+        auto cached = atlas.images.find(files[i].path);
+        if (cached == atlas.images.end() || cached->second.time != times[i] || cached->second.size != sizes[i] ||
+            cached->second.name != files[i].name)
+            changed.push_back(i);
+    }
+
+    vector<string> removed;
+    for (auto &[path, image] : atlas.images)
+        if (!listed.count(path))
+            removed.push_back(path);
+
+    if (!atlas.packers.empty() && changed.empty() && removed.empty())
+        return;
+
+    // Decode only the changed images
+    vector<Bitmap *> decoded(changed.size());
+    vector<string> errors(changed.size());
+    ParallelFor(static_cast<int>(changed.size()), [&](int i)
+                {
+        const ImageFile &file = files[changed[i]];
+        if (options.verbose)
+            Out() << '\t' << file.path << endl;
+        decoded[i] = DecodeBitmap(file.path, file.name, errors[i]); });
+
+    // A file that's still being written often fails to decode, the packing and textures stay as they are and
+    // the image is decoded again on the next change
+    bool failed = false;
+    for (auto &error : errors)
+        if (!error.empty())
+        {
+            cerr << error << endl;
+            failed = true;
+        }
+    if (failed)
+    {
+        for (auto bitmap : decoded)
+            delete bitmap;
+        Out() << "kept atlas: " << atlas.name << " (images failed to load, waiting for the next change)" << endl;
+        return;
+    }
+
+    unordered_map<const Bitmap *, Bitmap *> swaps;
+    bool keepPacking = !atlas.packers.empty() && removed.empty();
+    for (int i = 0; i < changed.size() && keepPacking; ++i)
+    {
+        auto cached = atlas.images.find(files[changed[i]].path);
+        if (cached == atlas.images.end())
+            keepPacking = false;
+        else
+            swaps[cached->second.bitmap] = decoded[i];
+    }
+    keepPacking = keepPacking && CanSwap(atlas, swaps);
+
+    if (keepPacking)
+    {
+        // Keep the packing, only the pixels of the swapped bitmaps changed
+        for (auto packer : atlas.packers)
+        {
+            for (size_t i = 0; i < packer->bitmaps.size(); ++i)
+            {
+                auto replacement = swaps.find(packer->bitmaps[i]);
+                if (replacement == swaps.end())
+                    continue;
+                if (options.unique && packer->points[i].dupID < 0)
+                {
+                    packer->dupLookup.erase(packer->bitmaps[i]->hashValue);
+                    packer->dupLookup[replacement->second->hashValue] = static_cast<int>(i);
+                }
+                packer->bitmaps[i] = replacement->second;
+            }
+        }
+    }
+    else
+    {
+        for (auto packer : atlas.packers)
+            delete packer;
+        atlas.packers.clear();
+    }
+
+    for (auto &path : removed)
+    {
+        delete atlas.images[path].bitmap;
+        atlas.images.erase(path);
+    }
+    for (int i = 0; i < changed.size(); ++i)
+    {
+        CachedImage &image = atlas.images[files[changed[i]].path];
+        delete image.bitmap;
+        image = {files[changed[i]].name, times[changed[i]], sizes[changed[i]], decoded[i]};
+    }
+
+    if (!keepPacking)
+    {
+        // Repack from memory, in the same order as a normal run would
+        vector<Bitmap *> bitmaps;
+        for (auto &file : files)
+            bitmaps.push_back(atlas.images[file.path].bitmap);
+
+        string error;
+        if (!PackBitmaps(bitmaps, atlas.name, atlas.packers, error))
+        {
+            cerr << error << endl;
+            for (auto packer : atlas.packers)
+                delete packer;
+            atlas.packers.clear();
+            return;
+        }
+    }
+
+    // Save the textures whose pixels changed and remove the ones that aren't used anymore
+    fs::remove(atlas.outputName + ".hash");
+
+    bool noZero = options.noZero && atlas.packers.size() == 1;
+    string extension = TextureExtension();
+    for (size_t i = 0; i < atlas.pageHashes.size(); ++i)
+        if (i >= atlas.packers.size() || noZero != atlas.noZero)
+            fs::remove(atlas.outputName + (atlas.noZero ? "" : to_string(i)) + extension);
+
+    vector<uint64_t> pageHashes(atlas.packers.size());
+    int saved = 0;
+    for (size_t i = 0; i < atlas.packers.size(); ++i)
+    {
+        pageHashes[i] = PageHash(*atlas.packers[i]);
+        if (noZero == atlas.noZero && i < atlas.pageHashes.size() && pageHashes[i] == atlas.pageHashes[i])
+            continue;
+
+        // A page that failed to save gets a hash that's saved again on the next update
+        if (!SaveTexture(*atlas.packers[i], atlas.outputName + (noZero ? "" : to_string(i)) + extension))
+            pageHashes[i] = ~pageHashes[i];
+        else
+            ++saved;
+    }
+    atlas.pageHashes = pageHashes;
+    atlas.noZero = noZero;
+
+    SaveMetadata(atlas.packers, atlas.outputName, atlas.name, noZero, nullptr);
+
+    auto milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    Out() << "updated atlas: " << atlas.name << " (" << changed.size() << " images decoded, "
+          << (keepPacking ? "packing kept" : "repacked") << ", " << saved << '/' << atlas.packers.size()
+          << " textures saved, " << milliseconds << " ms)" << endl;
+}
+
+int WatchAtlas(const string &outputDirectory, const string &name, const vector<string> &inputs)
+{
+    WarmAtlas atlas;
+    atlas.outputName = outputDirectory.empty() ? name : outputDirectory + '/' + name;
+    atlas.name = name;
+    atlas.inputs = inputs;
+
+    // Image inputs are watched through their directories
+    vector<string> directories;
+    for (auto &input : inputs)
+    {
+        if (fs::is_directory(input))
+            directories.push_back(input);
+        else
+        {
+            string parent = fs::path(input).parent_path().string();
+            directories.push_back(parent.empty() ? "." : parent);
+        }
+    }
+
+    FileWatcher watcher;
+    for (auto &directory : directories)
+        watcher.Watch(directory);
+
+    fs::remove(atlas.outputName + ".hash");
+    RemoveAtlasFiles(atlas.outputName);
+    Update(atlas);
+
+    Out() << "watching for changes..." << endl;
+    while (true)
+    {
+        watcher.Wait();
+        for (auto &directory : directories)
+            watcher.Watch(directory);
+        Update(atlas);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef watch_hpp
+#define watch_hpp
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Wakes up when something changes in the watched directories, using inotify on Linux and polling elsewhere
+struct FileWatcher
+{
+    FileWatcher();
+    ~FileWatcher();
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // Watches a directory and its subdirectories, calling it again picks up new subdirectories
+    void Watch(const string &directory);
+
+    // Blocks until a change, then until the burst of events of saving a file has settled
+    void Wait();
+
+private:
+    int descriptor = -1;
+};
+
+// --watch: packs the atlas, then keeps the decoded bitmaps and the packing in memory and updates
+// the atlas whenever the inputs change. Doesn't return, it's stopped with Ctrl+C
+int WatchAtlas(const string &outputDirectory, const string &name, const vector<string> &inputs);
+
+#endif